@@ -0,0 +1,50 @@
+﻿// Commands.cpp
+#include "Commands.h"
+
+static bool isSpace(char ch) {
+    return ch == ' ' || ch == '\t' || ch == '\r' || ch == '\n';
+}
+
+static string_view trimView(string_view s) {
+    while (!s.empty() && isSpace(s.front())) s.remove_prefix(1);
+    while (!s.empty() && isSpace(s.back())) s.remove_suffix(1);
+    return s;
+}
+
+bool CommandArgs::parse(string_view line) {
+    line = trimView(line);
+    n = 0;
+    if (line.empty() || line[0] != '/') return false;
+
+    size_t end = 1;
+    while (end < line.size() && !isSpace(line[end])) end++;
+    cmd = line.substr(1, end - 1);
+    tail = trimView(line.substr(end));
+
+    size_t pos = 0;
+    while (n < MAX_WORDS) {
+        while (pos < tail.size() && isSpace(tail[pos])) pos++;
+        if (pos == tail.size()) break;
+        size_t stop = pos;
+        while (stop < tail.size() && !isSpace(tail[stop])) stop++;
+        words[n++] = tail.substr(pos, stop - pos);
+        pos = stop;
+    }
+    return true;
+}
+
+string_view CommandArgs::from(size_t i) const {
+    if (i >= n) return string_view();
+    // слова — view в tail, так что смещение считается по указателям
+    return tail.substr(static_cast<size_t>(words[i].data() - tail.data()));
+}
+
+// FNV-1a с подмешанным seed
+uint32_t commandHash(string_view name, uint32_t seed) {
+    uint32_t h = 2166136261u ^ (seed * 0x9E3779B9u);
+    for (unsigned char ch : name) {
+        h ^= ch;
+        h *= 16777619u;
+    }
+    return h;
+}
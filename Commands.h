@@ -0,0 +1,96 @@
+﻿// Commands.h
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+// Аргументы команды, уже разрезанные по пробелам: view в исходную строку,
+// живут ровно столько же, сколько она. Ничего не копируется.
+//   "/w bob  привет всем" → name "w", arg(0) "bob", from(1) "привет всем"
+class CommandArgs {
+public:
+    // false — строка не команда (не начинается с '/')
+    bool parse(string_view line);
+
+    string_view name() const { return cmd; }
+    size_t count() const { return n; }
+    // i-е слово после имени; нет такого — пусто
+    string_view arg(size_t i) const { return i < n ? words[i] : string_view(); }
+    // хвост строки начиная с i-го слова, как есть (текст сообщения с пробелами)
+    string_view from(size_t i) const;
+    // всё после имени команды
+    string_view rest() const { return tail; }
+
+private:
+    // больше слов ни одной команде не нужно; остальное доступно через from()
+    static const size_t MAX_WORDS = 8;
+
+    string_view cmd;
+    string_view tail;
+    string_view words[MAX_WORDS];
+    size_t n = 0;
+};
+
+uint32_t commandHash(string_view name, uint32_t seed);
+
+// Таблица команд: имя → обработчик. Заполняется один раз при старте,
+// после каждого add() подбирается seed, при котором у имён нет коллизий
+// (совершенный хэш), так что поиск — один хэш и одно сравнение строк
+// независимо от числа команд.
+template <class Handler>
+class CommandTable {
+public:
+    struct Entry {
+        string name;   // без '/'
+        Handler handler;
+        string usage;  // для /help; пусто — команда в справке не видна
+        string help;
+    };
+
+    void add(string name, Handler handler, string usage = "", string help = "") {
+        entries.push_back({ move(name), handler, move(usage), move(help) });
+        rebuild();
+    }
+
+    const Entry* find(string_view name) const {
+        if (slots.empty()) return nullptr;
+        const int idx = slots[commandHash(name, seed) & (slots.size() - 1)];
+        if (idx < 0 || entries[idx].name != name) return nullptr;
+        return &entries[idx];
+    }
+
+    // в порядке регистрации
+    const vector<Entry>& all() const { return entries; }
+
+private:
+    void rebuild() {
+        size_t size = 8;
+        while (size < 2 * entries.size()) size <<= 1;
+        for (;;) {
+            // обычно хватает нескольких seed'ов; не нашли — удваиваем таблицу
+            for (uint32_t s = 0; s < 256; s++) {
+                if (tryBuild(size, s)) return;
+            }
+            size <<= 1;
+        }
+    }
+
+    bool tryBuild(size_t size, uint32_t s) {
+        slots.assign(size, -1);
+        for (size_t i = 0; i < entries.size(); i++) {
+            int& slot = slots[commandHash(entries[i].name, s) & (size - 1)];
+            if (slot >= 0) return false;
+            slot = static_cast<int>(i);
+        }
+        seed = s;
+        return true;
+    }
+
+    vector<Entry> entries;
+    vector<int> slots;
+    uint32_t seed = 0;
+};
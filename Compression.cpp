@@ -0,0 +1,111 @@
+﻿// Compression.cpp
+#include "Compression.h"
+
+#if defined(__has_include)
+#if __has_include(<zlib.h>)
+#define CHAT_HAVE_ZLIB 1
+#endif
+#endif
+
+#ifdef CHAT_HAVE_ZLIB
+#include <zlib.h>
+#ifdef _MSC_VER
+#pragma comment(lib, "zlib.lib")
+#endif
+
+// окно 8К и memLevel 6: ~50 КБ на сжимаемое соединение вместо ~260 КБ по умолчанию;
+// строки чата короткие и повторяются близко, большое окно почти ничего не даёт
+static const int DEFLATE_WINDOW_BITS = 13;
+static const int DEFLATE_MEM_LEVEL = 6;
+static const size_t ZCHUNK = 16 * 1024;
+
+bool compressionAvailable() { return true; }
+
+struct Deflater::Impl {
+    z_stream z{};
+    bool ready = false;
+    ~Impl() { if (ready) deflateEnd(&z); }
+};
+
+Deflater::Deflater() : impl(new Impl) {}
+Deflater::~Deflater() = default;
+
+bool Deflater::init(int level) {
+    if (impl->ready) return true;
+    if (deflateInit2(&impl->z, level, Z_DEFLATED, DEFLATE_WINDOW_BITS, DEFLATE_MEM_LEVEL,
+        Z_DEFAULT_STRATEGY) != Z_OK) return false;
+    impl->ready = true;
+    return true;
+}
+
+bool Deflater::write(const char* data, size_t len, string& out, bool flush) {
+    if (!impl->ready) return false;
+    z_stream& z = impl->z;
+    z.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    z.avail_in = (uInt)len;
+    // при Z_SYNC_FLUSH зовём deflate, пока он не оставит места в выходном буфере
+    while (true) {
+        const size_t before = out.size();
+        out.resize(before + ZCHUNK);
+        z.next_out = reinterpret_cast<Bytef*>(&out[before]);
+        z.avail_out = (uInt)ZCHUNK;
+        const int rc = deflate(&z, flush ? Z_SYNC_FLUSH : Z_NO_FLUSH);
+        out.resize(before + (ZCHUNK - z.avail_out));
+        if (rc == Z_STREAM_ERROR) return false;
+        if (z.avail_out != 0 && z.avail_in == 0) return true;
+    }
+}
+
+struct Inflater::Impl {
+    z_stream z{};
+    bool ready = false;
+    ~Impl() { if (ready) inflateEnd(&z); }
+};
+
+Inflater::Inflater() : impl(new Impl) {}
+Inflater::~Inflater() = default;
+
+bool Inflater::init() {
+    if (impl->ready) return true;
+    // окно 15 разжимает поток с любым окном поменьше
+    if (inflateInit2(&impl->z, 15) != Z_OK) return false;
+    impl->ready = true;
+    return true;
+}
+
+bool Inflater::write(const char* data, size_t len, string& out) {
+    if (!impl->ready) return false;
+    z_stream& z = impl->z;
+    z.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    z.avail_in = (uInt)len;
+    while (true) {
+        const size_t before = out.size();
+        out.resize(before + ZCHUNK);
+        z.next_out = reinterpret_cast<Bytef*>(&out[before]);
+        z.avail_out = (uInt)ZCHUNK;
+        const int rc = inflate(&z, Z_SYNC_FLUSH);
+        out.resize(before + (ZCHUNK - z.avail_out));
+        if (rc == Z_BUF_ERROR) return true; // всё пришедшее уже разжато
+        if (rc != Z_OK) return false;       // Z_STREAM_END сервер не шлёт — это тоже порча
+        if (z.avail_out != 0 && z.avail_in == 0) return true;
+    }
+}
+
+#else
+
+// сборка без zlib: сжатие не договаривается, все соединения идут как есть
+bool compressionAvailable() { return false; }
+
+struct Deflater::Impl {};
+Deflater::Deflater() = default;
+Deflater::~Deflater() = default;
+bool Deflater::init(int) { return false; }
+bool Deflater::write(const char*, size_t, string&, bool) { return false; }
+
+struct Inflater::Impl {};
+Inflater::Inflater() = default;
+Inflater::~Inflater() = default;
+bool Inflater::init() { return false; }
+bool Inflater::write(const char*, size_t, string&) { return false; }
+
+#endif
@@ -0,0 +1,52 @@
+﻿// Compression.h
+#pragma once
+#include <string>
+#include <memory>
+
+using namespace std;
+
+// Сжатие потока сервер -> клиент (deflate, zlib).
+// Клиент самой первой строкой шлёт COMPRESS_HELLO (до "CHAT/2" и до логина),
+// сервер отвечает несжатой строкой COMPRESS_ACK или COMPRESS_NAK — и после ACK
+// всё, что он пишет в это соединение, идёт одним сжатым потоком. Поток
+// сбрасывается (Z_SYNC_FLUSH) после каждой пачки, так что клиент может
+// разжать всё пришедшее, не дожидаясь следующей. Клиент -> сервер не сжимается.
+#define COMPRESS_HELLO "COMPRESS deflate"
+#define COMPRESS_ACK   "COMPRESS OK"
+#define COMPRESS_NAK   "COMPRESS NO"
+
+// собрано ли с zlib; без него сервер на COMPRESS_HELLO отвечает отказом
+bool compressionAvailable();
+
+// Сжимающая половина: своё окно словаря на каждое соединение
+class Deflater {
+public:
+    Deflater();
+    ~Deflater();
+
+    // level 1..9; false — zlib нет или не хватило памяти
+    bool init(int level);
+
+    // дописать сжатое len байт в out; flush — закрыть пачку, чтобы клиент увидел всё сразу
+    bool write(const char* data, size_t len, string& out, bool flush);
+
+private:
+    struct Impl;
+    unique_ptr<Impl> impl;
+};
+
+// Разжимающая половина (клиент)
+class Inflater {
+public:
+    Inflater();
+    ~Inflater();
+
+    bool init();
+
+    // разжать всё пришедшее в out; false — поток испорчен
+    bool write(const char* data, size_t len, string& out);
+
+private:
+    struct Impl;
+    unique_ptr<Impl> impl;
+};
@@ -0,0 +1,72 @@
+﻿// Coro.h
+#pragma once
+#include <coroutine>
+#include <exception>
+#include <vector>
+
+using namespace std;
+
+// Сопрограммы поверх реактора (C++20): шаг соединения, которому надо
+// подождать (очереди, таймера, следующего оборота цикла), пишется прямым
+// кодом с co_await, а не разрезается на состояния и колбэки.
+// Поток на клиента не нужен: приостановленная сопрограмма — это кадр в куче
+// и запись в списке ждущих, возобновляет её сам реактор в своём потоке.
+
+// «Запустил и забыл»: стартует сразу, по завершении освобождает кадр сама
+struct Task {
+    struct promise_type {
+        Task get_return_object() noexcept { return {}; }
+        suspend_never initial_suspend() noexcept { return {}; }
+        suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { terminate(); }
+    };
+};
+
+// Список ждущих сопрограмм. wake() никого не возобновляет на месте (можно
+// оказаться посреди обхода соединений), а переносит ждущих в список, который
+// реактор возобновит в безопасной точке цикла.
+class WaitList {
+public:
+    struct Awaiter {
+        WaitList& list;
+        bool ok = true;
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(coroutine_handle<> h) { list.waiters.push_back(Entry{ h, &ok }); }
+        // false — ждать было нечего: соединение закрыли, пока сопрограмма спала
+        bool await_resume() const noexcept { return ok; }
+    };
+
+    Awaiter wait() { return Awaiter{ *this }; }
+    bool empty() const { return waiters.empty(); }
+
+    // перенести всех ждущих в to; ok = false — разбудить с отказом
+    void wake(WaitList& to, bool ok = true) {
+        for (auto& e : waiters) {
+            if (!ok) *e.ok = false;
+            to.waiters.push_back(e);
+        }
+        waiters.clear();
+    }
+
+    // возобновить всех; вставшие в очередь заново во время обхода ждут следующего раза
+    void resumeAll() {
+        vector<Entry> batch;
+        batch.swap(waiters);
+        for (auto& e : batch) e.h.resume();
+    }
+
+    // реактор закрывается: кадры освобождаем, не возобновляя
+    void destroyAll() {
+        for (auto& e : waiters) e.h.destroy();
+        waiters.clear();
+    }
+
+private:
+    struct Entry {
+        coroutine_handle<> h;
+        bool* ok;
+    };
+    vector<Entry> waiters;
+};
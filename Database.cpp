@@ -69,11 +69,38 @@ bool Database::init() {
         sqlite3_free(errMsg);
         return false;
     }
+
+    // комнаты: колонка появилась позже таблицы — добавляем, если её нет (повторный ALTER просто вернёт ошибку)
+    sqlite3_exec(db, "ALTER TABLE messages ADD COLUMN room TEXT;", nullptr, nullptr, nullptr);
+    // своя «лента» у каждой комнаты: история комнаты читается по индексу, без обхода всей таблицы
+    if (sqlite3_exec(db, "CREATE INDEX IF NOT EXISTS idx_messages_room ON messages(room, id);",
+        nullptr, nullptr, &errMsg) != SQLITE_OK) {
+        cerr << "Ошибка SQL (room index): " << errMsg << endl;
+        sqlite3_free(errMsg);
+        return false;
+    }
+    // отложенные личные: очередь по адресату и курсор подтверждённой доставки
+    const char* createOffline =
+        "CREATE TABLE IF NOT EXISTS offline_messages ("
+        "id INTEGER PRIMARY KEY AUTOINCREMENT, "
+        "recipient TEXT NOT NULL, "
+        "sender TEXT, "
+        "text TEXT);"
+        "CREATE INDEX IF NOT EXISTS idx_offline_recipient ON offline_messages(recipient, id);"
+        "CREATE TABLE IF NOT EXISTS offline_cursor ("
+        "login TEXT PRIMARY KEY, "
+        "acked INTEGER NOT NULL DEFAULT 0);";
+    if (sqlite3_exec(db, createOffline, nullptr, nullptr, &errMsg) != SQLITE_OK) {
+        cerr << "Ошибка SQL (offline): " << errMsg << endl;
+        sqlite3_free(errMsg);
+        return false;
+    }
     cout << "База готова.\n";
     return true;
 }
 
 bool Database::addUser(const string& login, const string& password, const string& name) {
+    lock_guard<mutex> lock(mtx);
     if (!db) return false;
 
     // Храним уже ХЕШ, а не открытый пароль
@@ -90,11 +117,14 @@ bool Database::addUser(const string& login, const string& password, const string
     sqlite3_bind_text(stmt, 3, name.c_str(), -1, SQLITE_STATIC);
 
     bool ok = (sqlite3_step(stmt) == SQLITE_DONE);
+    // INSERT OR IGNORE на существующий логин строку не добавляет — кеш списка не трогаем
+    if (ok && sqlite3_changes(db) > 0) usersVer++;
     sqlite3_finalize(stmt);
     return ok;
 }
 
 bool Database::checkUser(const string& login, const string& password) {
+    lock_guard<mutex> lock(mtx);
     if (!db) return false;
 
     // 1) читаем, что лежит в поле password
@@ -141,9 +171,11 @@ bool Database::checkUser(const string& login, const string& password) {
     }
 }
 
-bool Database::addMessage(const string& sender, const string& recipient, const string& text) {
+bool Database::addMessage(const string& sender, const string& recipient, const string& text,
+    const string& room) {
+    lock_guard<mutex> lock(mtx);
     if (!db) return false;
-    const char* sql = "INSERT INTO messages (sender, recipient, text) VALUES (?, ?, ?);";
+    const char* sql = "INSERT INTO messages (sender, recipient, text, room) VALUES (?, ?, ?, ?);";
     sqlite3_stmt* stmt;
     if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
         cerr << "Ошибка подготовки запроса addMessage\n";
@@ -157,13 +189,58 @@ bool Database::addMessage(const string& sender, const string& recipient, const s
         sqlite3_bind_text(stmt, 2, recipient.c_str(), -1, SQLITE_STATIC);
     }
     sqlite3_bind_text(stmt, 3, text.c_str(), -1, SQLITE_TRANSIENT);
+    if (room.empty()) {
+        sqlite3_bind_null(stmt, 4);
+    }
+    else {
+        sqlite3_bind_text(stmt, 4, room.c_str(), -1, SQLITE_STATIC);
+    }
 
     bool ok = (sqlite3_step(stmt) == SQLITE_DONE);
     sqlite3_finalize(stmt);
     return ok;
 }
 
+bool Database::addMessages(const vector<Message>& batch, vector<int>* ids) {
+    lock_guard<mutex> lock(mtx);
+    if (ids) ids->assign(batch.size(), 0);
+    if (!db) return false;
+    if (batch.empty()) return true;
+
+    const char* sql = "INSERT INTO messages (sender, recipient, text, room) VALUES (?, ?, ?, ?);";
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        cerr << "Ошибка подготовки запроса addMessages\n";
+        return false;
+    }
+    sqlite3_exec(db, "BEGIN;", nullptr, nullptr, nullptr);
+    bool ok = true;
+    vector<int> rows(batch.size(), 0);
+    for (size_t i = 0; i < batch.size(); i++) {
+        const Message& m = batch[i];
+        sqlite3_bind_text(stmt, 1, m.sender.c_str(), -1, SQLITE_STATIC);
+        if (m.recipient.empty()) sqlite3_bind_null(stmt, 2);
+        else sqlite3_bind_text(stmt, 2, m.recipient.c_str(), -1, SQLITE_STATIC);
+        sqlite3_bind_text(stmt, 3, m.text.c_str(), -1, SQLITE_STATIC);
+        if (m.room.empty()) sqlite3_bind_null(stmt, 4);
+        else sqlite3_bind_text(stmt, 4, m.room.c_str(), -1, SQLITE_STATIC);
+        if (sqlite3_step(stmt) == SQLITE_DONE) rows[i] = (int)sqlite3_last_insert_rowid(db);
+        ok = rows[i] != 0 && ok;
+        sqlite3_reset(stmt);
+    }
+    sqlite3_finalize(stmt);
+    // одна битая строка не должна терять всю пачку: коммитим то, что вставилось
+    if (sqlite3_exec(db, "COMMIT;", nullptr, nullptr, nullptr) != SQLITE_OK) {
+        cerr << "Ошибка фиксации пачки сообщений: " << sqlite3_errmsg(db) << endl;
+        sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
+        return false;
+    }
+    if (ids) ids->swap(rows);
+    return ok;
+}
+
 vector<Message> Database::getAllMessages() {
+    lock_guard<mutex> lock(mtx);
     vector<Message> result;
     if (!db) return result;
 
@@ -193,6 +270,167 @@ vector<Message> Database::getAllMessages() {
     return result;
 }
 
+vector<Message> Database::getHistoryChunk(const string& login, const string& room,
+    int afterId, int upToId, size_t limit) {
+    lock_guard<mutex> lock(mtx);
+    vector<Message> result;
+    if (!db) return result;
+
+    // видимость фильтрует SQLite, а не мы: наружу выходят только нужные строки
+    const char* lobbySql =
+        "SELECT id, sender, recipient, text, room FROM messages "
+        "WHERE id > ? AND id <= ? AND room IS NULL "
+        "AND (recipient IS NULL OR recipient = '' OR sender = ? OR recipient = ?) "
+        "ORDER BY id LIMIT ?;";
+    const char* roomSql =
+        "SELECT id, sender, recipient, text, room FROM messages "
+        "WHERE id > ? AND id <= ? AND room = ? "
+        "ORDER BY id LIMIT ?;";
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v2(db, room.empty() ? lobbySql : roomSql, -1, &stmt, nullptr) != SQLITE_OK) {
+        cerr << "Ошибка подготовки запроса getHistoryChunk\n";
+        return result;
+    }
+    int n = 1;
+    sqlite3_bind_int(stmt, n++, afterId);
+    sqlite3_bind_int(stmt, n++, upToId);
+    if (room.empty()) {
+        sqlite3_bind_text(stmt, n++, login.c_str(), -1, SQLITE_STATIC);
+        sqlite3_bind_text(stmt, n++, login.c_str(), -1, SQLITE_STATIC);
+    }
+    else {
+        sqlite3_bind_text(stmt, n++, room.c_str(), -1, SQLITE_STATIC);
+    }
+    sqlite3_bind_int64(stmt, n, (sqlite3_int64)limit);
+
+    result.reserve(limit);
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        Message m;
+        m.id = sqlite3_column_int(stmt, 0);
+        const unsigned char* s = sqlite3_column_text(stmt, 1);
+        m.sender = s ? reinterpret_cast<const char*>(s) : "";
+        const unsigned char* r = sqlite3_column_text(stmt, 2);
+        m.recipient = r ? reinterpret_cast<const char*>(r) : "";
+        const unsigned char* t = sqlite3_column_text(stmt, 3);
+        m.text = t ? reinterpret_cast<const char*>(t) : "";
+        const unsigned char* rm = sqlite3_column_text(stmt, 4);
+        m.room = rm ? reinterpret_cast<const char*>(rm) : "";
+        result.push_back(move(m));
+    }
+    sqlite3_finalize(stmt);
+    return result;
+}
+
+int Database::lastMessageId() {
+    lock_guard<mutex> lock(mtx);
+    if (!db) return 0;
+
+    const char* sql = "SELECT MAX(id) FROM messages;";
+    sqlite3_stmt* stmt = nullptr;
+    int id = 0;
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) == SQLITE_OK) {
+        if (sqlite3_step(stmt) == SQLITE_ROW) id = sqlite3_column_int(stmt, 0);
+        sqlite3_finalize(stmt);
+    }
+    return id;
+}
+
+bool Database::addOfflineMessage(const string& sender, const string& recipient, const string& text) {
+    lock_guard<mutex> lock(mtx);
+    if (!db) return false;
+    const char* sql = "INSERT INTO offline_messages (recipient, sender, text) VALUES (?, ?, ?);";
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        cerr << "Ошибка подготовки запроса addOfflineMessage\n";
+        return false;
+    }
+    sqlite3_bind_text(stmt, 1, recipient.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, sender.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 3, text.c_str(), -1, SQLITE_STATIC);
+    bool ok = (sqlite3_step(stmt) == SQLITE_DONE);
+    sqlite3_finalize(stmt);
+    return ok;
+}
+
+vector<Message> Database::getOfflineChunk(const string& login, int afterId, size_t limit) {
+    lock_guard<mutex> lock(mtx);
+    vector<Message> result;
+    if (!db) return result;
+
+    // только по индексу (recipient, id): чужие очереди и общая история не читаются
+    const char* sql =
+        "SELECT id, sender, text FROM offline_messages "
+        "WHERE recipient = ? AND id > ? ORDER BY id LIMIT ?;";
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        cerr << "Ошибка подготовки запроса getOfflineChunk\n";
+        return result;
+    }
+    sqlite3_bind_text(stmt, 1, login.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_int(stmt, 2, afterId);
+    sqlite3_bind_int64(stmt, 3, (sqlite3_int64)limit);
+
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        Message m;
+        m.id = sqlite3_column_int(stmt, 0);
+        const unsigned char* s = sqlite3_column_text(stmt, 1);
+        m.sender = s ? reinterpret_cast<const char*>(s) : "";
+        m.recipient = login;
+        const unsigned char* t = sqlite3_column_text(stmt, 2);
+        m.text = t ? reinterpret_cast<const char*>(t) : "";
+        result.push_back(move(m));
+    }
+    sqlite3_finalize(stmt);
+    return result;
+}
+
+int Database::offlineCursor(const string& login) {
+    lock_guard<mutex> lock(mtx);
+    if (!db) return 0;
+
+    const char* sql = "SELECT acked FROM offline_cursor WHERE login=?;";
+    sqlite3_stmt* stmt = nullptr;
+    int id = 0;
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) == SQLITE_OK) {
+        sqlite3_bind_text(stmt, 1, login.c_str(), -1, SQLITE_STATIC);
+        if (sqlite3_step(stmt) == SQLITE_ROW) id = sqlite3_column_int(stmt, 0);
+        sqlite3_finalize(stmt);
+    }
+    return id;
+}
+
+bool Database::ackOffline(const string& login, int upToId) {
+    lock_guard<mutex> lock(mtx);
+    if (!db) return false;
+
+    // курсор только растёт: повторный или запоздавший ack назад не откатывает
+    const char* upd =
+        "INSERT OR REPLACE INTO offline_cursor (login, acked) VALUES "
+        "(?1, MAX(?2, COALESCE((SELECT acked FROM offline_cursor WHERE login = ?1), 0)));";
+    const char* del = "DELETE FROM offline_messages WHERE recipient = ? AND id <= ?;";
+    sqlite3_stmt* stmt = nullptr;
+    sqlite3_exec(db, "BEGIN;", nullptr, nullptr, nullptr);
+    bool ok = sqlite3_prepare_v2(db, upd, -1, &stmt, nullptr) == SQLITE_OK;
+    if (ok) {
+        sqlite3_bind_text(stmt, 1, login.c_str(), -1, SQLITE_STATIC);
+        sqlite3_bind_int(stmt, 2, upToId);
+        ok = sqlite3_step(stmt) == SQLITE_DONE;
+        sqlite3_finalize(stmt);
+    }
+    if (ok && sqlite3_prepare_v2(db, del, -1, &stmt, nullptr) == SQLITE_OK) {
+        sqlite3_bind_text(stmt, 1, login.c_str(), -1, SQLITE_STATIC);
+        sqlite3_bind_int(stmt, 2, upToId);
+        ok = sqlite3_step(stmt) == SQLITE_DONE;
+        sqlite3_finalize(stmt);
+    }
+    if (!ok || sqlite3_exec(db, "COMMIT;", nullptr, nullptr, nullptr) != SQLITE_OK) {
+        cerr << "Ошибка подтверждения отложенных сообщений: " << sqlite3_errmsg(db) << endl;
+        sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
+        return false;
+    }
+    return true;
+}
+
 void Database::printAllMessages() {
     for (const auto& m : getAllMessages()) {
         cout << "[" << m.id << "] " << m.sender << " -> "
@@ -202,6 +440,7 @@ void Database::printAllMessages() {
 } // ← закрываем функцию тут!
 
 vector<string> Database::getAllUsers() {
+    lock_guard<mutex> lock(mtx);
     vector<string> users;
     if (!db) return users;
 
@@ -222,3 +461,61 @@ vector<string> Database::getAllUsers() {
     return users;
 }
 
+int Database::getUserId(const string& login) {
+    lock_guard<mutex> lock(mtx);
+    if (!db) return 0;
+
+    const char* sql = "SELECT id FROM users WHERE login=?;";
+    sqlite3_stmt* stmt = nullptr;
+    int id = 0;
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) == SQLITE_OK) {
+        sqlite3_bind_text(stmt, 1, login.c_str(), -1, SQLITE_STATIC);
+        if (sqlite3_step(stmt) == SQLITE_ROW) id = sqlite3_column_int(stmt, 0);
+        sqlite3_finalize(stmt);
+    }
+    else {
+        cerr << "Ошибка подготовки запроса getUserId\n";
+    }
+    return id;
+}
+
+string Database::getUserLogin(int id) {
+    lock_guard<mutex> lock(mtx);
+    if (!db) return "";
+
+    const char* sql = "SELECT login FROM users WHERE id=?;";
+    sqlite3_stmt* stmt = nullptr;
+    string login;
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) == SQLITE_OK) {
+        sqlite3_bind_int(stmt, 1, id);
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            const unsigned char* p = sqlite3_column_text(stmt, 0);
+            login = p ? reinterpret_cast<const char*>(p) : "";
+        }
+        sqlite3_finalize(stmt);
+    }
+    else {
+        cerr << "Ошибка подготовки запроса getUserLogin\n";
+    }
+    return login;
+}
+
+vector<pair<int, string>> Database::getUsersWithIds() {
+    lock_guard<mutex> lock(mtx);
+    vector<pair<int, string>> users;
+    if (!db) return users;
+
+    const char* sql = "SELECT id, login FROM users ORDER BY login;";
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) == SQLITE_OK) {
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            const unsigned char* login = sqlite3_column_text(stmt, 1);
+            if (login) users.emplace_back(sqlite3_column_int(stmt, 0), reinterpret_cast<const char*>(login));
+        }
+        sqlite3_finalize(stmt);
+    }
+    else {
+        cerr << "Ошибка подготовки запроса getUsersWithIds\n";
+    }
+    return users;
+}
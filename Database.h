@@ -2,6 +2,10 @@
 #pragma once
 #include <string>
 #include <vector>
+#include <utility>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
 #include "sqlite3.h"
 
 using namespace std;
@@ -12,11 +16,14 @@ struct Message {
     string sender;
     string recipient;
     string text;
+    string room; // пусто — общий чат
 };
 
 class Database {
 private:
     sqlite3* db;
+    mutex mtx; // одно соединение на все потоки сервера — запросы идут по очереди
+    atomic<uint64_t> usersVer{ 0 }; // растёт при каждой реально добавленной строке users
 
 public:
     Database(const string& filename);
@@ -27,9 +34,36 @@ public:
     bool addUser(const string& login, const string& password, const string& name);
     bool checkUser(const string& login, const string& password);
 
-    bool addMessage(const string& sender, const string& recipient, const string& text);
+    bool addMessage(const string& sender, const string& recipient, const string& text,
+        const string& room = "");
+    // пачка сообщений одной транзакцией: один fsync на всю пачку, запрос готовится один раз;
+    // ids (если задан) — id каждой строки в базе, 0 — строка не легла
+    bool addMessages(const vector<Message>& batch, vector<int>* ids = nullptr);
     vector<Message> getAllMessages();
 
+    // история для login порциями: видимые ему сообщения с id в (afterId, upToId],
+    // не больше limit штук; курсор — id последнего полученного.
+    // room пусто — общий чат и личные, иначе — только сообщения комнаты
+    vector<Message> getHistoryChunk(const string& login, const string& room,
+        int afterId, int upToId, size_t limit);
+    int lastMessageId();
+
+    // личные сообщения тем, кто не в сети: своя очередь на каждого адресата
+    // (индекс по recipient, id), выдаётся при входе порциями после курсора
+    bool addOfflineMessage(const string& sender, const string& recipient, const string& text);
+    vector<Message> getOfflineChunk(const string& login, int afterId, size_t limit);
+    // id последнего подтверждённого клиентом; с него начинается выдача при входе
+    int offlineCursor(const string& login);
+    // клиент подтвердил всё до upToId: двигаем курсор, доставленное удаляем
+    bool ackOffline(const string& login, int upToId);
+
     void printAllMessages();
     vector<string> getAllUsers();
+    // поменялся ли список пользователей с прошлого раза (для кеша [USERS])
+    uint64_t usersVersion() const { return usersVer.load(); }
+
+    // числовые id пользователей (для бинарного протокола); 0 — нет такого
+    int getUserId(const string& login);
+    string getUserLogin(int id); // пусто — нет такого
+    vector<pair<int, string>> getUsersWithIds();
 };
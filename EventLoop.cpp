@@ -0,0 +1,163 @@
+﻿// EventLoop.cpp
+#include "EventLoop.h"
+#include "IoUring.h"
+#include <map>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+#ifndef _WIN32
+#include <sys/select.h>
+#include <errno.h>
+#endif
+
+// ---------------------------------------------------------------------
+// select(): запасной бэкенд, работает везде, но ограничен FD_SETSIZE
+// и на POSIX обходит все сокеты при каждом пробуждении
+// ---------------------------------------------------------------------
+class SelectLoop : public EventLoop {
+public:
+    SelectLoop() {
+        FD_ZERO(&readSet);
+        FD_ZERO(&writeSet);
+    }
+
+    bool add(SOCKET s, unsigned flags) override {
+#ifdef _WIN32
+        if (interest.size() >= FD_SETSIZE) return false;
+#else
+        if (s >= FD_SETSIZE) return false;
+#endif
+        interest[s] = 0;
+        apply(s, flags);
+        return true;
+    }
+
+    bool modify(SOCKET s, unsigned flags) override {
+        if (!interest.count(s)) return false;
+        apply(s, flags);
+        return true;
+    }
+
+    void remove(SOCKET s) override {
+        if (!interest.erase(s)) return;
+        FD_CLR(s, &readSet);
+        FD_CLR(s, &writeSet);
+    }
+
+    int wait(vector<IoEvent>& out, int timeoutMs) override {
+        out.clear();
+        fd_set rd = readSet;
+        fd_set wr = writeSet;
+
+        timeval tv{};
+        timeval* ptv = nullptr;
+        if (timeoutMs >= 0) {
+            tv.tv_sec = timeoutMs / 1000;
+            tv.tv_usec = (timeoutMs % 1000) * 1000;
+            ptv = &tv;
+        }
+
+#ifdef _WIN32
+        // Winsock не умеет select() с пустыми наборами
+        if (rd.fd_count == 0 && wr.fd_count == 0) {
+            Sleep(timeoutMs < 0 ? 10 : timeoutMs);
+            return 0;
+        }
+        int n = select(0, &rd, &wr, nullptr, ptv);
+        if (n == SOCKET_ERROR) return -1;
+        // Winsock возвращает готовые сокеты прямо в fd_array — обходить всех не нужно
+        for (u_int i = 0; i < rd.fd_count; i++) out.push_back({ rd.fd_array[i], IO_READ });
+        for (u_int i = 0; i < wr.fd_count; i++) out.push_back({ wr.fd_array[i], IO_WRITE });
+#else
+        const int maxFd = interest.empty() ? -1 : interest.rbegin()->first;
+        int n = select(maxFd + 1, &rd, &wr, nullptr, ptv);
+        if (n < 0) return errno == EINTR ? 0 : -1;
+        for (const auto& kv : interest) {
+            if (n == 0) break;
+            if (FD_ISSET(kv.first, &rd)) { out.push_back({ kv.first, IO_READ }); n--; }
+            if (FD_ISSET(kv.first, &wr)) { out.push_back({ kv.first, IO_WRITE }); n--; }
+        }
+#endif
+        return (int)out.size();
+    }
+
+    const char* name() const override { return "select"; }
+
+private:
+    void apply(SOCKET s, unsigned flags) {
+        if (flags & IO_READ) FD_SET(s, &readSet); else FD_CLR(s, &readSet);
+        if (flags & IO_WRITE) FD_SET(s, &writeSet); else FD_CLR(s, &writeSet);
+        interest[s] = flags;
+    }
+
+    fd_set readSet;
+    fd_set writeSet;
+    map<SOCKET, unsigned> interest; // упорядочено — максимальный fd берём из rbegin()
+};
+
+#ifdef __linux__
+// ---------------------------------------------------------------------
+// epoll в edge-triggered режиме: стоимость пробуждения зависит
+// только от числа готовых сокетов, а не от общего числа соединений
+// ---------------------------------------------------------------------
+class EpollLoop : public EventLoop {
+public:
+    EpollLoop() : epfd(epoll_create1(EPOLL_CLOEXEC)), ready(1024) {}
+    ~EpollLoop() override { if (epfd >= 0) close(epfd); }
+
+    bool ok() const { return epfd >= 0; }
+
+    bool add(SOCKET s, unsigned flags) override { return ctl(EPOLL_CTL_ADD, s, flags); }
+    bool modify(SOCKET s, unsigned flags) override { return ctl(EPOLL_CTL_MOD, s, flags); }
+    void remove(SOCKET s) override { epoll_ctl(epfd, EPOLL_CTL_DEL, s, nullptr); }
+
+    int wait(vector<IoEvent>& out, int timeoutMs) override {
+        out.clear();
+        int n = epoll_wait(epfd, ready.data(), (int)ready.size(), timeoutMs);
+        if (n < 0) return errno == EINTR ? 0 : -1;
+        for (int i = 0; i < n; i++) {
+            const uint32_t e = ready[i].events;
+            unsigned flags = 0;
+            if (e & (EPOLLIN | EPOLLRDHUP)) flags |= IO_READ;
+            if (e & EPOLLOUT) flags |= IO_WRITE;
+            // при ошибке/обрыве отдаём ещё и IO_READ: recv вернёт 0/-1, и клиент закроется штатно
+            if (e & (EPOLLERR | EPOLLHUP)) flags |= IO_ERROR | IO_READ;
+            out.push_back({ ready[i].data.fd, flags });
+        }
+        // буфер заполнился целиком — в следующий раз берём больше
+        if (n == (int)ready.size()) ready.resize(ready.size() * 2);
+        return n;
+    }
+
+    const char* name() const override { return "epoll"; }
+
+private:
+    bool ctl(int op, SOCKET s, unsigned flags) {
+        epoll_event ev{};
+        ev.events = EPOLLET | EPOLLRDHUP;
+        if (flags & IO_READ) ev.events |= EPOLLIN;
+        if (flags & IO_WRITE) ev.events |= EPOLLOUT;
+        ev.data.fd = s;
+        return epoll_ctl(epfd, op, s, &ev) == 0;
+    }
+
+    int epfd;
+    vector<epoll_event> ready;
+};
+#endif
+
+unique_ptr<EventLoop> makeEventLoop(const string& backend) {
+    // io_uring только по явной просьбе; не поддерживается ядром — тихо уходим на epoll.
+    // "io_uring" — прежнее имя того же бэкенда, чтобы не ломать старые config.txt
+    if (backend == "io_uring_poll" || backend == "io_uring") {
+        if (auto ring = makeIoUringLoop()) return ring;
+    }
+#ifdef __linux__
+    if (backend != "select") {
+        auto ep = make_unique<EpollLoop>();
+        if (ep->ok()) return ep;
+    }
+#endif
+    return make_unique<SelectLoop>();
+}
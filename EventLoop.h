@@ -0,0 +1,42 @@
+﻿// EventLoop.h
+#pragma once
+#include <memory>
+#include <string>
+#include <vector>
+#include "NetUtils.h"
+
+using namespace std;
+
+// флаги интереса (add/modify) и готовности (IoEvent::flags)
+enum IoFlags : unsigned {
+    IO_READ = 1,
+    IO_WRITE = 2,
+    IO_ERROR = 4,   // только в событиях: ошибка или обрыв соединения
+};
+
+struct IoEvent {
+    SOCKET sock;
+    unsigned flags;
+};
+
+// Цикл событий с подменяемым бэкендом.
+// Бэкенд может быть edge-triggered (epoll), поэтому по событию IO_READ
+// обработчик обязан читать сокет, пока recv не вернёт EWOULDBLOCK.
+class EventLoop {
+public:
+    virtual ~EventLoop() = default;
+
+    virtual bool add(SOCKET s, unsigned flags) = 0;
+    virtual bool modify(SOCKET s, unsigned flags) = 0;
+    virtual void remove(SOCKET s) = 0;
+
+    // ждёт готовые сокеты (timeoutMs < 0 — без таймаута);
+    // возвращает число событий в out или -1 при ошибке
+    virtual int wait(vector<IoEvent>& out, int timeoutMs) = 0;
+
+    virtual const char* name() const = 0;
+};
+
+// backend: "epoll", "select", "io_uring_poll" (Linux 5.13+, иначе epoll; тоже только готовность,
+// старое имя "io_uring" — то же самое) или пусто/"auto" — лучший доступный на платформе
+unique_ptr<EventLoop> makeEventLoop(const string& backend);
@@ -0,0 +1,77 @@
+﻿// FanoutPool.cpp
+#include "FanoutPool.h"
+#include <algorithm>
+
+void FanoutPool::start(size_t n) {
+    stopping = false;
+    for (size_t i = 0; i < n; i++) workers.emplace_back([this] { workerLoop(); });
+}
+
+void FanoutPool::stop() {
+    {
+        lock_guard<mutex> lock(mtx);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto& t : workers) t.join();
+    workers.clear();
+}
+
+void FanoutPool::workerLoop() {
+    unique_lock<mutex> lock(mtx);
+    while (true) {
+        wake.wait(lock, [&] { return stopping || !tasks.empty(); });
+        if (tasks.empty()) return;
+        auto task = move(tasks.front());
+        tasks.pop_front();
+        lock.unlock();
+        task();
+        lock.lock();
+    }
+}
+
+void FanoutPool::parallelFor(size_t n, size_t slices, const function<void(size_t, size_t, size_t)>& job) {
+    slices = min(slices, workers.size() + 1);
+    if (slices <= 1 || n < slices) {
+        job(0, 0, n);
+        return;
+    }
+
+    // защёлка на эту рассылку: пул общий, одновременно могут раздавать несколько реакторов
+    struct Latch {
+        mutex m;
+        condition_variable cv;
+        size_t left;
+    };
+    Latch latch;
+    latch.left = slices - 1;
+
+    const size_t step = (n + slices - 1) / slices;
+    {
+        lock_guard<mutex> lock(mtx);
+        for (size_t s = 1; s < slices; s++) {
+            const size_t b = s * step, e = min(n, b + step);
+            tasks.push_back([&job, &latch, s, b, e] {
+                if (b < e) job(s, b, e);
+                lock_guard<mutex> l(latch.m);
+                if (--latch.left == 0) latch.cv.notify_one();
+            });
+        }
+    }
+    wake.notify_all();
+
+    // первый кусок — сами, потом помогаем разбирать очередь, пока есть что
+    job(0, 0, min(n, step));
+    while (true) {
+        function<void()> task;
+        {
+            lock_guard<mutex> lock(mtx);
+            if (tasks.empty()) break;
+            task = move(tasks.front());
+            tasks.pop_front();
+        }
+        task();
+    }
+    unique_lock<mutex> l(latch.m);
+    latch.cv.wait(l, [&] { return latch.left == 0; });
+}
@@ -0,0 +1,40 @@
+﻿// FanoutPool.h
+#pragma once
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+
+using namespace std;
+
+// Пул потоков для раздачи больших рассылок. Реактор режет получателей
+// на куски, каждый кусок обходит свой поток (send + очередь соединения),
+// а сам реактор берёт первый кусок и ждёт остальные. Пока он ждёт, его
+// соединения никто другой не трогает, так что однопоточная модель реактора
+// не ломается, а порядок сообщений отправителя сохраняется: следующая
+// рассылка начнётся только после того, как предыдущая разложена всем.
+// Пул общий на все реакторы.
+class FanoutPool {
+public:
+    ~FanoutPool() { stop(); }
+
+    void start(size_t threads);
+    void stop();
+    size_t threads() const { return workers.size(); }
+
+    // job(slice, begin, end) по кускам [0, n); slices кусков (не больше потоков + 1);
+    // возвращается, когда отработали все
+    void parallelFor(size_t n, size_t slices, const function<void(size_t, size_t, size_t)>& job);
+
+private:
+    void workerLoop();
+
+    mutex mtx;
+    condition_variable wake;
+    deque<function<void()>> tasks;
+    bool stopping = false;
+    vector<thread> workers;
+};
@@ -0,0 +1,721 @@
+﻿// Federation.cpp
+#include "Federation.h"
+#include "Reactor.h"
+#include "sha1.h"
+#include <iostream>
+#include <algorithm>
+#include <random>
+
+#ifndef _WIN32
+#include <errno.h>
+#endif
+
+// типы кадров между узлами (своя нумерация, формат — как у протокола 2)
+enum class FedMsg : uint8_t {
+    Hello = 1, // node, mac — кто подключился и HMAC(secret, вызов + node)
+    Presence,  // login, node, u32 count — сколько у логина соединений на node
+    Public,    // from, room, text — room пусто: общий чат
+    Private,   // u8 hop, from, fromNode, to, text
+    Notice,    // login, text — служебное сообщение пользователю этого узла
+    Offline,   // u32 id, from, to, text — отложенное личное из очереди домашнего узла
+    OfflineAck,// login, u32 id — отложенные до id включительно доставлены
+    Challenge, // nonce — первым от принявшего узла
+};
+
+// куда идёт личное: на домашний узел адресата (тот решит), на узел, где он сидит
+// (доставить, а нет его — вернуть домой на хранение), или домой на хранение
+enum : uint8_t {
+    HOP_ROUTE = 0,
+    HOP_DELIVER = 1,
+    HOP_STORE = 2,
+};
+
+// пока связи нет, кадры копятся; больше — новые выбрасываем
+static const size_t MAX_QUEUED = 16 << 20;
+static const auto RETRY = chrono::seconds(1);
+
+static const size_t NONCE_BYTES = 16;
+
+static FrameWriter fedFrame(FedMsg t) {
+    return FrameWriter(static_cast<MsgType>(t));
+}
+
+static string sha1Bytes(const string& data) {
+    uint* d = sha1_std(data, static_cast<uint>(data.size()));
+    string out;
+    for (int i = 0; i < SHA1HASHLENGTHUINTS; i++) {
+        out.push_back(static_cast<char>(d[i] >> 24));
+        out.push_back(static_cast<char>(d[i] >> 16));
+        out.push_back(static_cast<char>(d[i] >> 8));
+        out.push_back(static_cast<char>(d[i]));
+    }
+    delete[] d;
+    return out;
+}
+
+// HMAC-SHA1 (RFC 2104)
+static string hmacSha1(const string& key, const string& data) {
+    string k = key.size() > one_block_size_bytes ? sha1Bytes(key) : key;
+    k.resize(one_block_size_bytes, '\0');
+    string ipad(k), opad(k);
+    for (size_t i = 0; i < k.size(); i++) {
+        ipad[i] ^= 0x36;
+        opad[i] ^= 0x5c;
+    }
+    return sha1Bytes(opad + sha1Bytes(ipad + data));
+}
+
+// сравнение без раннего выхода: по времени ответа не угадать, сколько байт совпало
+static bool sameMac(string_view a, string_view b) {
+    if (a.size() != b.size()) return false;
+    unsigned char diff = 0;
+    for (size_t i = 0; i < a.size(); i++) diff |= static_cast<unsigned char>(a[i] ^ b[i]);
+    return diff == 0;
+}
+
+static string makeNonce() {
+    static thread_local mt19937_64 rng{ random_device{}() };
+    string n;
+    while (n.size() < NONCE_BYTES) {
+        const uint64_t v = rng();
+        n.append(reinterpret_cast<const char*>(&v), sizeof(v));
+    }
+    n.resize(NONCE_BYTES);
+    return n;
+}
+
+static bool parseIPv4(const string& host, in_addr& out) {
+#ifdef _WIN32
+    return InetPtonA(AF_INET, host.c_str(), &out) == 1;
+#else
+    return inet_pton(AF_INET, host.c_str(), &out) == 1;
+#endif
+}
+
+static bool connectPending() {
+#ifdef _WIN32
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+    return errno == EINPROGRESS;
+#endif
+}
+
+bool parsePeers(const string& spec, vector<PeerAddr>& out) {
+    size_t pos = 0;
+    while (pos < spec.size()) {
+        size_t end = spec.find(',', pos);
+        if (end == string::npos) end = spec.size();
+        string item = spec.substr(pos, end - pos);
+        pos = end + 1;
+        item.erase(remove(item.begin(), item.end(), ' '), item.end());
+        if (item.empty()) continue;
+
+        const size_t at = item.find('@');
+        const size_t colon = item.rfind(':');
+        if (at == string::npos || colon == string::npos || colon < at) return false;
+        PeerAddr p;
+        p.id = item.substr(0, at);
+        p.host = item.substr(at + 1, colon - at - 1);
+        try { p.port = stoi(item.substr(colon + 1)); }
+        catch (...) { return false; }
+        if (p.id.empty() || p.host.empty()) return false;
+        out.push_back(move(p));
+    }
+    return true;
+}
+
+bool Federation::start(const string& self, const string& bindHost, int port, const string& secret, const vector<PeerAddr>& peers) {
+    if (running || self.empty()) return false;
+    in_addr probe{};
+    if (!parseIPv4(bindHost, probe)) {
+        cerr << "[Федерация] непонятный адрес federation_bind: " << bindHost << endl;
+        return false;
+    }
+    if (secret.empty()) {
+        cerr << "[Федерация] не задан federation_secret — без него узлы друг друга не пустят" << endl;
+        return false;
+    }
+    if (!makeWakeupPair(wakeRead, wakeWrite)) return false;
+
+    selfId = self;
+    listenHost = bindHost;
+    listenPort = port;
+    this->secret = secret;
+    vector<string> nodes{ self };
+    for (const auto& p : peers) {
+        if (p.id == self) continue;
+        nodes.push_back(p.id);
+        peerIds.push_back(p.id);
+        Outbound o;
+        o.addr = p;
+        outbound.push_back(move(o));
+    }
+    ring.build(nodes);
+
+    loop = makeEventLoop("auto");
+    loop->add(wakeRead, IO_READ);
+    running = true;
+    worker = thread([this] { run(); });
+    return true;
+}
+
+void Federation::stop() {
+    if (!running) return;
+    stopping = true;
+    char b = 1;
+    send(wakeWrite, &b, 1, 0);
+    if (worker.joinable()) worker.join();
+
+    for (auto& o : outbound) {
+        if (o.sock != INVALID_SOCKET) closeSocket(o.sock);
+        o.sock = INVALID_SOCKET;
+    }
+    for (auto& kv : inbound) closeSocket(kv.first);
+    inbound.clear();
+    if (listenSock != INVALID_SOCKET) closeSocket(listenSock);
+    listenSock = INVALID_SOCKET;
+    if (wakeRead != INVALID_SOCKET) closeSocket(wakeRead);
+    if (wakeWrite != INVALID_SOCKET && wakeWrite != wakeRead) closeSocket(wakeWrite);
+    wakeRead = wakeWrite = INVALID_SOCKET;
+    running = false;
+}
+
+void Federation::run() {
+    vector<IoEvent> events;
+    while (!stopping) {
+        const auto now = chrono::steady_clock::now();
+        // порт может быть ещё занят прежним процессом (горячий перезапуск) — пробуем снова
+        if (listenSock == INVALID_SOCKET && now >= listenRetry) openListener();
+        for (auto& o : outbound) {
+            if (o.sock == INVALID_SOCKET && now >= o.retryAt) startConnect(o);
+        }
+
+        if (loop->wait(events, 200) < 0) {
+            cerr << "Ошибка ожидания событий федерации" << endl;
+            break;
+        }
+        for (const auto& ev : events) {
+            if (ev.sock == wakeRead) {
+                char buf[256];
+                while (recv(wakeRead, buf, sizeof(buf), 0) > 0) {}
+                continue;
+            }
+            if (ev.sock == listenSock) {
+                while (true) {
+                    SOCKET s = accept(listenSock, nullptr, nullptr);
+                    if (s == INVALID_SOCKET) break;
+                    setNonBlocking(s);
+                    // вызов — пара десятков байт в пустой буфер свежего сокета, уходит сразу
+                    const string nonce = makeNonce();
+                    const string challenge = fedFrame(FedMsg::Challenge).str(nonce).bytes();
+                    if (send(s, challenge.data(), (int)challenge.size(), 0) != (int)challenge.size() || !loop->add(s, IO_READ)) {
+                        closeSocket(s);
+                        continue;
+                    }
+                    inbound[s].nonce = nonce;
+                }
+                continue;
+            }
+            auto ob = find_if(outbound.begin(), outbound.end(), [&](const Outbound& o) { return o.sock == ev.sock; });
+            if (ob != outbound.end()) onOutbound(*ob, ev.flags);
+            else if (inbound.count(ev.sock)) onInbound(ev.sock);
+        }
+        if (!pendingAcks.empty()) flushAcks();
+        takeQueued();
+    }
+}
+
+void Federation::openListener() {
+    listenRetry = chrono::steady_clock::now() + RETRY;
+    SOCKET s = socket(AF_INET, SOCK_STREAM, 0);
+    if (s == INVALID_SOCKET) return;
+    int one = 1;
+    setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (const char*)&one, sizeof(one));
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<uint16_t>(listenPort));
+    parseIPv4(listenHost, addr.sin_addr);
+    if (bind(s, (sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR || listen(s, SOMAXCONN) == SOCKET_ERROR) {
+        closeSocket(s);
+        return;
+    }
+    setNonBlocking(s);
+    loop->add(s, IO_READ);
+    listenSock = s;
+    cout << "[Федерация] узел " << selfId << " принимает узлы на " << listenHost << ":" << listenPort << endl;
+}
+
+void Federation::startConnect(Outbound& o) {
+    o.retryAt = chrono::steady_clock::now() + RETRY;
+    SOCKET s = socket(AF_INET, SOCK_STREAM, 0);
+    if (s == INVALID_SOCKET) return;
+    setNonBlocking(s);
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<uint16_t>(o.addr.port));
+    if (!parseIPv4(o.addr.host, addr.sin_addr)) {
+        closeSocket(s);
+        return;
+    }
+    if (connect(s, (sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR && !connectPending()) {
+        closeSocket(s);
+        return;
+    }
+    // подключение закончится событием готовности к записи
+    if (!loop->add(s, IO_WRITE)) {
+        closeSocket(s);
+        return;
+    }
+    o.sock = s;
+    o.connecting = true;
+}
+
+void Federation::onOutbound(Outbound& o, unsigned flags) {
+    if (o.connecting) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        getsockopt(o.sock, SOL_SOCKET, SO_ERROR, (char*)&err, &len);
+        if (err != 0 || (flags & IO_ERROR)) {
+            closeOutbound(o);
+            return;
+        }
+        o.connecting = false;
+        // пишем только после вызова от того узла (onChallenge)
+        loop->modify(o.sock, IO_READ);
+        return;
+    }
+
+    if (!o.ready) {
+        if (flags & IO_ERROR) {
+            closeOutbound(o);
+            return;
+        }
+        onChallenge(o);
+        return;
+    }
+
+    if (flags & (IO_READ | IO_ERROR)) {
+        // узел нам сюда не пишет: прочитали — значит, закрыли (или мусор)
+        char buf[256];
+        int n = recv(o.sock, buf, sizeof(buf), 0);
+        if (n == 0 || (n < 0 && !lastErrorWouldBlock()) || (flags & IO_ERROR)) {
+            closeOutbound(o);
+            return;
+        }
+    }
+    if (flags & IO_WRITE) flushOutbound(o);
+}
+
+void Federation::onChallenge(Outbound& o) {
+    while (true) {
+        auto [buf, room] = o.in.writable();
+        if (room == 0) { closeOutbound(o); return; }
+        int n = recv(o.sock, buf, (int)room, 0);
+        if (n > 0) {
+            o.in.commit((size_t)n);
+            continue;
+        }
+        if (n < 0 && lastErrorWouldBlock()) break;
+        closeOutbound(o);
+        return;
+    }
+    string_view frame, nonce;
+    if (!o.in.nextFrame(frame)) {
+        if (o.in.broken()) closeOutbound(o);
+        return;
+    }
+    FrameReader r(frame);
+    if (static_cast<FedMsg>(r.type()) != FedMsg::Challenge || !r.str(nonce) || nonce.size() != NONCE_BYTES) {
+        closeOutbound(o);
+        return;
+    }
+    o.ready = true;
+    cout << "[Федерация] связь с узлом " << o.addr.id << " установлена" << endl;
+    // первым — кто мы (с подписью) и кто у нас в сети; очередь допишет takeQueued
+    const string mac = hmacSha1(secret, string(nonce) + selfId);
+    o.buf = fedFrame(FedMsg::Hello).str(selfId).str(mac).bytes() + presenceSnapshot();
+    {
+        lock_guard<mutex> lock(mtx);
+        up.insert(o.addr.id);
+    }
+    takeQueued();
+}
+
+void Federation::closeOutbound(Outbound& o) {
+    if (o.ready) cout << "[Федерация] связь с узлом " << o.addr.id << " потеряна" << endl;
+    loop->remove(o.sock);
+    closeSocket(o.sock);
+    o.sock = INVALID_SOCKET;
+    o.connecting = false;
+    o.ready = false;
+    o.in.reset(256);
+    // недописанный кадр на новом соединении испортил бы поток — то, что уже
+    // забрали из очереди, теряем; не забранное уйдёт после переподключения
+    o.buf.clear();
+    o.retryAt = chrono::steady_clock::now() + RETRY;
+    lock_guard<mutex> lock(mtx);
+    up.erase(o.addr.id);
+}
+
+void Federation::flushOutbound(Outbound& o) {
+    size_t off = 0;
+    while (off < o.buf.size()) {
+        int n = send(o.sock, o.buf.data() + off, (int)(o.buf.size() - off), 0);
+        if (n > 0) { off += (size_t)n; continue; }
+        if (n < 0 && lastErrorWouldBlock()) break;
+        closeOutbound(o);
+        return;
+    }
+    o.buf.erase(0, off);
+    loop->modify(o.sock, o.buf.empty() ? IO_READ : (IO_READ | IO_WRITE));
+}
+
+void Federation::takeQueued() {
+    for (auto& o : outbound) {
+        if (o.sock == INVALID_SOCKET || !o.ready) continue;
+        {
+            lock_guard<mutex> lock(mtx);
+            wakePending = false;
+            auto it = queued.find(o.addr.id);
+            if (it != queued.end() && !it->second.empty()) {
+                // всё накопленное — одной пачкой за другим
+                if (o.buf.empty()) o.buf.swap(it->second);
+                else o.buf += it->second;
+                it->second.clear();
+            }
+        }
+        if (!o.buf.empty()) flushOutbound(o);
+    }
+}
+
+void Federation::queueTo(const string& node, string frame, bool droppable) {
+    bool wake = false;
+    {
+        lock_guard<mutex> lock(mtx);
+        if (droppable && !up.count(node)) return;
+        string& q = queued[node];
+        if (q.size() + frame.size() > MAX_QUEUED) return;
+        q += frame;
+        if (!wakePending) {
+            wakePending = true;
+            wake = true;
+        }
+    }
+    // будим только первым кадром: остальные заберутся той же пачкой
+    if (wake) {
+        char b = 1;
+        send(wakeWrite, &b, 1, 0);
+    }
+}
+
+void Federation::queueAll(const string& frame, bool droppable) {
+    for (const auto& id : peerIds) queueTo(id, frame, droppable);
+}
+
+string Federation::presenceSnapshot() {
+    string out;
+    lock_guard<mutex> lock(mtx);
+    for (const auto& kv : localCount) {
+        out += fedFrame(FedMsg::Presence).str(kv.first).str(selfId).u32((uint32_t)kv.second).bytes();
+    }
+    return out;
+}
+
+void Federation::onInbound(SOCKET s) {
+    Inbound& link = inbound[s];
+    while (true) {
+        auto [buf, room] = link.in.writable();
+        if (room == 0) { closeInbound(s); return; }
+        int n = recv(s, buf, (int)room, 0);
+        if (n > 0) {
+            link.in.commit((size_t)n);
+            string_view frame;
+            while (link.in.nextFrame(frame)) {
+                if (!onFrame(link, frame)) { closeInbound(s); return; }
+            }
+            if (link.in.broken()) { closeInbound(s); return; }
+            continue;
+        }
+        if (n < 0 && lastErrorWouldBlock()) return;
+        closeInbound(s);
+        return;
+    }
+}
+
+void Federation::closeInbound(SOCKET s) {
+    auto it = inbound.find(s);
+    if (it == inbound.end()) return;
+    const string node = it->second.node;
+    loop->remove(s);
+    closeSocket(s);
+    inbound.erase(it);
+    if (node.empty()) return;
+
+    // узел пропал: его пользователей больше нет в сети (вернётся — пришлёт снимок)
+    auto r = remote.find(node);
+    if (r != remote.end()) {
+        vector<string> logins;
+        for (const auto& kv : r->second) logins.push_back(kv.first);
+        for (const auto& login : logins) applyPresence(node, login, 0);
+    }
+}
+
+bool Federation::onFrame(Inbound& link, string_view frame) {
+    FrameReader r(frame);
+    string_view a, b, c, d;
+    uint32_t count = 0;
+    uint8_t hop = 0;
+    const FedMsg type = static_cast<FedMsg>(r.type());
+    if (link.node.empty()) {
+        // первым — только Hello от известного узла с верной подписью
+        if (type != FedMsg::Hello || !r.str(a) || !r.str(b)) return false;
+        const string node(a);
+        if (find(peerIds.begin(), peerIds.end(), node) == peerIds.end() || !sameMac(b, hmacSha1(secret, link.nonce + node))) {
+            cerr << "[Федерация] отклонено подключение: неверный Hello" << (node.empty() ? "" : " от " + node) << endl;
+            return false;
+        }
+        link.node = node;
+        return true;
+    }
+    switch (type) {
+    case FedMsg::Hello:
+        return false;
+    case FedMsg::Presence:
+        if (r.str(a) && r.str(b) && r.u32(count)) applyPresence(string(b), string(a), count);
+        return true;
+    case FedMsg::Public:
+        if (r.str(a) && r.str(b) && r.str(c)) deliverPublic(string(a), string(b), string(c));
+        return true;
+    case FedMsg::Private:
+        if (r.u8(hop) && r.str(a) && r.str(b) && r.str(c) && r.str(d))
+            routePrivate(hop, string(a), string(b), string(c), string(d));
+        return true;
+    case FedMsg::Notice:
+        if (r.str(a) && r.str(b)) deliverInfo(string(a), string(b));
+        return true;
+    case FedMsg::Offline:
+        if (r.u32(count) && r.str(a) && r.str(b) && r.str(c)) deliverOffline(link.node, count, string(a), string(b), string(c));
+        return true;
+    case FedMsg::OfflineAck:
+        // курсор двигаем только у своих: чужой дом нам не указ
+        if (r.str(a) && r.u32(count) && ring.owner(string(a)) == selfId) ctx.db.ackOffline(string(a), (int)count);
+        return true;
+    default:
+        return true;
+    }
+}
+
+void Federation::applyPresence(const string& node, const string& login, uint32_t count) {
+    auto& counts = remote[node];
+    const uint32_t prev = counts.count(login) ? counts[login] : 0;
+    if (count == 0) counts.erase(login);
+    else counts[login] = count;
+
+    // окно присутствия и рассылку ведёт реактор — отдаём ему разницу
+    const int delta = (int)count - (int)prev;
+    if (delta != 0) {
+        ctx.reactors[0]->post(Post::call([login, delta](Reactor& r) { r.remotePresence(login, delta); }));
+    }
+
+    if (ring.owner(login) != selfId) return;
+    bool cameOnline = false;
+    {
+        lock_guard<mutex> lock(mtx);
+        seen.insert(login);
+        if (count > 0) {
+            cameOnline = prev == 0;
+            dir[login] = node;
+        }
+        else {
+            auto it = dir.find(login);
+            if (it != dir.end() && it->second == node) dir.erase(it);
+        }
+    }
+    // мы его дом: всё, что ждало, пока он войдёт, — туда, где он вошёл
+    if (cameOnline) sendOfflineQueue(login, node);
+}
+
+void Federation::sendOfflineQueue(const string& login, const string& node) {
+    int cursor = ctx.db.offlineCursor(login);
+    while (true) {
+        auto chunk = ctx.db.getOfflineChunk(login, cursor, ctx.historyChunk);
+        if (chunk.empty()) break;
+        string batch;
+        for (const auto& m : chunk) {
+            batch += fedFrame(FedMsg::Offline).u32((uint32_t)m.id).str(m.sender).str(login).str(m.text).bytes();
+        }
+        // из очереди убирает только OfflineAck от узла адресата: пропала связь,
+        // переполнилась очередь узла или адресат успел уйти — строки остаются
+        // и уйдут при следующем входе
+        queueTo(node, move(batch));
+        cursor = chunk.back().id;
+        if (chunk.size() < ctx.historyChunk) break;
+    }
+}
+
+void Federation::deliverPublic(const string& from, const string& room, const string& text) {
+    const bool bin = ctx.v2Clients.load() > 0;
+    const uint32_t fromId = bin ? (uint32_t)ctx.db.getUserId(from) : 0;
+    Outgoing msg;
+    if (room.empty()) {
+        msg.text = makeFrame("[" + from + "] " + text + "\n");
+        if (bin) msg.bin = FrameWriter(MsgType::PublicMsg).u32(fromId).str(text).finish();
+    }
+    else {
+        msg.text = makeFrame("[" + from + " -> #" + room + "] " + text + "\n");
+        if (bin) msg.bin = FrameWriter(MsgType::RoomMsg).u32(fromId).str(room).str(text).finish();
+    }
+    // своя копия истории на каждом узле
+    ctx.writer.submit(Message{ 0, from, "", text, room });
+
+    vector<size_t> targets;
+    if (room.empty()) {
+        for (size_t i = 0; i < ctx.reactors.size(); i++) targets.push_back(i);
+    }
+    else {
+        lock_guard<mutex> lock(ctx.roomsMutex);
+        auto it = ctx.roomShards.find(room);
+        if (it == ctx.roomShards.end()) return;
+        for (size_t i = 0; i < it->second.size(); i++) {
+            if (it->second[i] > 0) targets.push_back(i);
+        }
+    }
+    for (size_t i : targets) ctx.reactors[i]->post(Post::fanout(msg, room));
+}
+
+void Federation::deliverOffline(const string& home, uint32_t id, const string& from, const string& to, const string& text) {
+    if (home.empty() || !deliverLocal(from, to, text)) return;
+    // подтверждения копим и отправляем одно на логин за проход цикла (flushAcks)
+    uint32_t& acked = pendingAcks[home][to];
+    acked = max(acked, id);
+}
+
+void Federation::flushAcks() {
+    for (const auto& node : pendingAcks) {
+        string batch;
+        for (const auto& kv : node.second) batch += fedFrame(FedMsg::OfflineAck).str(kv.first).u32(kv.second).bytes();
+        queueTo(node.first, move(batch));
+    }
+    pendingAcks.clear();
+}
+
+bool Federation::deliverLocal(const string& from, const string& to, const string& text) {
+    Route route{ 0, INVALID_SOCKET, 0 };
+    {
+        lock_guard<mutex> lock(ctx.dirMutex);
+        auto it = ctx.loginToSock.find(to);
+        if (it == ctx.loginToSock.end()) return false;
+        route = it->second;
+    }
+    Outgoing out{ makeFrame("[" + from + " -> " + to + "] " + text + "\n"), nullptr };
+    if (ctx.v2Clients.load() > 0)
+        out.bin = FrameWriter(MsgType::PrivateMsg).u32((uint32_t)ctx.db.getUserId(from)).u32(route.userId).str(text).finish();
+    ctx.writer.submit(Message{ 0, from, to, text, "" });
+    ctx.reactors[route.shard]->post(Post::direct(route.sock, to, out));
+    return true;
+}
+
+void Federation::routePrivate(uint8_t hop, const string& from, const string& fromNode, const string& to, const string& text) {
+    if (deliverLocal(from, to, text)) return;
+
+    const string& home = ring.owner(to);
+    if (home == selfId) {
+        if (hop == HOP_ROUTE) {
+            string holder;
+            {
+                lock_guard<mutex> lock(mtx);
+                auto it = dir.find(to);
+                if (it != dir.end()) holder = it->second;
+            }
+            if (!holder.empty() && holder != selfId) {
+                queueTo(holder, fedFrame(FedMsg::Private).u8(HOP_DELIVER).str(from).str(fromNode).str(to).str(text).bytes());
+                return;
+            }
+        }
+        storeOffline(from, fromNode, to, text);
+        return;
+    }
+    // адресат успел уйти с этого узла — пусть дом сохранит
+    if (hop == HOP_DELIVER) {
+        queueTo(home, fedFrame(FedMsg::Private).u8(HOP_STORE).str(from).str(fromNode).str(to).str(text).bytes());
+        return;
+    }
+    // маршрут или хранение пришли не на дом: кольца узлов не совпадают (разные конфиги)
+    notice(fromNode, from, "[Сервер] Пользователь '" + to + "' не в сети\n");
+}
+
+void Federation::storeOffline(const string& from, const string& fromNode, const string& to, const string& text) {
+    bool known;
+    {
+        lock_guard<mutex> lock(mtx);
+        known = seen.count(to) > 0;
+    }
+    if (!known) known = ctx.db.getUserId(to) != 0;
+    if (!known || !ctx.db.addOfflineMessage(from, to, text)) {
+        notice(fromNode, from, "[Сервер] Пользователь '" + to + "' не в сети\n");
+        return;
+    }
+    notice(fromNode, from, "[Сервер] " + to + " не в сети — сообщение будет доставлено при входе\n");
+}
+
+void Federation::notice(const string& node, const string& login, const string& text) {
+    if (node == selfId) deliverInfo(login, text);
+    else queueTo(node, fedFrame(FedMsg::Notice).str(login).str(text).bytes());
+}
+
+void Federation::deliverInfo(const string& login, const string& text) {
+    Route route{ 0, INVALID_SOCKET, 0 };
+    {
+        lock_guard<mutex> lock(ctx.dirMutex);
+        auto it = ctx.loginToSock.find(login);
+        if (it == ctx.loginToSock.end()) return;
+        route = it->second;
+    }
+    Outgoing out{ makeFrame(text), nullptr };
+    if (ctx.v2Clients.load() > 0) {
+        string_view body = text;
+        while (!body.empty() && body.back() == '\n') body.remove_suffix(1);
+        out.bin = FrameWriter(MsgType::Info).str(body).finish();
+    }
+    ctx.reactors[route.shard]->post(Post::direct(route.sock, login, out));
+}
+
+void Federation::localPresence(const string& login, int delta) {
+    int count;
+    bool home;
+    {
+        lock_guard<mutex> lock(mtx);
+        int& c = localCount[login];
+        c = max(0, c + delta);
+        count = c;
+        if (c == 0) localCount.erase(login);
+        home = running && ring.owner(login) == selfId;
+        if (home) {
+            seen.insert(login);
+            if (count > 0) dir[login] = selfId;
+            else if (dir.count(login) && dir[login] == selfId) dir.erase(login);
+        }
+    }
+    if (!running) return;
+    queueAll(fedFrame(FedMsg::Presence).str(login).str(selfId).u32((uint32_t)count).bytes(), true);
+}
+
+string Federation::nextHop(const string& login) {
+    const string& home = ring.owner(login);
+    if (home != selfId) return home;
+    lock_guard<mutex> lock(mtx);
+    auto it = dir.find(login);
+    if (it == dir.end() || it->second == selfId) return "";
+    return it->second;
+}
+
+void Federation::sendPrivate(const string& node, const string& from, const string& to, const string& text) {
+    const uint8_t hop = node == ring.owner(to) ? HOP_ROUTE : HOP_DELIVER;
+    queueTo(node, fedFrame(FedMsg::Private).u8(hop).str(from).str(selfId).str(to).str(text).bytes());
+}
+
+void Federation::relayPublic(const string& from, const string& room, const string& text) {
+    if (!running) return;
+    queueAll(fedFrame(FedMsg::Public).str(from).str(room).str(text).bytes());
+}
@@ -0,0 +1,155 @@
+﻿// Federation.h
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <unordered_map>
+#include <unordered_set>
+#include "NetUtils.h"
+#include "EventLoop.h"
+#include "LineFramer.h"
+#include "HashRing.h"
+
+using namespace std;
+
+struct ServerContext;
+
+struct PeerAddr {
+    string id;
+    string host; // IP-адрес
+    int port = 0;
+};
+
+// "node2@127.0.0.1:6002,node3@10.0.0.5:6003"; false — есть непонятный элемент
+bool parsePeers(const string& spec, vector<PeerAddr>& out);
+
+// Несколько серверов-узлов с общим пространством пользователей.
+//
+// У каждого логина есть домашний узел — по согласованному хэшу логина на кольце
+// из всех узлов (набор node_id у всех узлов должен совпадать). Домашний узел знает,
+// на каком узле логин сейчас в сети, и хранит его отложенные личные. Личное
+// сообщение адресату не с этого узла идёт на его домашний узел, оттуда — на узел,
+// где он сидит; никого нет — ложится в очередь на домашнем и уйдёт при входе.
+// Присутствие и общие сообщения (и сообщения комнат) рассылаются всем узлам.
+//
+// Связь между узлами — односторонние TCP-соединения: каждый узел сам подключается
+// ко всем остальным и только пишет в них, а принимает по входящим. Кадры — как в
+// протоколе 2 (u32 длина | u8 тип | данные), свои типы. Всё, что реакторы поставили
+// в очередь узла, уходит пачкой одним send, подтверждений никто не ждёт — кроме
+// отложенных личных: их домашний узел удаляет, только когда узел адресата
+// ответит, что доставил.
+// Присутствие передаётся абсолютным числом соединений логина на узле, так что
+// повтор после переподключения ничего не портит.
+//
+// Чужих не пускаем: принявший узел сразу шлёт случайный вызов, подключившийся
+// отвечает Hello с HMAC-SHA1 от общего секрета (federation_secret) по вызову и
+// своему id. До правильного Hello ни один кадр не разбирается.
+class Federation {
+public:
+    explicit Federation(ServerContext& ctx) : ctx(ctx) {}
+    ~Federation() { stop(); }
+
+    // свой поток: приём соединений узлов на bindHost:port и подключение к peers;
+    // secret — общий для всех узлов, пустой не годится
+    bool start(const string& self, const string& bindHost, int port, const string& secret, const vector<PeerAddr>& peers);
+    void stop();
+    bool enabled() const { return running.load(); }
+    const string& self() const { return selfId; }
+
+    // дальше — из потоков реакторов
+
+    // у login на этом узле стало на delta соединений больше (меньше)
+    void localPresence(const string& login, int delta);
+    // куда отправить личное для login, которого нет на этом узле;
+    // пусто — мы его домашний узел и он нигде не в сети: хранить здесь
+    string nextHop(const string& login);
+    void sendPrivate(const string& node, const string& from, const string& to, const string& text);
+    // общее сообщение (room пусто) или сообщение комнаты — на все узлы
+    void relayPublic(const string& from, const string& room, const string& text);
+
+private:
+    // исходящая связь с узлом: только пишем
+    struct Outbound {
+        PeerAddr addr;
+        SOCKET sock = INVALID_SOCKET;
+        bool connecting = false;
+        bool ready = false; // вызов получен, Hello отправлен
+        LineFramer in{ 256 }; // до Hello — кадр вызова
+        string buf; // уже забрано из очереди, ещё не ушло в сокет
+        chrono::steady_clock::time_point retryAt;
+    };
+    // входящая: только читаем
+    struct Inbound {
+        LineFramer in{ 1 << 20 };
+        string nonce; // наш вызов этому соединению
+        string node;  // из кадра Hello; пусто — ещё не представился
+    };
+
+    void run();
+    void openListener();
+    void startConnect(Outbound& o);
+    void onOutbound(Outbound& o, unsigned flags);
+    void closeOutbound(Outbound& o);
+    void flushOutbound(Outbound& o);
+    void takeQueued();
+    void onInbound(SOCKET s);
+    void closeInbound(SOCKET s);
+    // false — соединение закрыть
+    bool onFrame(Inbound& link, string_view frame);
+    void onChallenge(Outbound& o);
+
+    // разбор входящих кадров (поток федерации)
+    void applyPresence(const string& node, const string& login, uint32_t count);
+    void deliverPublic(const string& from, const string& room, const string& text);
+    void routePrivate(uint8_t hop, const string& from, const string& fromNode, const string& to, const string& text);
+    void storeOffline(const string& from, const string& fromNode, const string& to, const string& text);
+    void notice(const string& node, const string& login, const string& text);
+    void deliverInfo(const string& login, const string& text);
+    void sendOfflineQueue(const string& login, const string& node);
+    void deliverOffline(const string& home, uint32_t id, const string& from, const string& to, const string& text);
+    void flushAcks();
+    bool deliverLocal(const string& from, const string& to, const string& text);
+
+    // в очередь узла; droppable — не копить, пока связи нет (присутствие
+    // всё равно придёт снимком при подключении)
+    void queueTo(const string& node, string frame, bool droppable = false);
+    void queueAll(const string& frame, bool droppable = false);
+    string presenceSnapshot();
+
+    ServerContext& ctx;
+    string selfId;
+    string listenHost;
+    int listenPort = 0;
+    string secret;
+    HashRing ring;
+    vector<string> peerIds; // не меняется после start
+    atomic<bool> running{ false };
+    atomic<bool> stopping{ false };
+    thread worker;
+
+    // только поток федерации
+    unique_ptr<EventLoop> loop;
+    SOCKET listenSock = INVALID_SOCKET;
+    chrono::steady_clock::time_point listenRetry;
+    SOCKET wakeRead = INVALID_SOCKET, wakeWrite = INVALID_SOCKET;
+    vector<Outbound> outbound;
+    unordered_map<SOCKET, Inbound> inbound;
+    // узел -> логин -> сколько у него там соединений (по кадрам Presence)
+    unordered_map<string, unordered_map<string, uint32_t>> remote;
+    // узел -> логин -> до какого id доставлены его отложенные (ещё не отправлено)
+    unordered_map<string, unordered_map<string, uint32_t>> pendingAcks;
+
+    mutex mtx;
+    unordered_map<string, string> queued; // узел -> кадры для него
+    unordered_set<string> up;             // узлы, с которыми есть связь
+    bool wakePending = false;
+    unordered_map<string, int> localCount; // логин -> соединений на этом узле
+    // для логинов, чей дом здесь: где он в сети и кого вообще видели
+    unordered_map<string, string> dir;
+    unordered_set<string> seen;
+};
@@ -0,0 +1,41 @@
+﻿// FlushScheduler.cpp
+#include "FlushScheduler.h"
+#include <algorithm>
+
+void FlushScheduler::configure(chrono::microseconds delayBudget, size_t busy) {
+    delay = max(delayBudget, chrono::microseconds(0));
+    busyEvents = max<size_t>(1, busy);
+}
+
+void FlushScheduler::beginTurn(size_t events) {
+    work = 0;
+    direct = true;
+    note(events);
+}
+
+void FlushScheduler::note(size_t n) {
+    work += n;
+    if (work >= busyEvents) direct = false;
+}
+
+void FlushScheduler::held(Clock::time_point now) {
+    if (holding) return;
+    holding = true;
+    deadline = now + delay;
+}
+
+bool FlushScheduler::due(Clock::time_point now) {
+    // нагрузку сглаживаем: одиночный пустой оборот посреди потока её не сбрасывает
+    load = load * 0.875 + (double)work * 0.125;
+    if (!holding) return false;
+    // через обороты держим, только пока поток не спадает и бюджет не вышел
+    if (delay.count() == 0 || direct || load < (double)busyEvents) return true;
+    return now >= deadline;
+}
+
+int FlushScheduler::timeoutMs(Clock::time_point now) const {
+    if (!holding) return -1;
+    if (now >= deadline) return 0;
+    // wait считает в миллисекундах: округляем вниз, чтобы не пересидеть бюджет
+    return (int)chrono::duration_cast<chrono::milliseconds>(deadline - now).count();
+}
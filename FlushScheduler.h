@@ -0,0 +1,45 @@
+﻿// FlushScheduler.h
+#pragma once
+#include <chrono>
+#include <cstddef>
+
+using namespace std;
+
+// Когда отдавать исходящее в сокеты. Реактор спрашивает его на каждом обороте:
+//  - простой (за оборот одно событие) — пишем сразу, как и раньше: задержка не растёт;
+//  - всплеск (событий за оборот не меньше busyEvents) — кадры копятся в очередях
+//    соединений и уходят в конце оборота одним writev на соединение;
+//  - нагрузка держится (сглаженное число событий за оборот не меньше busyEvents)
+//    и задан delay — копим и через несколько оборотов, пока приходят новые события,
+//    но не дольше delay; пустой оборот (ничего не пришло) сбрасывает сразу.
+class FlushScheduler {
+public:
+    using Clock = chrono::steady_clock;
+
+    void configure(chrono::microseconds delayBudget, size_t busy);
+
+    // начало оборота: сколько событий вернул wait
+    void beginTurn(size_t events);
+    // ещё работа внутри оборота (например, пачка писем из почтового ящика)
+    void note(size_t n);
+    // писать прямо сейчас, ничего не копя
+    bool immediate() const { return direct; }
+
+    // в очереди соединения отложен кадр: с первого такого кадра идёт отсчёт delay
+    void held(Clock::time_point now);
+    // конец оборота: сбрасывать ли отложенное сейчас
+    bool due(Clock::time_point now);
+    void flushed() { holding = false; }
+
+    // сколько можно спать в wait, не нарушив бюджет; -1 — не ограничиваем
+    int timeoutMs(Clock::time_point now) const;
+
+private:
+    chrono::microseconds delay{ 0 };
+    size_t busyEvents = 2;
+    double load = 0;      // сглаженное число событий за оборот
+    size_t work = 0;      // событий на текущем обороте
+    bool direct = true;
+    bool holding = false;
+    Clock::time_point deadline;
+};
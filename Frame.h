@@ -0,0 +1,15 @@
+﻿// Frame.h
+#pragma once
+#include <string>
+#include <memory>
+
+using namespace std;
+
+// Неизменяемый кадр исходящих данных. Рассылка создаёт его один раз,
+// а в очереди получателей кладётся только указатель (счётчик ссылок),
+// поэтому сообщение на 10 тысяч адресатов — одна аллокация, а не 10 тысяч копий.
+using FramePtr = shared_ptr<const string>;
+
+inline FramePtr makeFrame(string bytes) {
+    return make_shared<const string>(move(bytes));
+}
@@ -0,0 +1,317 @@
+﻿// Handoff.cpp
+#include "Handoff.h"
+#include <iostream>
+
+#ifndef _WIN32
+#include <sys/un.h>
+#include <sys/uio.h>
+#include <sys/time.h>
+#include <cerrno>
+#include <cstring>
+
+// сколько дескрипторов в одном sendmsg (ядро ограничивает SCM_RIGHTS ~250)
+static const size_t FDS_PER_MSG = 64;
+// заголовок пачки: u8 вид | u32 число сокетов | u32 длина данных
+static const size_t BATCH_HEADER = 9;
+
+enum BatchKind : uint8_t {
+    BATCH_END = 0,
+    BATCH_LISTENERS = 1,
+    BATCH_SESSIONS = 2,
+};
+
+static void put32(string& b, uint32_t v) {
+    b.push_back(static_cast<char>(v >> 24));
+    b.push_back(static_cast<char>((v >> 16) & 0xFF));
+    b.push_back(static_cast<char>((v >> 8) & 0xFF));
+    b.push_back(static_cast<char>(v & 0xFF));
+}
+
+// в отличие от кадров протокола, длина 32-битная: неотправленный вывод бывает в мегабайты
+static void putStr(string& b, const string& s) {
+    put32(b, (uint32_t)s.size());
+    b += s;
+}
+
+struct BlobReader {
+    const char* p;
+    size_t left;
+    bool ok = true;
+
+    uint32_t u32() {
+        if (!ok || left < 4) { ok = false; return 0; }
+        const auto* b = reinterpret_cast<const unsigned char*>(p);
+        p += 4;
+        left -= 4;
+        return (uint32_t(b[0]) << 24) | (uint32_t(b[1]) << 16) | (uint32_t(b[2]) << 8) | uint32_t(b[3]);
+    }
+    string str() {
+        const uint32_t n = u32();
+        if (!ok || left < n) { ok = false; return string(); }
+        string s(p, n);
+        p += n;
+        left -= n;
+        return s;
+    }
+};
+
+static void putSession(string& b, const HandoffSession& s) {
+    put32(b, s.shard);
+    put32(b, s.ready);
+    putStr(b, s.login);
+    put32(b, s.userId);
+    put32(b, s.proto);
+    putStr(b, s.room);
+    put32(b, (uint32_t)s.rooms.size());
+    for (const auto& r : s.rooms) putStr(b, r);
+    putStr(b, s.input);
+    putStr(b, s.output);
+    put32(b, (uint32_t)s.replays.size());
+    for (const auto& h : s.replays) {
+        putStr(b, h.room);
+        put32(b, h.offline);
+        put32(b, h.cursor);
+        put32(b, h.upTo);
+    }
+}
+
+static bool getSession(BlobReader& r, HandoffSession& s) {
+    s.shard = r.u32();
+    s.ready = (uint8_t)r.u32();
+    s.login = r.str();
+    s.userId = r.u32();
+    s.proto = (uint8_t)r.u32();
+    s.room = r.str();
+    const uint32_t nRooms = r.u32();
+    for (uint32_t i = 0; i < nRooms && r.ok; i++) s.rooms.push_back(r.str());
+    s.input = r.str();
+    s.output = r.str();
+    const uint32_t nReplays = r.u32();
+    for (uint32_t i = 0; i < nReplays && r.ok; i++) {
+        HandoffReplay h;
+        h.room = r.str();
+        h.offline = (uint8_t)r.u32();
+        h.cursor = r.u32();
+        h.upTo = r.u32();
+        s.replays.push_back(move(h));
+    }
+    return r.ok;
+}
+
+static bool sendAllRaw(int s, const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = ::send(s, data, len, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        data += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+static bool recvAllRaw(int s, char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = ::recv(s, data, len, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        data += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+// сокеты едут вместе с заголовком пачки, данные — следом обычным send
+static bool sendBatch(int s, BatchKind kind, const vector<SOCKET>& fds, const string& blob) {
+    string hdr;
+    hdr.push_back(static_cast<char>(kind));
+    put32(hdr, (uint32_t)fds.size());
+    put32(hdr, (uint32_t)blob.size());
+
+    iovec iov{ &hdr[0], hdr.size() };
+    msghdr m{};
+    m.msg_iov = &iov;
+    m.msg_iovlen = 1;
+    vector<char> ctl;
+    if (!fds.empty()) {
+        ctl.assign(CMSG_SPACE(sizeof(int) * fds.size()), 0);
+        m.msg_control = ctl.data();
+        m.msg_controllen = ctl.size();
+        cmsghdr* c = CMSG_FIRSTHDR(&m);
+        c->cmsg_level = SOL_SOCKET;
+        c->cmsg_type = SCM_RIGHTS;
+        c->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+        memcpy(CMSG_DATA(c), fds.data(), sizeof(int) * fds.size());
+    }
+    ssize_t n;
+    do { n = sendmsg(s, &m, 0); } while (n < 0 && errno == EINTR);
+    if (n <= 0) return false;
+    // сокеты ушли с первым байтом, хвост заголовка (если ядро взяло не всё) — без них
+    if ((size_t)n < hdr.size() && !sendAllRaw(s, hdr.data() + n, hdr.size() - n)) return false;
+    return sendAllRaw(s, blob.data(), blob.size());
+}
+
+static bool recvBatch(int s, uint8_t& kind, vector<SOCKET>& fds, string& blob) {
+    char hdr[BATCH_HEADER];
+    iovec iov{ hdr, sizeof(hdr) };
+    vector<char> ctl(CMSG_SPACE(sizeof(int) * FDS_PER_MSG), 0);
+    msghdr m{};
+    m.msg_iov = &iov;
+    m.msg_iovlen = 1;
+    m.msg_control = ctl.data();
+    m.msg_controllen = ctl.size();
+
+    ssize_t n;
+    do { n = recvmsg(s, &m, MSG_CMSG_CLOEXEC); } while (n < 0 && errno == EINTR);
+    if (n <= 0) return false;
+    for (cmsghdr* c = CMSG_FIRSTHDR(&m); c; c = CMSG_NXTHDR(&m, c)) {
+        if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS) continue;
+        const size_t cnt = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        const size_t at = fds.size();
+        fds.resize(at + cnt);
+        memcpy(&fds[at], CMSG_DATA(c), sizeof(int) * cnt);
+    }
+    if (m.msg_flags & MSG_CTRUNC) return false;
+    if ((size_t)n < sizeof(hdr) && !recvAllRaw(s, hdr + n, sizeof(hdr) - n)) return false;
+
+    BlobReader r{ hdr + 1, sizeof(hdr) - 1 };
+    kind = static_cast<uint8_t>(hdr[0]);
+    const uint32_t nfds = r.u32();
+    const uint32_t len = r.u32();
+    if (nfds != fds.size()) return false;
+    blob.resize(len);
+    return len == 0 || recvAllRaw(s, &blob[0], len);
+}
+
+static bool fillAddr(const string& path, sockaddr_un& addr) {
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(addr.sun_path)) return false;
+    memcpy(addr.sun_path, path.c_str(), path.size());
+    return true;
+}
+
+bool takeOverFrom(const string& path, HandoffState& st) {
+    sockaddr_un addr;
+    if (!fillAddr(path, addr)) return false;
+    int s = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (s < 0) return false;
+    if (connect(s, (sockaddr*)&addr, sizeof(addr)) != 0) {
+        closeSocket(s); // никто не слушает — обычный запуск
+        return false;
+    }
+    // старый процесс может зависнуть — не ждём его вечно
+    timeval tv{ 30, 0 };
+    setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    cout << "Найден работающий сервер, забираем его соединения..." << endl;
+    const string hello = HANDOFF_HELLO "\n";
+    bool ok = sendAllRaw(s, hello.data(), hello.size());
+    while (ok) {
+        uint8_t kind = BATCH_END;
+        vector<SOCKET> fds;
+        string blob;
+        if (!recvBatch(s, kind, fds, blob)) {
+            for (SOCKET f : fds) closeSocket(f);
+            ok = false;
+            break;
+        }
+        if (kind == BATCH_END) break;
+        if (kind == BATCH_LISTENERS) {
+            st.listeners.insert(st.listeners.end(), fds.begin(), fds.end());
+            continue;
+        }
+        BlobReader r{ blob.data(), blob.size() };
+        for (size_t i = 0; i < fds.size(); i++) {
+            HandoffSession sess;
+            sess.sock = fds[i];
+            if (!getSession(r, sess)) {
+                // остаток пачки не разобрать — сокеты без состояния никому не нужны
+                for (size_t j = i; j < fds.size(); j++) closeSocket(fds[j]);
+                ok = false;
+                break;
+            }
+            st.sessions.push_back(move(sess));
+        }
+    }
+    closeSocket(s);
+
+    if (!ok || st.listeners.empty()) {
+        cerr << "Передача соединений сорвалась, запускаемся с чистого листа" << endl;
+        for (SOCKET l : st.listeners) closeSocket(l);
+        for (const auto& sess : st.sessions) closeSocket(sess.sock);
+        st.listeners.clear();
+        st.sessions.clear();
+        return false;
+    }
+    return true;
+}
+
+bool HandoffListener::open(const string& path) {
+    sockaddr_un addr;
+    if (!fillAddr(path, addr)) return false;
+    int s = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (s < 0) return false;
+    // путь остался от прежнего процесса (его слушатель уже отработал) — занимаем
+    unlink(path.c_str());
+    if (bind(s, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(s, 1) != 0) {
+        cerr << "Не удалось открыть " << path << " для горячего перезапуска" << endl;
+        closeSocket(s);
+        return false;
+    }
+    sock = s;
+    return true;
+}
+
+SOCKET HandoffListener::waitSuccessor() {
+    const SOCKET l = sock;
+    while (l != INVALID_SOCKET) {
+        int s = accept(l, nullptr, nullptr);
+        if (s < 0) {
+            if (errno == EINTR) continue;
+            return INVALID_SOCKET; // слушатель закрыли
+        }
+        timeval tv{ 5, 0 };
+        setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        // первая строка — приветствие преемника; всё остальное — чужие, закрываем
+        string line;
+        char ch;
+        while (line.size() < 64 && recvAllRaw(s, &ch, 1) && ch != '\n') line.push_back(ch);
+        if (line == HANDOFF_HELLO) return s;
+        closeSocket(s);
+    }
+    return INVALID_SOCKET;
+}
+
+bool HandoffListener::send(SOCKET successor, const HandoffState& st) {
+    string none;
+    if (!sendBatch(successor, BATCH_LISTENERS, st.listeners, none)) return false;
+    for (size_t i = 0; i < st.sessions.size(); i += FDS_PER_MSG) {
+        vector<SOCKET> fds;
+        string blob;
+        for (size_t j = i; j < st.sessions.size() && j < i + FDS_PER_MSG; j++) {
+            fds.push_back(st.sessions[j].sock);
+            putSession(blob, st.sessions[j]);
+        }
+        if (!sendBatch(successor, BATCH_SESSIONS, fds, blob)) return false;
+    }
+    return sendBatch(successor, BATCH_END, vector<SOCKET>(), none);
+}
+
+void HandoffListener::close() {
+    if (sock == INVALID_SOCKET) return;
+    // shutdown будит поток, висящий в accept; путь не удаляем — его мог занять преемник
+    shutdown(sock, SHUT_RDWR);
+    closeSocket(sock);
+    sock = INVALID_SOCKET;
+}
+
+#else
+
+// Windows: дескрипторы между процессами так не передать — только обычный перезапуск
+bool takeOverFrom(const string&, HandoffState&) { return false; }
+bool HandoffListener::open(const string&) { return false; }
+SOCKET HandoffListener::waitSuccessor() { return INVALID_SOCKET; }
+bool HandoffListener::send(SOCKET, const HandoffState&) { return false; }
+void HandoffListener::close() {}
+
+#endif
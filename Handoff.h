@@ -0,0 +1,63 @@
+﻿// Handoff.h
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "NetUtils.h"
+
+using namespace std;
+
+// Горячий перезапуск без разрыва соединений (только Unix).
+// Работающий сервер слушает Unix-сокет handoff_path. Новый процесс, запускаясь,
+// стучится туда первым делом; старый останавливает реакторы и передаёт ему
+// слушающие сокеты и все живые клиентские (SCM_RIGHTS) вместе с их состоянием:
+// логин, комнаты, недоразобранный ввод, неотправленный вывод, догрузка истории.
+// Клиенты ничего не замечают — ни переподключения, ни повторного входа.
+#define HANDOFF_HELLO "CHAT/HANDOFF 2"
+
+struct HandoffReplay {
+    string room;
+    uint8_t offline = 0;  // 1 — отложенные личные, а не история
+    uint32_t cursor = 0;
+    uint32_t upTo = 0;
+};
+
+// одно клиентское соединение в пути между процессами
+struct HandoffSession {
+    SOCKET sock = INVALID_SOCKET;
+    uint32_t shard = 0;   // в каком реакторе жило (новый возьмёт shard % потоков)
+    uint8_t ready = 0;    // 1 — авторизован, 0 — ещё ждёт логина
+    string login;
+    uint32_t userId = 0;
+    uint8_t proto = 1;
+    string room;
+    vector<string> rooms;
+    string input;         // пришло, но ещё не разобрано (половина строки или кадра)
+    string output;        // поставлено в очередь, но ещё не ушло клиенту
+    vector<HandoffReplay> replays;
+};
+
+struct HandoffState {
+    vector<SOCKET> listeners;
+    vector<HandoffSession> sessions;
+};
+
+// новый процесс: забрать всё у работающего сервера; false — там никого нет
+// (или передача сорвалась — тогда всё полученное уже закрыто) и стартуем как обычно
+bool takeOverFrom(const string& path, HandoffState& st);
+
+// старый процесс: ждёт преемника на Unix-сокете
+class HandoffListener {
+public:
+    ~HandoffListener() { close(); }
+
+    bool open(const string& path);
+    // блокирует поток до прихода преемника; INVALID_SOCKET — слушатель закрыт
+    SOCKET waitSuccessor();
+    // отдать состояние преемнику; сокеты из st после этого можно закрывать
+    bool send(SOCKET successor, const HandoffState& st);
+    void close();
+
+private:
+    SOCKET sock = INVALID_SOCKET;
+};
@@ -0,0 +1,42 @@
+﻿// HashRing.cpp
+#include "HashRing.h"
+#include <algorithm>
+
+static uint64_t fnv1a64(string_view s) {
+    uint64_t h = 14695981039346656037ull;
+    for (unsigned char ch : s) {
+        h ^= ch;
+        h *= 1099511628211ull;
+    }
+    // FNV плохо перемешивает хвост: добиваем финализатором, иначе соседние
+    // "node#1", "node#2" ложатся на кольцо кучно
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    return h;
+}
+
+void HashRing::build(vector<string> nodes, size_t vnodes) {
+    // порядок перечисления в конфиге не должен влиять на кольцо
+    sort(nodes.begin(), nodes.end());
+    nodes.erase(unique(nodes.begin(), nodes.end()), nodes.end());
+    names = move(nodes);
+
+    points.clear();
+    points.reserve(names.size() * vnodes);
+    for (size_t n = 0; n < names.size(); n++) {
+        for (size_t v = 0; v < vnodes; v++) {
+            points.emplace_back(fnv1a64(names[n] + "#" + to_string(v)), n);
+        }
+    }
+    sort(points.begin(), points.end());
+}
+
+const string& HashRing::owner(string_view key) const {
+    static const string none;
+    if (points.empty()) return none;
+    const uint64_t h = fnv1a64(key);
+    auto it = lower_bound(points.begin(), points.end(), make_pair(h, size_t(0)));
+    if (it == points.end()) it = points.begin();
+    return names[it->second];
+}
@@ -0,0 +1,27 @@
+﻿// HashRing.h
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <utility>
+
+using namespace std;
+
+// Согласованное хэширование: у каждого узла vnodes точек на кольце,
+// ключ принадлежит первой точке по часовой стрелке. Добавление или
+// уход узла переносит только его долю ключей, а не перемешивает все.
+// Хэш свой (FNV-1a), а не std::hash: узлы на разных машинах и сборках
+// должны считать одинаково.
+class HashRing {
+public:
+    void build(vector<string> nodes, size_t vnodes = 64);
+
+    bool empty() const { return points.empty(); }
+    // узел-владелец ключа; кольцо пустое — пустая строка
+    const string& owner(string_view key) const;
+
+private:
+    vector<pair<uint64_t, size_t>> points; // точка кольца -> номер узла, по возрастанию
+    vector<string> names;
+};
@@ -0,0 +1,284 @@
+﻿// IoUring.cpp
+#include "IoUring.h"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING 1
+#endif
+#endif
+
+#ifdef HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <poll.h>
+#include <signal.h>
+#include <errno.h>
+#include <cstring>
+#include <cstdint>
+#include <unordered_map>
+#include <algorithm>
+
+static int uringSetup(unsigned entries, io_uring_params* p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags,
+    const void* arg, size_t argSize) {
+    return (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, arg, argSize);
+}
+
+class IoUringLoop : public EventLoop {
+public:
+    ~IoUringLoop() override {
+        if (sqPtr && sqPtr != MAP_FAILED) munmap(sqPtr, sqSize);
+        if (cqPtr && cqPtr != sqPtr && cqPtr != MAP_FAILED) munmap(cqPtr, cqSize);
+        if (sqes && (void*)sqes != MAP_FAILED) munmap(sqes, sqesSize);
+        if (ringFd >= 0) close(ringFd);
+    }
+
+    bool init(unsigned entries);
+
+    bool add(SOCKET s, unsigned flags) override {
+        Reg& r = regs[s];
+        r.flags = 0;
+        r.gen = 0;
+        return arm(s, r, flags);
+    }
+
+    bool modify(SOCKET s, unsigned flags) override {
+        auto it = regs.find(s);
+        if (it == regs.end()) return false;
+        if (it->second.flags == flags) return true;
+        disarm(it->second, s);
+        return arm(s, it->second, flags);
+    }
+
+    void remove(SOCKET s) override {
+        auto it = regs.find(s);
+        if (it == regs.end()) return;
+        disarm(it->second, s);
+        regs.erase(it);
+    }
+
+    int wait(vector<IoEvent>& out, int timeoutMs) override;
+
+    const char* name() const override { return "io_uring_poll"; }
+
+private:
+    struct Reg {
+        unsigned flags = 0; // на что подписан сейчас (0 — poll не взведён)
+        uint32_t gen = 0;   // поколение взведённого poll: старые завершения отбрасываем
+    };
+
+    static uint64_t tag(SOCKET s, uint32_t gen) { return (uint64_t(gen) << 32) | uint32_t(s); }
+
+    io_uring_sqe* nextSqe();
+    bool arm(SOCKET s, Reg& r, unsigned flags);
+    void disarm(Reg& r, SOCKET s);
+    int reap(vector<IoEvent>* out);
+    // сколько SQE ядро ещё не забрало — считаем по самому кольцу
+    void syncSubmitted() { unsubmitted = *sqTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE); }
+
+    int ringFd = -1;
+    void* sqPtr = nullptr;
+    void* cqPtr = nullptr;
+    size_t sqSize = 0, cqSize = 0, sqesSize = 0;
+
+    unsigned* sqHead = nullptr;
+    unsigned* sqTail = nullptr;
+    unsigned* sqArray = nullptr;
+    unsigned sqMask = 0, sqEntries = 0;
+    io_uring_sqe* sqes = nullptr;
+
+    unsigned* cqHead = nullptr;
+    unsigned* cqTail = nullptr;
+    unsigned cqMask = 0;
+    io_uring_cqe* cqes = nullptr;
+
+    unsigned unsubmitted = 0; // заполненные SQE, которые ядро ещё не видело
+    uint32_t nextGen = 1;
+    unordered_map<SOCKET, Reg> regs;
+};
+
+bool IoUringLoop::init(unsigned entries) {
+    io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    ringFd = uringSetup(entries, &p);
+    if (ringFd < 0) return false;
+    // таймаут ожидания передаём прямо в io_uring_enter (5.11+), переполнение CQ не теряет события
+    if (!(p.features & IORING_FEAT_EXT_ARG) || !(p.features & IORING_FEAT_NODROP)) return false;
+
+    sqSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cqSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    const bool single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single) sqSize = cqSize = max(sqSize, cqSize);
+
+    sqPtr = mmap(nullptr, sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+    if (sqPtr == MAP_FAILED) return false;
+    cqPtr = single ? sqPtr
+        : mmap(nullptr, cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+    if (cqPtr == MAP_FAILED) return false;
+    sqesSize = p.sq_entries * sizeof(io_uring_sqe);
+    sqes = (io_uring_sqe*)mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+    if ((void*)sqes == MAP_FAILED) return false;
+
+    char* sq = (char*)sqPtr;
+    sqHead = (unsigned*)(sq + p.sq_off.head);
+    sqTail = (unsigned*)(sq + p.sq_off.tail);
+    sqMask = *(unsigned*)(sq + p.sq_off.ring_mask);
+    sqEntries = *(unsigned*)(sq + p.sq_off.ring_entries);
+    sqArray = (unsigned*)(sq + p.sq_off.array);
+
+    char* cq = (char*)cqPtr;
+    cqHead = (unsigned*)(cq + p.cq_off.head);
+    cqTail = (unsigned*)(cq + p.cq_off.tail);
+    cqMask = *(unsigned*)(cq + p.cq_off.ring_mask);
+    cqes = (io_uring_cqe*)(cq + p.cq_off.cqes);
+
+    // multishot poll появился в 5.13, а флаги функций о нём не говорят — проверяем на пайпе
+    int fds[2];
+    if (pipe(fds) != 0) return false;
+    bool multishot = false;
+    if (add(fds[0], IO_READ) && write(fds[1], "x", 1) == 1) {
+        vector<IoEvent> ev;
+        multishot = wait(ev, 1000) == 1 && ev[0].flags == IO_READ && regs[fds[0]].flags == IO_READ;
+    }
+    remove(fds[0]);
+    uringEnter(ringFd, unsubmitted, 0, 0, nullptr, 0);
+    syncSubmitted();
+    close(fds[0]);
+    close(fds[1]);
+    return multishot;
+}
+
+io_uring_sqe* IoUringLoop::nextSqe() {
+    unsigned tail = *sqTail;
+    if (tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries) {
+        // очередь отправки полна — отдаём ядру накопленное, не дожидаясь wait()
+        if (uringEnter(ringFd, unsubmitted, 0, 0, nullptr, 0) < 0) return nullptr;
+        syncSubmitted();
+        if (tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries) return nullptr;
+    }
+    const unsigned idx = tail & sqMask;
+    io_uring_sqe* sqe = &sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqArray[idx] = idx;
+    __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+    unsubmitted++;
+    return sqe;
+}
+
+bool IoUringLoop::arm(SOCKET s, Reg& r, unsigned flags) {
+    r.flags = flags;
+    if (flags == 0) return true; // ни читать, ни писать не ждём — poll не нужен
+
+    io_uring_sqe* sqe = nextSqe();
+    if (!sqe) {
+        r.flags = 0;
+        return false;
+    }
+    r.gen = nextGen++;
+    if (nextGen == 0) nextGen = 1;
+
+    unsigned mask = 0;
+    if (flags & IO_READ) mask |= POLLIN | POLLRDHUP;
+    if (flags & IO_WRITE) mask |= POLLOUT;
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = s;
+    sqe->len = IORING_POLL_ADD_MULTI; // один взвод — события, пока не отменим
+    sqe->poll32_events = mask;
+    sqe->user_data = tag(s, r.gen);
+    return true;
+}
+
+void IoUringLoop::disarm(Reg& r, SOCKET s) {
+    if (r.flags == 0) return;
+    io_uring_sqe* sqe = nextSqe();
+    if (sqe) {
+        sqe->opcode = IORING_OP_POLL_REMOVE;
+        sqe->fd = -1;
+        sqe->addr = tag(s, r.gen);
+        sqe->user_data = 0; // своё завершение отмена тоже пришлёт — его пропустим
+    }
+    // поколение сбрасываем в любом случае: поздние события старого poll не должны пройти
+    r.flags = 0;
+    r.gen = 0;
+}
+
+int IoUringLoop::reap(vector<IoEvent>* out) {
+    unsigned head = *cqHead;
+    const unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+    int n = 0;
+    for (; head != tail; head++, n++) {
+        const io_uring_cqe& cqe = cqes[head & cqMask];
+        if (cqe.user_data == 0 || !out) continue;
+
+        const SOCKET s = (SOCKET)(uint32_t)cqe.user_data;
+        const uint32_t gen = (uint32_t)(cqe.user_data >> 32);
+        auto it = regs.find(s);
+        if (it == regs.end() || it->second.gen != gen) continue; // отменённый или чужой poll
+
+        unsigned flags = 0;
+        if (cqe.res < 0) {
+            flags = IO_ERROR | IO_READ;
+        }
+        else {
+            const unsigned e = (unsigned)cqe.res;
+            if (e & (POLLIN | POLLRDHUP)) flags |= IO_READ;
+            if (e & POLLOUT) flags |= IO_WRITE;
+            // как и в epoll: при обрыве ещё и IO_READ, чтобы recv вернул 0/-1
+            if (e & (POLLERR | POLLHUP)) flags |= IO_ERROR | IO_READ;
+        }
+
+        // ядро сняло multishot (ошибка или переполнение) — взводим заново с теми же флагами
+        if (!(cqe.flags & IORING_CQE_F_MORE)) {
+            const unsigned want = it->second.flags;
+            it->second.flags = 0;
+            if (cqe.res >= 0 || cqe.res == -ECANCELED) arm(s, it->second, want);
+        }
+        if (flags) out->push_back({ s, flags });
+    }
+    __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+    return n;
+}
+
+int IoUringLoop::wait(vector<IoEvent>& out, int timeoutMs) {
+    out.clear();
+
+    // завершения уже лежат в кольце — только отправляем накопленное, не спим
+    const bool haveCqes = *cqHead != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+    if (!haveCqes || unsubmitted > 0) {
+        __kernel_timespec ts{};
+        io_uring_getevents_arg arg;
+        memset(&arg, 0, sizeof(arg));
+        arg.sigmask_sz = _NSIG / 8;
+        if (timeoutMs >= 0) {
+            ts.tv_sec = timeoutMs / 1000;
+            ts.tv_nsec = (long long)(timeoutMs % 1000) * 1000000;
+            arg.ts = (uint64_t)(uintptr_t)&ts;
+        }
+        const unsigned minComplete = haveCqes ? 0 : 1;
+        int rc = uringEnter(ringFd, unsubmitted, minComplete,
+            IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+        if (rc < 0 && errno != ETIME && errno != EINTR && errno != EBUSY) return -1;
+        syncSubmitted();
+    }
+
+    reap(&out);
+    return (int)out.size();
+}
+
+unique_ptr<EventLoop> makeIoUringLoop() {
+    auto loop = make_unique<IoUringLoop>();
+    if (!loop->init(4096)) return nullptr;
+    return loop;
+}
+
+#else
+
+unique_ptr<EventLoop> makeIoUringLoop() {
+    return nullptr;
+}
+
+#endif
@@ -0,0 +1,17 @@
+﻿// IoUring.h
+#pragma once
+#include "EventLoop.h"
+
+// Бэкенд цикла событий io_uring_poll (только Linux, без liburing — прямые системные вызовы).
+// Это замена epoll, а не ввод-вывод по завершению: кольцо сообщает только о
+// готовности сокетов (многоразовые, multishot, POLL_ADD), а читает и пишет реактор
+// теми же recv/writev, что и с epoll. Выигрыш — в подписках: add/modify/remove
+// копятся в очереди отправки и уходят в ядро одним io_uring_enter вместе с
+// ожиданием, вместо отдельного epoll_ctl на каждое.
+// Чего здесь нет: multishot accept, recv в кольцо выданных ядру буферов, связанных
+// send. Для них реактор должен отдавать буферы кольцу и получать данные из
+// завершений, а он сам читает сокет (LineFramer, сжатие, передача соединений) —
+// это другой интерфейс EventLoop, и число системных вызовов на сообщение при
+// рассылке этот бэкенд не уменьшает.
+// nullptr — ядро или сборка io_uring не умеют (нет multishot poll/EXT_ARG, запрещено seccomp).
+unique_ptr<EventLoop> makeIoUringLoop();
@@ -0,0 +1,120 @@
+﻿// LineFramer.cpp
+#include "LineFramer.h"
+#include <cstring>
+#include <algorithm>
+
+void LineFramer::reset(size_t maxLineLen) {
+    maxLine = maxLineLen == 0 ? 1 : maxLineLen;
+    // ёмкость — степень двойки (индекс = позиция & mask) и не меньше двух строк,
+    // чтобы переполнение замечалось раньше, чем кончится место
+    size_t cap = 1024;
+    while (cap < 2 * maxLine) cap <<= 1;
+    ring.assign(cap, 0);
+    head = tail = scanned = 0;
+    skipping = false;
+    lastTruncated = false;
+    badFrame = false;
+}
+
+pair<char*, size_t> LineFramer::writable() {
+    // буфер пуст — начинаем сначала, так непрерывный кусок под recv самый большой
+    if (head == tail) head = tail = scanned = 0;
+    const size_t freeBytes = ring.size() - (tail - head);
+    const size_t idx = tail & mask();
+    return { ring.data() + idx, min(freeBytes, ring.size() - idx) };
+}
+
+void LineFramer::commit(size_t n) {
+    tail += n;
+}
+
+bool LineFramer::next(string_view& line) {
+    lastTruncated = false;
+    while (true) {
+        // ищем '\n' только в ещё не просмотренной части (не больше двух кусков кольца)
+        size_t nl = string::npos;
+        while (scanned < tail) {
+            const size_t idx = scanned & mask();
+            const size_t run = min(tail - scanned, ring.size() - idx);
+            const void* p = memchr(ring.data() + idx, '\n', run);
+            if (p) {
+                nl = scanned + (size_t)(static_cast<const char*>(p) - (ring.data() + idx));
+                break;
+            }
+            scanned += run;
+        }
+
+        if (skipping) {
+            // выбрасываем хвост слишком длинной строки до её конца
+            if (nl == string::npos) {
+                head = scanned = tail;
+                return false;
+            }
+            head = scanned = nl + 1;
+            skipping = false;
+            continue;
+        }
+
+        size_t len;
+        size_t nextHead;
+        if (nl != string::npos) {
+            len = nl - head;
+            nextHead = nl + 1;
+            if (len > maxLine) {
+                len = maxLine;
+                lastTruncated = true;
+            }
+        }
+        else {
+            if (tail - head <= maxLine) return false; // ждём продолжения строки
+            // конца строки нет, а лимит превышен: отдаём начало, остальное выбросим
+            len = maxLine;
+            nextHead = head + len;
+            lastTruncated = true;
+            skipping = true;
+        }
+
+        line = view(head, len);
+        head = nextHead;
+        if (scanned < head) scanned = head;
+
+        if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+        return true;
+    }
+}
+
+bool LineFramer::nextFrame(string_view& frame) {
+    if (badFrame || tail - head < 4) return false;
+
+    unsigned char hdr[4];
+    for (size_t i = 0; i < 4; i++) hdr[i] = static_cast<unsigned char>(ring[(head + i) & mask()]);
+    const size_t len = (size_t(hdr[0]) << 24) | (size_t(hdr[1]) << 16) | (size_t(hdr[2]) << 8) | hdr[3];
+    if (len == 0 || len > maxLine) {
+        badFrame = true;
+        return false;
+    }
+    if (tail - head < 4 + len) return false; // кадр пришёл не целиком
+
+    frame = view(head + 4, len);
+    head += 4 + len;
+    scanned = head;
+    return true;
+}
+
+string LineFramer::pending() const {
+    string out;
+    out.reserve(tail - head);
+    for (size_t pos = head; pos < tail; pos++) out.push_back(ring[pos & mask()]);
+    return out;
+}
+
+string_view LineFramer::view(size_t pos, size_t len) {
+    const size_t idx = pos & mask();
+    if (idx + len <= ring.size()) return string_view(ring.data() + idx, len);
+
+    // перескочили через конец кольца — склеиваем две части
+    const size_t first = ring.size() - idx;
+    scratch.assign(ring.data() + idx, first);
+    scratch.append(ring.data(), len - first);
+    return scratch;
+}
@@ -0,0 +1,57 @@
+﻿// LineFramer.h
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <utility>
+
+using namespace std;
+
+// Построчный разборщик поверх кольцевого буфера.
+// recv пишет прямо в кольцо (writable/commit), next() отдаёт строки как
+// string_view без копирования и без сдвига хвоста. Копируется только строка,
+// которая перескочила через конец кольца, — в маленький запасной буфер.
+// Строка длиннее maxLine отдаётся обрезанной (truncated() == true),
+// остаток до '\n' выбрасывается.
+// Для протокола 2 то же кольцо умеет отдавать кадры с 4-байтовой длиной (nextFrame).
+class LineFramer {
+public:
+    explicit LineFramer(size_t maxLine = 4096) { reset(maxLine); }
+
+    void reset(size_t maxLine);
+
+    // непрерывный свободный участок для recv; размер 0 — кольцо заполнено
+    pair<char*, size_t> writable();
+    void commit(size_t n);
+
+    // следующая полная строка без '\n' и завершающего '\r';
+    // view живёт до следующего вызова next()/commit()
+    bool next(string_view& line);
+
+    // последняя строка из next() была обрезана по maxLine
+    bool truncated() const { return lastTruncated; }
+
+    // следующий кадр "u32 длина (big-endian) | данные": view на данные без поля длины;
+    // длина больше maxLine — поток испорчен, broken() == true, дальше только закрывать
+    bool nextFrame(string_view& frame);
+    bool broken() const { return badFrame; }
+
+    size_t buffered() const { return tail - head; }
+    // копия ещё не разобранных байт (передача соединения другому процессу)
+    string pending() const;
+
+private:
+    size_t mask() const { return ring.size() - 1; }
+    // непрерывный view на [pos, pos + len); через конец кольца — копия в scratch
+    string_view view(size_t pos, size_t len);
+
+    vector<char> ring;
+    size_t maxLine = 4096;
+    size_t head = 0;     // начало неразобранных данных (позиции растут монотонно)
+    size_t tail = 0;     // конец записанных данных
+    size_t scanned = 0;  // до сюда '\n' уже искали — не сканируем хвост повторно
+    bool skipping = false;       // выбрасываем остаток слишком длинной строки
+    bool lastTruncated = false;
+    bool badFrame = false;
+    string scratch;      // склейка строки, перескочившей через конец кольца
+};
@@ -0,0 +1,299 @@
+﻿// LocalTransport.cpp
+#include "LocalTransport.h"
+#include <cstring>
+#include <new>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+
+#ifndef _WIN32
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <cerrno>
+
+#ifdef MSG_NOSIGNAL
+static const int BELL_FLAGS = MSG_DONTWAIT | MSG_NOSIGNAL;
+#else
+static const int BELL_FLAGS = MSG_DONTWAIT;
+#endif
+
+static_assert(atomic<uint64_t>::is_always_lock_free, "кольцам нужны атомики без блокировок");
+
+// сегмент: заголовок | заголовки колец к серверу и от сервера | данные к серверу | данные от сервера
+static const uint32_t SHM_MAGIC = 0x43484d31; // "CHM1"
+static const size_t SEG_HEADER = 64;
+static const size_t MIN_RING = 4096;
+static const size_t MAX_RING = 64 << 20;
+
+struct SegHeader {
+    uint32_t magic;
+    uint32_t capacity;
+};
+
+static size_t segmentSize(size_t cap) {
+    return SEG_HEADER + 2 * sizeof(ShmRing::Header) + 2 * cap;
+}
+
+static bool fillAddr(const string& path, sockaddr_un& addr) {
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(addr.sun_path)) return false;
+    memcpy(addr.sun_path, path.c_str(), path.size());
+    return true;
+}
+
+SOCKET openLocalListener(const string& path) {
+    sockaddr_un addr;
+    if (!fillAddr(path, addr)) return INVALID_SOCKET;
+    int s = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (s < 0) return INVALID_SOCKET;
+    // файл остался от прежнего запуска (или его держит процесс, отдающий нам клиентов) — занимаем
+    unlink(path.c_str());
+    if (bind(s, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(s, SOMAXCONN) != 0) {
+        closeSocket(s);
+        return INVALID_SOCKET;
+    }
+    setNonBlocking(s);
+    return s;
+}
+
+SOCKET connectLocal(const string& path) {
+    sockaddr_un addr;
+    if (!fillAddr(path, addr)) return INVALID_SOCKET;
+    int s = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (s < 0) return INVALID_SOCKET;
+    if (connect(s, (sockaddr*)&addr, sizeof(addr)) != 0) {
+        closeSocket(s);
+        return INVALID_SOCKET;
+    }
+    return s;
+}
+
+void ShmRing::attach(Header* h, char* d, size_t capacity) {
+    hdr = h;
+    data = d;
+    cap = capacity;
+    mine = 0;
+}
+
+size_t ShmRing::write(const char* p, size_t n, bool& bell) {
+    bell = false;
+    size_t done = 0;
+    while (done < n) {
+        size_t used = (size_t)(mine - hdr->head.load(memory_order_acquire));
+        if (used >= cap) {
+            // не влезло: просим звонок о месте и проверяем ещё раз — вернуть меньше n
+            // можно только с заказанным звонком, иначе остаток в очереди никто не допишет.
+            // (Читатель испортил head — так и останется полным, а реактор отключит
+            // клиента по out_max_bytes)
+            hdr->writerWaiting.store(1);
+            used = (size_t)(mine - hdr->head.load());
+            if (used >= cap) break;
+            hdr->writerWaiting.store(0, memory_order_relaxed);
+        }
+
+        const size_t k = min(n - done, cap - used);
+        const size_t idx = (size_t)(mine & (cap - 1));
+        const size_t first = min(k, cap - idx);
+        memcpy(data + idx, p + done, first);
+        memcpy(data, p + done + first, k - first);
+        mine += k;
+        done += k;
+        // store и load ниже — seq_cst: с парой «флаг, затем tail» у читателя звонок не теряется
+        hdr->tail.store(mine);
+    }
+    bell = done > 0 && hdr->readerWaiting.load() != 0 && hdr->readerWaiting.exchange(0) != 0;
+    return done;
+}
+
+size_t ShmRing::read(char* p, size_t n, bool& bell, bool& broken) {
+    bell = broken = false;
+    size_t avail = (size_t)(hdr->tail.load(memory_order_acquire) - mine);
+    if (avail == 0) {
+        hdr->readerWaiting.store(1);
+        avail = (size_t)(hdr->tail.load() - mine);
+        if (avail == 0) return 0;
+        hdr->readerWaiting.store(0, memory_order_relaxed);
+    }
+    if (avail > cap) {
+        broken = true;
+        return 0;
+    }
+
+    const size_t k = min(n, avail);
+    const size_t idx = (size_t)(mine & (cap - 1));
+    const size_t first = min(k, cap - idx);
+    memcpy(p, data + idx, first);
+    memcpy(p + first, data, k - first);
+    mine += k;
+    hdr->head.store(mine);
+    bell = hdr->writerWaiting.load() != 0 && hdr->writerWaiting.exchange(0) != 0;
+    return k;
+}
+
+ShmLink::~ShmLink() {
+    if (mem) munmap(mem, memSize);
+    // сервер так и не открыл сегмент (отказал) — имя удаляем сами
+    if (owner && !shmName.empty()) shm_unlink(shmName.c_str());
+}
+
+bool ShmLink::map(int fd, size_t size, bool creator) {
+    void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) return false;
+    mem = p;
+    memSize = size;
+
+    char* base = static_cast<char*>(p);
+    SegHeader* seg = reinterpret_cast<SegHeader*>(base);
+    size_t cap;
+    if (creator) {
+        cap = (size - SEG_HEADER - 2 * sizeof(ShmRing::Header)) / 2;
+        seg->magic = SHM_MAGIC;
+        seg->capacity = (uint32_t)cap;
+    }
+    else {
+        // всё, что пришло из чужого сегмента, проверяем и дальше берём только свою копию
+        cap = seg->capacity;
+        if (seg->magic != SHM_MAGIC || cap < MIN_RING || cap > MAX_RING ||
+            (cap & (cap - 1)) != 0 || segmentSize(cap) != size) return false;
+    }
+
+    auto* toServer = reinterpret_cast<ShmRing::Header*>(base + SEG_HEADER);
+    auto* toClient = toServer + 1;
+    char* dataToServer = base + SEG_HEADER + 2 * sizeof(ShmRing::Header);
+    char* dataToClient = dataToServer + cap;
+    if (creator) {
+        new (toServer) ShmRing::Header{};
+        new (toClient) ShmRing::Header{};
+        tx.attach(toServer, dataToServer, cap);
+        rx.attach(toClient, dataToClient, cap);
+    }
+    else {
+        rx.attach(toServer, dataToServer, cap);
+        tx.attach(toClient, dataToClient, cap);
+    }
+    return true;
+}
+
+unique_ptr<ShmLink> ShmLink::create(SOCKET bell, size_t capacity) {
+    static atomic<unsigned> serial{ 0 };
+    size_t cap = MIN_RING;
+    while (cap < capacity && cap < MAX_RING) cap <<= 1;
+
+    unique_ptr<ShmLink> link(new ShmLink());
+    link->bell = bell;
+    link->shmName = "/chat-" + to_string(getpid()) + "-" + to_string(serial++);
+    int fd = shm_open(link->shmName.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) return nullptr;
+    link->owner = true;
+    const size_t size = segmentSize(cap);
+    const bool ok = ftruncate(fd, (off_t)size) == 0 && link->map(fd, size, true);
+    ::close(fd);
+    if (!ok) return nullptr;
+    return link;
+}
+
+unique_ptr<ShmLink> ShmLink::open(SOCKET bell, const string& name) {
+    // только наши имена: клиент не должен заставить сервер открыть чужой объект
+    if (name.size() > 64 || name.rfind("/chat-", 0) != 0 || name.find('/', 1) != string::npos) return nullptr;
+    int fd = shm_open(name.c_str(), O_RDWR, 0);
+    if (fd < 0) return nullptr;
+    // после отображения имя больше не нужно: упадёт кто угодно — в /dev/shm ничего не останется
+    shm_unlink(name.c_str());
+
+    unique_ptr<ShmLink> link(new ShmLink());
+    link->bell = bell;
+    link->shmName = name;
+    struct stat st;
+    const bool ok = fstat(fd, &st) == 0 && (size_t)st.st_size > SEG_HEADER &&
+        link->map(fd, (size_t)st.st_size, false);
+    ::close(fd);
+    if (!ok) return nullptr;
+    return link;
+}
+
+void ShmLink::ring() {
+    // неблокирующий: если звонков и так полный сокет, собеседник и без этого проснётся
+    char b = 1;
+    send(bell, &b, 1, BELL_FLAGS);
+}
+
+int ShmLink::read(char* buf, size_t len) {
+    bool wake, broken;
+    const size_t n = rx.read(buf, len, wake, broken);
+    if (broken) return -2;
+    if (wake) ring();
+    if (n > 0) return (int)n;
+    return peerClosed ? 0 : -1;
+}
+
+int ShmLink::write(const char* data, size_t len) {
+    bool wake;
+    const size_t n = tx.write(data, len, wake);
+    if (wake) ring();
+    return (int)n;
+}
+
+void ShmLink::drainBell() {
+    char buf[256];
+    while (true) {
+        const int n = (int)recv(bell, buf, sizeof(buf), 0);
+        if (n > 0) continue;
+        if (n == 0 || !lastErrorWouldBlock()) peerClosed = true;
+        return;
+    }
+}
+
+int ShmLink::readWait(char* buf, size_t len) {
+    while (true) {
+        const int n = read(buf, len);
+        if (n >= 0) return n;
+        if (n == -2) return -1;
+        // кольцо пусто и звонок заказан — спим на сокете
+        char b[256];
+        const int r = (int)recv(bell, b, sizeof(b), 0);
+        if (r == 0) peerClosed = true;
+        else if (r < 0) return -1;
+    }
+}
+
+bool ShmLink::writeAll(const char* data, size_t len, const atomic<bool>& running) {
+    size_t off = 0;
+    int idle = 0;
+    while (off < len) {
+        const int n = write(data + off, len - off);
+        if (n > 0) {
+            off += (size_t)n;
+            idle = 0;
+            continue;
+        }
+        if (peerClosed || !running) return false;
+        // кольцо полно: сервер под нагрузкой — сначала уступаем ядро, потом короткие паузы
+        if (++idle < 64) this_thread::yield();
+        else this_thread::sleep_for(chrono::microseconds(50));
+    }
+    return true;
+}
+
+#else
+
+// Windows: ни Unix-сокетов в этом сервере, ни shm_open — только TCP
+SOCKET openLocalListener(const string&) { return INVALID_SOCKET; }
+SOCKET connectLocal(const string&) { return INVALID_SOCKET; }
+void ShmRing::attach(Header*, char*, size_t) {}
+size_t ShmRing::write(const char*, size_t, bool& bell) { bell = false; return 0; }
+size_t ShmRing::read(char*, size_t, bool& bell, bool& broken) { bell = broken = false; return 0; }
+ShmLink::~ShmLink() {}
+bool ShmLink::map(int, size_t, bool) { return false; }
+unique_ptr<ShmLink> ShmLink::create(SOCKET, size_t) { return nullptr; }
+unique_ptr<ShmLink> ShmLink::open(SOCKET, const string&) { return nullptr; }
+void ShmLink::ring() {}
+int ShmLink::read(char*, size_t) { return -2; }
+int ShmLink::write(const char*, size_t) { return 0; }
+void ShmLink::drainBell() {}
+int ShmLink::readWait(char*, size_t) { return -1; }
+bool ShmLink::writeAll(const char*, size_t, const atomic<bool>&) { return false; }
+
+#endif
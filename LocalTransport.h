@@ -0,0 +1,99 @@
+﻿// LocalTransport.h
+#pragma once
+#include <string>
+#include <memory>
+#include <atomic>
+#include <cstdint>
+#include "NetUtils.h"
+
+using namespace std;
+
+// Быстрый путь для клиентов на той же машине (боты, мосты) — только Unix.
+//
+// 1. Unix-сокет unix_socket: тот же протокол, что и по TCP, но без стека TCP.
+// 2. Кольца в общей памяти. Клиент, подключённый по Unix-сокету, создаёт сегмент
+//    с двумя SPSC-кольцами (к серверу и от сервера) и самой первой строкой шлёт
+//    "CHAT/SHM <имя>". Сервер открывает сегмент, сразу удаляет имя и отвечает
+//    "CHAT/SHM OK" (или "CHAT/SHM NO" — тогда всё идёт по сокету, как обычно).
+//    Дальше все байты протокола ходят через кольца, а сокет остаётся звонком:
+//    писатель шлёт в него байт, только если читатель перед сном попросил разбудить
+//    (флаг в кольце). Пока обе стороны заняты, сообщение не стоит ни одного
+//    системного вызова. Закрытие сокета — закрытие соединения.
+#define SHM_HELLO "CHAT/SHM"
+#define SHM_ACK   "CHAT/SHM OK"
+#define SHM_NAK   "CHAT/SHM NO"
+
+// слушающий Unix-сокет (старый файл на этом пути удаляется); INVALID_SOCKET — не вышло
+SOCKET openLocalListener(const string& path);
+// блокирующее подключение к нему
+SOCKET connectLocal(const string& path);
+
+// Одно кольцо: один писатель, один читатель, в разных процессах.
+// Позиции растут монотонно, индекс — позиция & (capacity - 1). Свою позицию
+// каждая сторона держит у себя и только публикует в общую память: чужая
+// запись в сегмент не заставит нас читать или писать мимо кольца.
+class ShmRing {
+public:
+    struct Header {
+        alignas(64) atomic<uint64_t> head;  // сколько прочитано (пишет читатель)
+        alignas(64) atomic<uint64_t> tail;  // сколько записано (пишет писатель)
+        alignas(64) atomic<uint32_t> readerWaiting; // читатель уснул — после записи позвонить
+        atomic<uint32_t> writerWaiting;             // писатель ждёт места — после чтения позвонить
+    };
+
+    void attach(Header* h, char* data, size_t capacity);
+
+    // писатель: сколько влезло; 0 — кольцо полно (тогда заказан звонок о месте);
+    // bell — читатель просил разбудить
+    size_t write(const char* p, size_t n, bool& bell);
+    // читатель: сколько прочитано; 0 — пусто (тогда заказан звонок о данных);
+    // bell — писатель ждал места; broken — позиции в сегменте испорчены
+    size_t read(char* p, size_t n, bool& bell, bool& broken);
+
+private:
+    Header* hdr = nullptr;
+    char* data = nullptr;
+    size_t cap = 0;
+    uint64_t mine = 0; // своя позиция: tail у писателя, head у читателя
+};
+
+// Пара колец поверх сегмента общей памяти и сокет-звонок.
+// read/write неблокирующие (для реактора); readWait/writeAll — блокирующие (для клиента).
+class ShmLink {
+public:
+    ~ShmLink();
+
+    // клиент: новый сегмент с кольцами по capacity байт (округляется до степени двойки)
+    static unique_ptr<ShmLink> create(SOCKET bell, size_t capacity);
+    // сервер: сегмент клиента по имени из SHM_HELLO; имя сразу удаляется
+    static unique_ptr<ShmLink> open(SOCKET bell, const string& name);
+
+    const string& name() const { return shmName; }
+
+    // > 0 — прочитано; 0 — собеседник закрыл сокет и кольцо пусто;
+    // -1 — пока пусто (разбудит звонок); -2 — сегмент испорчен
+    int read(char* buf, size_t len);
+    // сколько ушло в кольцо (0 — полно, разбудит звонок)
+    int write(const char* data, size_t len);
+    // вычитать звонки из неблокирующего сокета; закрытие запоминается для read
+    void drainBell();
+    bool closed() const { return peerClosed; }
+
+    // ждёт данных на блокирующем сокете; результат как у recv
+    int readWait(char* buf, size_t len);
+    // ждёт места, пока running (сервер не успевает читать — короткие паузы)
+    bool writeAll(const char* data, size_t len, const atomic<bool>& running);
+
+private:
+    ShmLink() = default;
+    bool map(int fd, size_t size, bool creator);
+    void ring();
+
+    ShmRing rx, tx;
+    SOCKET bell = INVALID_SOCKET; // не наш: закрывает владелец соединения
+    atomic<bool> peerClosed{ false }; // у клиента читает и поток ввода
+    void* mem = nullptr;
+    size_t memSize = 0;
+    string shmName;
+    bool owner = false; // создатель удаляет имя, если сервер его так и не открыл
+};
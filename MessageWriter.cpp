@@ -0,0 +1,141 @@
+﻿// MessageWriter.cpp
+#include "MessageWriter.h"
+#include <iostream>
+#include <algorithm>
+
+// сколько раз пробуем записать строки, которые не легли (база занята и т.п.)
+static const int WRITE_ATTEMPTS = 3;
+
+void MessageWriter::start(size_t batch, chrono::milliseconds delay) {
+    if (worker.joinable()) return;
+    batchSize = batch == 0 ? 1 : batch;
+    maxDelay = delay;
+    stopping = false;
+    lastId = db.lastMessageId();
+    worker = thread([this] { run(); });
+}
+
+void MessageWriter::stop() {
+    {
+        lock_guard<mutex> lock(mtx);
+        stopping = true;
+    }
+    wake.notify_one();
+    if (worker.joinable()) worker.join();
+}
+
+void MessageWriter::submit(Message m, function<void(bool)> onCommit) {
+    {
+        lock_guard<mutex> lock(mtx);
+        if (worker.joinable() && !stopping) {
+            queuedCount++;
+            queue.push_back(Item{ move(m), move(onCommit) });
+            // будим только на первом: остальные заберутся той же пачкой
+            if (queue.size() == 1 || queue.size() == batchSize) wake.notify_one();
+            return;
+        }
+    }
+    // потока нет — как раньше, синхронно
+    const bool ok = db.addMessage(m.sender, m.recipient, m.text, m.room);
+    if (onCommit) onCommit(ok);
+}
+
+void MessageWriter::submitTask(function<void()> job) {
+    {
+        lock_guard<mutex> lock(mtx);
+        if (worker.joinable() && !stopping) {
+            tasks.push_back(move(job));
+            if (tasks.size() == 1) wake.notify_one();
+            return;
+        }
+    }
+    job();
+}
+
+void MessageWriter::afterCommit(function<void(int)> job, bool waitQueue) {
+    {
+        lock_guard<mutex> lock(mtx);
+        if (worker.joinable() && !stopping) {
+            // barriers не пусты только вместе с недописанной очередью — порядок вызовов сохраняется
+            if (waitQueue && doneCount < queuedCount) {
+                barriers.push_back(Barrier{ queuedCount, move(job) });
+                return;
+            }
+            tasks.push_back([job = move(job), id = lastId]() { job(id); });
+            if (tasks.size() == 1) wake.notify_one();
+            return;
+        }
+    }
+    job(db.lastMessageId());
+}
+
+void MessageWriter::run() {
+    unique_lock<mutex> lock(mtx);
+    while (true) {
+        wake.wait(lock, [&] { return stopping || !queue.empty() || !tasks.empty(); });
+        if (queue.empty() && tasks.empty()) break; // stopping и всё дописано
+
+        // задачи ждут человека (вход) — их вперёд и без задержки на сбор пачки
+        if (!tasks.empty()) {
+            vector<function<void()>> now;
+            now.swap(tasks);
+            lock.unlock();
+            for (auto& job : now) job();
+            lock.lock();
+            continue;
+        }
+
+        // первое сообщение пришло — даём пачке набраться, но не дольше maxDelay
+        if (!stopping && queue.size() < batchSize && maxDelay.count() > 0) {
+            wake.wait_for(lock, maxDelay, [&] { return stopping || queue.size() >= batchSize || !tasks.empty(); });
+        }
+
+        vector<Message> batch;
+        vector<pair<size_t, function<void(bool)>>> acks; // номер в пачке -> подтверждение
+        while (!queue.empty() && batch.size() < batchSize) {
+            if (queue.front().onCommit) acks.emplace_back(batch.size(), move(queue.front().onCommit));
+            batch.push_back(move(queue.front().msg));
+            queue.pop_front();
+        }
+
+        // в БД — без замка: реакторы тем временем продолжают ставить новые
+        lock.unlock();
+        vector<int> ids;
+        db.addMessages(batch, &ids);
+        // повторяем только то, что не легло: вставленное уже зафиксировано
+        for (int attempt = 1; attempt < WRITE_ATTEMPTS; attempt++) {
+            vector<Message> rest;
+            vector<size_t> where;
+            for (size_t i = 0; i < batch.size(); i++) {
+                if (ids[i] != 0) continue;
+                rest.push_back(batch[i]);
+                where.push_back(i);
+            }
+            if (rest.empty()) break;
+            this_thread::sleep_for(chrono::milliseconds(20 << attempt));
+            vector<int> again;
+            db.addMessages(rest, &again);
+            for (size_t j = 0; j < rest.size(); j++) {
+                if (again[j] != 0) ids[where[j]] = again[j];
+            }
+        }
+        const size_t lost = (size_t)count(ids.begin(), ids.end(), 0);
+        if (lost > 0) cerr << "Не удалось записать " << lost << " из " << batch.size() << " сообщений" << endl;
+
+        // счётчики — до подтверждений: кто спросит lastId после рассылки, её уже учтёт.
+        // Ждавшие afterCommit уходят в задачи с id последней строки, поставленной до них
+        lock.lock();
+        for (int rowId : ids) {
+            lastId = max(lastId, rowId);
+            doneCount++;
+            while (!barriers.empty() && barriers.front().upTo <= doneCount) {
+                tasks.push_back([job = move(barriers.front().job), id = lastId]() { job(id); });
+                barriers.pop_front();
+            }
+        }
+        lock.unlock();
+
+        for (auto& ack : acks) ack.second(ids[ack.first] != 0);
+        lock.lock();
+    }
+}
@@ -0,0 +1,69 @@
+﻿// MessageWriter.h
+#pragma once
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <functional>
+#include <condition_variable>
+#include "Database.h"
+
+using namespace std;
+
+// Запись сообщений в БД отдельным потоком с групповой фиксацией.
+// Реакторы только кладут сообщение в очередь; поток-писатель забирает
+// сколько накопилось (до batch штук, подождав не дольше delay) и пишет их
+// одной транзакцией — один fsync на пачку вместо fsync на каждую строку.
+// onCommit вызывается в потоке-писателе после COMMIT (режим persist_ack=durable):
+// true — строка в БД; false — не легла и после повторов, подтверждать нечего.
+// Сюда же уходит и другая работа с БД, которой не место в потоке реактора
+// (проверка пароля при входе): submitTask выполняет её между пачками,
+// afterCommit — когда запишется всё, что поставлено раньше (догрузка истории).
+class MessageWriter {
+public:
+    explicit MessageWriter(Database& db) : db(db) {}
+    ~MessageWriter() { stop(); }
+
+    // до start() (и после stop()) submit пишет сразу, в вызывающем потоке
+    void start(size_t batch, chrono::milliseconds delay);
+    // дописать очередь и остановить поток
+    void stop();
+
+    void submit(Message m, function<void(bool)> onCommit = nullptr);
+    // выполнить job в потоке-писателе (без потока — сразу, в вызывающем)
+    void submitTask(function<void()> job);
+
+    // выполнить job(lastId) в потоке-писателе, когда всё поставленное до этого вызова
+    // окажется в БД; lastId — id последней записанной строки из него.
+    // waitQueue=false — очередь не ждать, lastId — что записано на момент вызова
+    void afterCommit(function<void(int)> job, bool waitQueue = true);
+
+private:
+    struct Item {
+        Message msg;
+        function<void(bool)> onCommit;
+    };
+    struct Barrier {
+        uint64_t upTo; // ждёт, пока doneCount дойдёт до этого
+        function<void(int)> job;
+    };
+
+    void run();
+
+    Database& db;
+    mutex mtx;
+    condition_variable wake;      // писателю: есть работа или пора выходить
+    deque<Item> queue;
+    vector<function<void()>> tasks;
+    deque<Barrier> barriers;      // afterCommit, ждущие своей пачки (по возрастанию upTo)
+    uint64_t queuedCount = 0;     // сколько всего поставлено
+    uint64_t doneCount = 0;       // сколько из них уже зафиксировано
+    int lastId = 0;               // id последней записанной строки (в порядке очереди)
+    bool stopping = false;
+    thread worker;
+
+    size_t batchSize = 256;
+    chrono::milliseconds maxDelay{ 5 };
+};
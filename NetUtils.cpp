@@ -0,0 +1,75 @@
+﻿// NetUtils.cpp
+#include "NetUtils.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/resource.h>
+#endif
+
+void closeSocket(SOCKET s) {
+#ifdef _WIN32
+    closesocket(s);
+#else
+    close(s);
+#endif
+}
+
+bool setNonBlocking(SOCKET s, bool on) {
+#ifdef _WIN32
+    u_long mode = on ? 1 : 0;
+    return ioctlsocket(s, FIONBIO, &mode) == 0;
+#else
+    int flags = fcntl(s, F_GETFL, 0);
+    if (flags < 0) return false;
+    flags = on ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+    return fcntl(s, F_SETFL, flags) == 0;
+#endif
+}
+
+bool lastErrorWouldBlock() {
+#ifdef _WIN32
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+#endif
+}
+
+void raiseFdLimit() {
+#ifndef _WIN32
+    rlimit rl{};
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+#endif
+}
+
+bool makeWakeupPair(SOCKET& readEnd, SOCKET& writeEnd) {
+#ifdef _WIN32
+    // в Winsock нет socketpair: UDP-сокет на 127.0.0.1, подключённый сам к себе
+    SOCKET s = socket(AF_INET, SOCK_DGRAM, 0);
+    if (s == INVALID_SOCKET) return false;
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int len = sizeof(addr);
+    if (bind(s, (sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR ||
+        getsockname(s, (sockaddr*)&addr, &len) == SOCKET_ERROR ||
+        connect(s, (sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR) {
+        closesocket(s);
+        return false;
+    }
+    setNonBlocking(s);
+    readEnd = writeEnd = s;
+    return true;
+#else
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) return false;
+    setNonBlocking(sv[0]);
+    setNonBlocking(sv[1]);
+    readEnd = sv[0];
+    writeEnd = sv[1];
+    return true;
+#endif
+}
@@ -0,0 +1,35 @@
+﻿// NetUtils.h
+#pragma once
+// общие сетевые определения для Windows (Winsock) и POSIX
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+typedef int SOCKET;
+#define INVALID_SOCKET -1
+#define SOCKET_ERROR   -1
+#endif
+
+void closeSocket(SOCKET s);
+
+// перевести сокет в неблокирующий (on = true) или блокирующий режим
+bool setNonBlocking(SOCKET s, bool on = true);
+
+// последняя операция завершилась с EWOULDBLOCK/EAGAIN (не ошибка, данных пока нет)
+bool lastErrorWouldBlock();
+
+// поднять лимит открытых дескрипторов до максимума (нужно для десятков тысяч клиентов)
+void raiseFdLimit();
+
+// пара сокетов для пробуждения цикла событий из другого потока:
+// пишем байт в writeEnd — readEnd становится готов к чтению
+bool makeWakeupPair(SOCKET& readEnd, SOCKET& writeEnd);
@@ -0,0 +1,90 @@
+﻿// OutQueue.cpp
+#include "OutQueue.h"
+
+#ifndef _WIN32
+#include <sys/uio.h>
+#endif
+
+void OutQueue::push(FramePtr frame, size_t offset) {
+    if (!frame || offset >= frame->size()) return;
+    if (frames.empty()) headOffset = offset;
+    bytes += frame->size() - offset;
+    frames.push_back(move(frame));
+}
+
+string OutQueue::pending() const {
+    string out;
+    out.reserve(bytes);
+    for (size_t i = 0; i < frames.size(); i++) {
+        const size_t off = (i == 0) ? headOffset : 0;
+        out.append(frames[i]->data() + off, frames[i]->size() - off);
+    }
+    return out;
+}
+
+bool OutQueue::flush(SOCKET s) {
+    while (!frames.empty()) {
+        // собираем вектор из первых кадров очереди
+        int cnt = 0;
+        size_t wanted = 0;
+#ifdef _WIN32
+        WSABUF iov[MAX_IOV];
+        for (auto it = frames.begin(); it != frames.end() && cnt < MAX_IOV; ++it, ++cnt) {
+            const size_t off = (cnt == 0) ? headOffset : 0;
+            iov[cnt].buf = const_cast<char*>((*it)->data() + off);
+            iov[cnt].len = (ULONG)((*it)->size() - off);
+            wanted += iov[cnt].len;
+        }
+        DWORD sent = 0;
+        if (WSASend(s, iov, (DWORD)cnt, &sent, 0, nullptr, nullptr) == SOCKET_ERROR) {
+            return lastErrorWouldBlock();
+        }
+        size_t rc = sent;
+#else
+        iovec iov[MAX_IOV];
+        for (auto it = frames.begin(); it != frames.end() && cnt < MAX_IOV; ++it, ++cnt) {
+            const size_t off = (cnt == 0) ? headOffset : 0;
+            iov[cnt].iov_base = const_cast<char*>((*it)->data() + off);
+            iov[cnt].iov_len = (*it)->size() - off;
+            wanted += iov[cnt].iov_len;
+        }
+        ssize_t n = writev(s, iov, cnt);
+        if (n < 0) return lastErrorWouldBlock();
+        size_t rc = (size_t)n;
+#endif
+        if (rc == 0) return false;
+
+        // снимаем полностью ушедшие кадры, у частично ушедшего запоминаем смещение
+        bytes -= rc;
+        const bool partial = rc < wanted;
+        while (rc > 0) {
+            const size_t left = frames.front()->size() - headOffset;
+            if (rc < left) {
+                headOffset += rc;
+                break;
+            }
+            rc -= left;
+            frames.pop_front();
+            headOffset = 0;
+        }
+        if (partial) return true; // ядро взяло не всё — буфер полон, ждём готовности к записи
+    }
+    return true;
+}
+
+bool OutQueue::flush(const function<int(const char*, size_t)>& write) {
+    while (!frames.empty()) {
+        const FramePtr& f = frames.front();
+        const size_t left = f->size() - headOffset;
+        const int n = write(f->data() + headOffset, left);
+        if (n < 0) return false;
+        bytes -= (size_t)n;
+        if ((size_t)n < left) {
+            headOffset += (size_t)n;
+            return true; // кольцо полно — допишем по звонку
+        }
+        frames.pop_front();
+        headOffset = 0;
+    }
+    return true;
+}
@@ -0,0 +1,38 @@
+﻿// OutQueue.h
+#pragma once
+#include <string>
+#include <deque>
+#include <functional>
+#include "NetUtils.h"
+#include "Frame.h"
+
+using namespace std;
+
+// Исходящая очередь одного соединения — цепочка общих кадров.
+// Всё, что сокет не принял сразу (частичная запись / EWOULDBLOCK),
+// лежит здесь и дописывается, когда сокет снова готов к записи;
+// несколько кадров уходят одним writev/WSASend.
+class OutQueue {
+public:
+    bool empty() const { return frames.empty(); }
+    size_t size() const { return bytes; }
+
+    // offset — сколько байт кадра уже отправлено мимо очереди
+    void push(FramePtr frame, size_t offset = 0);
+
+    // пишет в сокет, пока он принимает; false — соединение сломано
+    bool flush(SOCKET s);
+    // то же для транспорта без writev (кольцо в общей памяти): write(p, n) — сколько взял
+    bool flush(const function<int(const char*, size_t)>& write);
+
+    // всё неотправленное одной строкой (передача соединения другому процессу)
+    string pending() const;
+
+private:
+    // сколько кадров отдаём ядру за один системный вызов
+    static const int MAX_IOV = 64;
+
+    deque<FramePtr> frames;
+    size_t headOffset = 0; // сколько байт первого кадра уже отправлено
+    size_t bytes = 0;
+};
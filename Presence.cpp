@@ -0,0 +1,110 @@
+﻿// Presence.cpp
+#include "Presence.h"
+
+// в одной строке снимка для протокола 1 — не больше стольких логинов
+static const size_t SNAPSHOT_LINE_NAMES = 50;
+
+bool Presence::join(const string& login, uint32_t id, bool* visible) {
+    lock_guard<mutex> lock(mtx);
+    Entry& e = users[login];
+    e.id = id;
+    if (visible) *visible = e.published;
+    if (e.conns++ > 0) return false; // уже в сети с другого соединения
+    return touch(login);
+}
+
+bool Presence::leave(const string& login) {
+    lock_guard<mutex> lock(mtx);
+    auto it = users.find(login);
+    if (it == users.end() || it->second.conns == 0) return false;
+    if (--it->second.conns > 0) return false;
+    return touch(login);
+}
+
+void Presence::restore(const string& login, uint32_t id) {
+    lock_guard<mutex> lock(mtx);
+    Entry& e = users[login];
+    e.id = id;
+    e.conns++;
+    e.published = true;
+    snapText.reset();
+    snapBin.reset();
+}
+
+bool Presence::touch(const string& login) {
+    // dirty — просто список на проверку: повтор логина отсеется при рассылке
+    dirty.push_back(login);
+    return dirty.size() == 1;
+}
+
+void Presence::flush(bool bin, const function<void(const PresenceUpdate&)>& send) {
+    lock_guard<mutex> lock(mtx);
+    if (dirty.empty()) return;
+
+    PresenceUpdate u;
+    string text, frames;
+    for (const auto& login : dirty) {
+        auto it = users.find(login);
+        if (it == users.end()) continue;
+        Entry& e = it->second;
+        const bool online = e.conns > 0;
+        // вышел и вернулся (или наоборот) в пределах окна — клиентам ничего не поменялось
+        if (online == e.published) {
+            if (!online) users.erase(it);
+            continue;
+        }
+        e.published = online;
+        if (online) u.joined.insert(login);
+
+        text += "[Сервер] " + login + (online ? " подключился\n" : " отключился\n");
+        // несколько кадров Presence подряд в одном буфере — тот же протокол, один send
+        if (bin) frames += FrameWriter(MsgType::Presence).u8(online ? 1 : 0).u32(e.id).str(login).bytes();
+        if (!online) users.erase(it);
+    }
+    dirty.clear();
+    if (text.empty()) return;
+
+    snapText.reset();
+    snapBin.reset();
+    u.delta = Outgoing{ makeFrame(move(text)), bin ? makeFrame(move(frames)) : nullptr };
+    if (!u.joined.empty()) {
+        u.snapText = snapshotLocked(1);
+        if (bin) u.snapBin = snapshotLocked(2);
+    }
+    send(u);
+}
+
+FramePtr Presence::snapshot(int proto) {
+    lock_guard<mutex> lock(mtx);
+    return snapshotLocked(proto);
+}
+
+FramePtr Presence::snapshotLocked(int proto) {
+    FramePtr& cached = proto == 2 ? snapBin : snapText;
+    if (cached) return cached;
+
+    vector<const pair<const string, Entry>*> online;
+    for (const auto& kv : users) {
+        if (kv.second.published) online.push_back(&kv);
+    }
+
+    if (proto == 2) {
+        vector<pair<uint32_t, string>> list;
+        list.reserve(online.size());
+        for (const auto* u : online) list.emplace_back(u->second.id, u->first);
+        cached = makeFrame(listFrames(MsgType::Online, list));
+        return cached;
+    }
+
+    string text = "[Сервер] В сети: " + to_string(online.size()) + "\n";
+    for (size_t i = 0; i < online.size(); i += SNAPSHOT_LINE_NAMES) {
+        text += "[Сервер] ";
+        for (size_t j = i; j < online.size() && j < i + SNAPSHOT_LINE_NAMES; j++) {
+            if (j > i) text += ", ";
+            text += online[j]->first;
+        }
+        text += '\n';
+    }
+    cached = makeFrame(move(text));
+    return cached;
+}
@@ -0,0 +1,66 @@
+﻿// Presence.h
+#pragma once
+#include <string>
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+#include "Protocol.h"
+
+using namespace std;
+
+// Кто сейчас в сети. Подключения и отключения не рассылаются сразу,
+// а копятся в течение окна (presence_window_ms) и уходят одним пакетом
+// изменений; выход и повторный вход одного логина в пределах окна
+// взаимно гасятся. Клиент, чей логин уже виден остальным, получает снимок
+// «кто в сети» на момент последней рассылки, а всё, что случилось позже, придёт
+// ему в следующем пакете. Вошедший заново ждёт конца окна и получает вместо
+// пакета свежий снимок — иначе увидел бы в пакете строку о собственном входе.
+
+// что разослать по итогам окна
+struct PresenceUpdate {
+    Outgoing delta;               // тем, кто уже видел прежний снимок
+    unordered_set<string> joined; // вошли в этом окне: им не delta, а снимок ниже
+    FramePtr snapText, snapBin;   // снимок после окна (только если joined не пусто)
+};
+
+class Presence {
+public:
+    explicit Presence(chrono::milliseconds window = chrono::milliseconds(200)) : window(window) {}
+
+    void setWindow(chrono::milliseconds w) { window = w; }
+    chrono::milliseconds windowLength() const { return window; }
+
+    // true — изменение открыло новое окно: вызвавший должен сделать flush() через windowLength();
+    // visible (если задан) — логин уже виден клиентам, снимок новому соединению можно слать сразу
+    bool join(const string& login, uint32_t id, bool* visible = nullptr);
+    bool leave(const string& login);
+    // соединение перешло от прежнего процесса: клиенты уже видят логин в сети, ничего не рассылаем
+    void restore(const string& login, uint32_t id);
+
+    // разослать накопленное через send (под замком, чтобы снимок и пакет не разошлись);
+    // bin — собирать ли кадры протокола 2
+    void flush(bool bin, const function<void(const PresenceUpdate&)>& send);
+
+    // снимок в кодировке протокола proto (общий кадр, пересобирается только после flush)
+    FramePtr snapshot(int proto);
+
+private:
+    struct Entry {
+        uint32_t id = 0;
+        int conns = 0;       // один логин может сидеть с нескольких соединений
+        bool published = false; // так его видят клиенты после последней рассылки
+    };
+
+    // логин изменил состояние; true — это первое изменение в окне
+    bool touch(const string& login);
+    FramePtr snapshotLocked(int proto);
+
+    mutex mtx;
+    chrono::milliseconds window;
+    unordered_map<string, Entry> users;
+    vector<string> dirty; // логины, менявшиеся в текущем окне
+    FramePtr snapText, snapBin;
+};
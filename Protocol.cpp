@@ -0,0 +1,116 @@
+﻿// Protocol.cpp
+#include "Protocol.h"
+#include <algorithm>
+
+FrameWriter::FrameWriter(MsgType type) {
+    buf.reserve(64);
+    buf.append(FRAME_HEADER, '\0');
+    buf.push_back(static_cast<char>(type));
+}
+
+FrameWriter& FrameWriter::u8(uint8_t v) {
+    buf.push_back(static_cast<char>(v));
+    return *this;
+}
+
+FrameWriter& FrameWriter::u16(uint16_t v) {
+    buf.push_back(static_cast<char>(v >> 8));
+    buf.push_back(static_cast<char>(v & 0xFF));
+    return *this;
+}
+
+FrameWriter& FrameWriter::u32(uint32_t v) {
+    buf.push_back(static_cast<char>(v >> 24));
+    buf.push_back(static_cast<char>((v >> 16) & 0xFF));
+    buf.push_back(static_cast<char>((v >> 8) & 0xFF));
+    buf.push_back(static_cast<char>(v & 0xFF));
+    return *this;
+}
+
+FrameWriter& FrameWriter::str(string_view s) {
+    if (s.size() > 0xFFFF) s = s.substr(0, 0xFFFF);
+    u16(static_cast<uint16_t>(s.size()));
+    buf.append(s.data(), s.size());
+    return *this;
+}
+
+string FrameWriter::bytes() {
+    const uint32_t len = static_cast<uint32_t>(buf.size() - FRAME_HEADER);
+    buf[0] = static_cast<char>(len >> 24);
+    buf[1] = static_cast<char>((len >> 16) & 0xFF);
+    buf[2] = static_cast<char>((len >> 8) & 0xFF);
+    buf[3] = static_cast<char>(len & 0xFF);
+    return buf;
+}
+
+string listFrames(MsgType type, const vector<pair<uint32_t, string>>& entries) {
+    // тип, more и count — в каждом кадре; запись — id и строка с длиной
+    const size_t head = 1 + 1 + 4;
+    auto entrySize = [](const string& login) { return 4 + 2 + min(login.size(), (size_t)0xFFFF); };
+
+    string out;
+    size_t i = 0;
+    do {
+        vector<size_t> part;
+        size_t len = head;
+        for (; i < entries.size(); i++) {
+            const size_t n = entrySize(entries[i].second);
+            // запись, которая не влезает даже одна, не отправить никак — пропускаем
+            if (head + n > MAX_FRAME) continue;
+            if (len + n > MAX_FRAME) break;
+            len += n;
+            part.push_back(i);
+        }
+        FrameWriter w(type);
+        w.u8(i < entries.size() ? 1 : 0).u32((uint32_t)part.size());
+        for (size_t k : part) w.u32(entries[k].first).str(entries[k].second);
+        out += w.bytes();
+    } while (i < entries.size());
+    return out;
+}
+
+FrameReader::FrameReader(string_view frame) : rest(frame) {
+    uint8_t type = 0;
+    if (u8(type)) t = static_cast<MsgType>(type);
+}
+
+bool FrameReader::take(size_t n, const char*& p) {
+    if (!good || rest.size() < n) {
+        good = false;
+        return false;
+    }
+    p = rest.data();
+    rest.remove_prefix(n);
+    return true;
+}
+
+bool FrameReader::u8(uint8_t& v) {
+    const char* p;
+    if (!take(1, p)) return false;
+    v = static_cast<uint8_t>(p[0]);
+    return true;
+}
+
+bool FrameReader::u16(uint16_t& v) {
+    const char* p;
+    if (!take(2, p)) return false;
+    const auto* b = reinterpret_cast<const unsigned char*>(p);
+    v = static_cast<uint16_t>((b[0] << 8) | b[1]);
+    return true;
+}
+
+bool FrameReader::u32(uint32_t& v) {
+    const char* p;
+    if (!take(4, p)) return false;
+    const auto* b = reinterpret_cast<const unsigned char*>(p);
+    v = (uint32_t(b[0]) << 24) | (uint32_t(b[1]) << 16) | (uint32_t(b[2]) << 8) | uint32_t(b[3]);
+    return true;
+}
+
+bool FrameReader::str(string_view& s) {
+    uint16_t len = 0;
+    const char* p;
+    if (!u16(len) || !take(len, p)) return false;
+    s = string_view(p, len);
+    return true;
+}
@@ -0,0 +1,118 @@
+﻿// Protocol.h
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <utility>
+#include "Frame.h"
+
+using namespace std;
+
+// Протокол 2: бинарные кадры с длиной вместо строк с '\n'.
+// Включается первой строкой клиента PROTO2_HELLO; сервер отвечает PROTO2_ACK,
+// и дальше обе стороны говорят кадрами. Старые клиенты шлют "login:password"
+// и остаются на текстовом протоколе 1.
+//
+// Кадр: u32 длина (big-endian, считается от типа) | u8 тип | данные.
+// Строки — u16 длина + байты UTF-8, пользователи — числовые id из таблицы users.
+#define PROTO2_HELLO "CHAT/2"
+#define PROTO2_ACK   "CHAT/2 OK"
+
+// Протокол 1: "OFFLINE_MARK id" — порция отложенных личных выдана до id, клиент
+// отвечает "/ack id". Начинается с управляющего байта: их сервер не принимает
+// ни в логинах, ни в текстах, так что строка чата или списка так начаться не может
+#define OFFLINE_MARK "\x01" "OFFLINE "
+
+// в логине — не больше стольких байт и ни одного управляющего символа
+static const size_t MAX_LOGIN = 64;
+
+// управляющие символы (кроме табуляции) — только в служебных строках сервера
+inline bool hasControlChars(string_view s) {
+    for (unsigned char ch : s) {
+        if ((ch < 0x20 && ch != '\t') || ch == 0x7f) return true;
+    }
+    return false;
+}
+
+static const size_t FRAME_HEADER = 4;
+// больше этого (тип + данные) кадр не бывает: обе стороны рвут соединение с таким;
+// длинные списки сервер режет на несколько кадров (listFrames)
+static const size_t MAX_FRAME = 64 * 1024;
+
+enum class MsgType : uint8_t {
+    Auth = 1,    // К→С: login, password
+    AuthResult,  // С→К: u8 ok, u32 userId
+    PublicMsg,   // К→С: text;            С→К: u32 fromId, text
+    PrivateMsg,  // К→С: u32 toId, text;  С→К: u32 fromId, u32 toId, text
+    UserList,    // С→К: u8 more, u32 count, { u32 id, login } * count; more=1 — продолжение в следующем кадре
+    Presence,    // С→К: u8 online, u32 id, login
+    Error,       // С→К: u16 code, text
+    Info,        // С→К: text (справка и прочие сообщения сервера)
+    Command,     // К→С: text (/users, /help и другие текстовые команды)
+    Online,      // С→К: как UserList (u8 more, u32 count, ...) — кто в сети при входе
+    RoomMsg,     // К→С: room, text;      С→К: u32 fromId, room, text
+    Ping,        // С→К: пусто — клиент давно молчит, жив ли он
+    Pong,        // К→С: пусто — ответ на Ping
+    OfflineEnd,  // С→К: u32 lastId — порция отложенных личных выдана, ждём "/ack lastId"
+};
+
+// коды кадра Error
+enum ErrorCode : uint16_t {
+    ERR_USAGE = 1,     // неверный синтаксис команды
+    ERR_OFFLINE = 2,   // адресат не в сети
+    ERR_BAD_FRAME = 3, // непонятный или неуместный кадр
+    ERR_RATE_LIMIT = 4, // слишком часто: сообщение отброшено
+    ERR_NOT_STORED = 5, // не удалось сохранить в БД: сообщение никому не ушло
+};
+
+// Сборка кадра: заголовок резервируется сразу, длина проставляется в finish()
+class FrameWriter {
+public:
+    explicit FrameWriter(MsgType type);
+
+    FrameWriter& u8(uint8_t v);
+    FrameWriter& u16(uint16_t v);
+    FrameWriter& u32(uint32_t v);
+    FrameWriter& str(string_view s); // длиннее 65535 байт — обрезается
+
+    string bytes();       // готовый кадр (для клиента и sendAll)
+    FramePtr finish() { return makeFrame(bytes()); }
+
+private:
+    string buf;
+};
+
+// Список { u32 id, login } кадрами типа type (UserList, Online), каждый не длиннее
+// MAX_FRAME; у всех, кроме последнего, more = 1. Пустой список — один кадр с count = 0
+string listFrames(MsgType type, const vector<pair<uint32_t, string>>& entries);
+
+// Разбор кадра (тип + данные, без поля длины). Любой выход за границу
+// переводит читателя в состояние ошибки, все дальнейшие чтения — false.
+class FrameReader {
+public:
+    explicit FrameReader(string_view frame);
+
+    MsgType type() const { return t; }
+    bool ok() const { return good; }
+
+    bool u8(uint8_t& v);
+    bool u16(uint16_t& v);
+    bool u32(uint32_t& v);
+    bool str(string_view& s);
+
+private:
+    bool take(size_t n, const char*& p);
+
+    string_view rest;
+    MsgType t = MsgType::Error;
+    bool good = true;
+};
+
+// Одно исходящее сообщение сразу в двух кодировках: текстовой (протокол 1)
+// и бинарной (протокол 2). Любая из них может отсутствовать — такие
+// получатели сообщение просто не получат.
+struct Outgoing {
+    FramePtr text;
+    FramePtr bin;
+};
@@ -0,0 +1,63 @@
+﻿// RateLimiter.cpp
+#include "RateLimiter.h"
+#include <algorithm>
+#include <cmath>
+
+void TokenBucket::configure(double r, double b) {
+    rate = r;
+    burst = max(b, r);
+    tokens = burst; // новый клиент начинает с полным запасом
+    last = chrono::steady_clock::now();
+}
+
+void TokenBucket::refill(chrono::steady_clock::time_point now) {
+    if (now <= last) return;
+    const double sec = chrono::duration<double>(now - last).count();
+    tokens = min(burst, tokens + sec * rate);
+    last = now;
+}
+
+bool TokenBucket::ready(double n, chrono::steady_clock::time_point now) {
+    if (unlimited()) return true;
+    refill(now);
+    return tokens >= n;
+}
+
+void TokenBucket::take(double n, chrono::steady_clock::time_point now) {
+    if (unlimited()) return;
+    refill(now);
+    tokens -= n;
+}
+
+chrono::milliseconds TokenBucket::waitFor(double n, chrono::steady_clock::time_point now) {
+    if (unlimited()) return chrono::milliseconds(0);
+    refill(now);
+    if (tokens >= n) return chrono::milliseconds(0);
+    return chrono::milliseconds((long long)ceil((n - tokens) / rate * 1000.0));
+}
+
+void LoginLimiter::configure(double msgsPerSec, double bytesPerSec) {
+    lock_guard<mutex> lock(mtx);
+    msgRate = msgsPerSec;
+    byteRate = bytesPerSec;
+    logins.clear();
+}
+
+bool LoginLimiter::allow(const string& login, size_t bytes) {
+    if (!enabled()) return true;
+    const auto now = chrono::steady_clock::now();
+
+    lock_guard<mutex> lock(mtx);
+    auto it = logins.find(login);
+    if (it == logins.end()) {
+        it = logins.emplace(login, Buckets()).first;
+        // запас — две секунды лимита: короткий всплеск не наказываем
+        it->second.msgs.configure(msgRate, msgRate * 2);
+        it->second.bytes.configure(byteRate, byteRate * 2);
+    }
+    Buckets& b = it->second;
+    if (!b.msgs.ready(1, now) || !b.bytes.ready((double)bytes, now)) return false;
+    b.msgs.take(1, now);
+    b.bytes.take((double)bytes, now);
+    return true;
+}
@@ -0,0 +1,53 @@
+﻿// RateLimiter.h
+#pragma once
+#include <string>
+#include <chrono>
+#include <mutex>
+#include <unordered_map>
+
+using namespace std;
+
+// Ведро токенов: rate токенов в секунду, не больше burst про запас.
+// rate == 0 — ограничения нет. take() может уйти в минус (долг):
+// так байты уже прочитанного recv учитываются честно, а следующий
+// recv подождёт, пока долг не отработается.
+class TokenBucket {
+public:
+    void configure(double rate, double burst);
+
+    bool unlimited() const { return rate <= 0; }
+    // хватает ли n токенов прямо сейчас
+    bool ready(double n, chrono::steady_clock::time_point now);
+    void take(double n, chrono::steady_clock::time_point now);
+    // сколько ждать, пока наберётся n токенов
+    chrono::milliseconds waitFor(double n, chrono::steady_clock::time_point now);
+
+private:
+    void refill(chrono::steady_clock::time_point now);
+
+    double rate = 0;
+    double burst = 0;
+    double tokens = 0;
+    chrono::steady_clock::time_point last;
+};
+
+// Общие для всех реакторов вёдра по логину: ограничение нельзя обойти,
+// открыв несколько соединений под одним именем.
+class LoginLimiter {
+public:
+    void configure(double msgsPerSec, double bytesPerSec);
+    bool enabled() const { return msgRate > 0 || byteRate > 0; }
+
+    // false — лимит логина исчерпан, сообщение отбрасываем
+    bool allow(const string& login, size_t bytes);
+
+private:
+    struct Buckets {
+        TokenBucket msgs;
+        TokenBucket bytes;
+    };
+
+    mutex mtx;
+    double msgRate = 0, byteRate = 0;
+    unordered_map<string, Buckets> logins;
+};
@@ -0,0 +1,1554 @@
+﻿// Reactor.cpp
+#include "Reactor.h"
+#include <iostream>
+#include <cstring>      // ← для strlen
+#include <algorithm>
+
+using namespace std;
+
+// запас длины строки сверх max_message_length: команда, логин адресата, пробелы
+static const size_t LINE_OVERHEAD = 256;
+static const size_t MAX_ROOM_NAME = 32;
+
+// аккуратно обрезаем пробелы/CR/LF по краям
+static inline std::string trim_copy(std::string_view s) {
+    const auto b = s.find_first_not_of(" \t\r\n");
+    if (b == std::string_view::npos) return "";
+    const auto e = s.find_last_not_of(" \t\r\n");
+    return std::string(s.substr(b, e - b + 1));
+}
+
+// в кадрах строки без завершающего перевода строки
+static inline string_view chomp(string_view s) {
+    while (!s.empty() && s.back() == '\n') s.remove_suffix(1);
+    return s;
+}
+
+// блок списка пользователей одной строкой: [USERS]\n...\n[END]\n
+static string usersListBlock(Database& db) {
+    string block = "[USERS]\n";
+    for (const auto& u : db.getAllUsers()) {
+        block += u;
+        block += '\n';
+    }
+    block += "[END]\n";
+    return block;
+}
+
+// send в сокет или в кольцо общей памяти (там 0 — кольцо полно)
+static int writeSome(Connection& c, const char* data, size_t len) {
+    if (c.shm) return c.shm->write(data, len);
+    return send(c.sock, data, (int)len, 0);
+}
+
+// дописать очередь соединения: в сокет одним writev, в кольцо — кадр за кадром
+static bool flushOut(Connection& c) {
+    if (!c.shm) return c.out.flush(c.sock);
+    ShmLink& link = *c.shm;
+    return c.out.flush([&link](const char* p, size_t n) { return link.write(p, n); });
+}
+
+// трогает только само соединение — поэтому годится и для потоков раздачи;
+// hold — не писать сейчас, а оставить в очереди до сброса в конце оборота
+static WriteResult writeFrame(Connection& c, const FramePtr& frame, size_t maxBytes, bool hold) {
+    // очередь пуста — пробуем отправить сразу, в очередь попадёт только остаток
+    size_t offset = 0;
+    if (c.out.empty() && !hold) {
+        int rc = writeSome(c, frame->data(), frame->size());
+        if (rc < 0 && !lastErrorWouldBlock()) return WriteResult::Broken;
+        if (rc > 0) offset = (size_t)rc;
+        if (offset == frame->size()) return WriteResult::Sent;
+    }
+
+    c.out.push(frame, offset);
+    if (c.out.size() > maxBytes) return WriteResult::Overflow;
+    return hold ? WriteResult::Held : WriteResult::Queued;
+}
+
+Reactor::Reactor(ServerContext& ctx, size_t id, unique_ptr<EventLoop> loop, SOCKET listenSock)
+    : ctx(ctx), id(id), loop(move(loop)), listenSock(listenSock) {
+    if (!makeWakeupPair(wakeRead, wakeWrite)) {
+        wakeRead = wakeWrite = INVALID_SOCKET;
+        return;
+    }
+    this->loop->add(listenSock, IO_READ);
+    this->loop->add(wakeRead, IO_READ);
+    flusher.configure(ctx.flushDelay, ctx.flushBusyEvents);
+}
+
+Reactor::~Reactor() {
+    turn.destroyAll();
+    for (auto& kv : conns) kv.second.drained.destroyAll();
+    // спящих на колесе таймеров никто уже не разбудит — освобождаем кадры сами
+    for (void* frame : sleeping) coroutine_handle<>::from_address(frame).destroy();
+    sleeping.clear();
+    for (const auto& kv : conns) closeSocket(kv.first);
+    if (wakeRead != INVALID_SOCKET) closeSocket(wakeRead);
+    if (wakeWrite != INVALID_SOCKET && wakeWrite != wakeRead) closeSocket(wakeWrite);
+}
+
+void Reactor::run() {
+    vector<IoEvent> events;
+    while (!stopRequested) {
+        const int n = loop->wait(events, nextTimeoutMs());
+        if (n < 0) {
+            cerr << "Ошибка ожидания событий (реактор " << id << ")!" << endl;
+            break;
+        }
+        // одно событие — пишем сразу; пачка — копим исходящее до конца оборота
+        flusher.beginTurn((size_t)n);
+        for (const auto& ev : events) {
+            if (ev.sock == listenSock) acceptAll(listenSock, false);
+            else if (ev.sock == localListen) acceptAll(localListen, true);
+            else if (ev.sock == wakeRead) drainMailbox();
+            else {
+                if (ev.flags & IO_WRITE) onWritable(ev.sock);
+                if (ev.flags & IO_READ) onReadable(ev.sock);
+            }
+        }
+        timers.advance(chrono::steady_clock::now());
+        // сопрограммы (история и прочее) — между пачками событий:
+        // живые сообщения не ждут конца чужой догрузки
+        turn.resumeAll();
+        // всё, что накопилось за пачку у сжимающих клиентов, — одним сбросом на каждого
+        flushCompressed();
+        if (flusher.due(chrono::steady_clock::now())) flushHeld();
+        closePending();
+    }
+}
+
+void Reactor::listenLocal(SOCKET s) {
+    localListen = s;
+    loop->add(s, IO_READ);
+}
+
+void Reactor::post(Post p) {
+    bool wasEmpty;
+    {
+        lock_guard<mutex> lock(mailMutex);
+        wasEmpty = mailbox.empty();
+        mailbox.push_back(move(p));
+    }
+    // будим только при переходе «пусто -> не пусто»: остальное заберётся той же пачкой
+    if (wasEmpty) {
+        char b = 1;
+        send(wakeWrite, &b, 1, 0);
+    }
+}
+
+void Reactor::drainMailbox() {
+    // сначала вычитываем сигнал, потом забираем очередь — иначе можно потерять пробуждение
+    char buf[256];
+    while (recv(wakeRead, buf, sizeof(buf), 0) > 0) {}
+
+    {
+        lock_guard<mutex> lock(mailMutex);
+        mailWork.swap(mailbox);
+    }
+    // письма из других реакторов — та же нагрузка, что и события сокетов
+    flusher.note(mailWork.size() > 0 ? mailWork.size() - 1 : 0);
+    for (const auto& p : mailWork) {
+        if (p.task) {
+            p.task(*this);
+            continue;
+        }
+        if (p.target == INVALID_SOCKET) {
+            if (p.room.empty()) broadcastLocal(p.data, p.except);
+            else broadcastRoomLocal(p.room, p.data, p.except);
+            continue;
+        }
+        auto it = conns.find(p.target);
+        if (it == conns.end() || it->second.state != ConnState::READY ||
+            it->second.login != p.targetLogin) continue;
+        enqueue(it->second, p.data);
+    }
+    mailWork.clear();
+}
+
+// новые клиенты: слушающий сокет неблокирующий, забираем всех до EWOULDBLOCK
+void Reactor::acceptAll(SOCKET from, bool local) {
+    while (true) {
+        SOCKET client = accept(from, nullptr, nullptr);
+        if (client == INVALID_SOCKET) break;
+
+        setNonBlocking(client);
+        if (!loop->add(client, IO_READ)) {
+            cerr << "Превышен лимит соединений бэкенда " << loop->name() << endl;
+            closeSocket(client);
+            continue;
+        }
+
+        Connection& c = conns[client];
+        c.sock = client;
+        c.local = local;
+        c.serial = nextSerial++;
+        c.in.reset(ctx.maxMsgLen + LINE_OVERHEAD);
+        c.lastSeen = chrono::steady_clock::now();
+        c.msgRate.configure(ctx.rateMsgs, ctx.rateMsgsBurst);
+        c.byteRate.configure(ctx.rateBytes, ctx.rateBytesBurst);
+        armAuthTimer(c);
+    }
+}
+
+// закрываем тех, кто не прислал логин вовремя
+void Reactor::armAuthTimer(Connection& c) {
+    const SOCKET client = c.sock;
+    const uint64_t serial = c.serial;
+    c.authTimer = timers.schedule(ctx.authTimeout, [this, client, serial]() {
+        Connection* c = findConn(client, serial);
+        if (!c) return;
+        c->authTimer = 0;
+        // и не прислал, и не дождался проверки (база занята) — одинаково закрываем
+        if (c->state == ConnState::READY) return;
+        cout << "[Сервер] таймаут авторизации, сокет " << client << " закрыт\n";
+        rejectAuth(client);
+    });
+}
+
+void Reactor::stop() {
+    stopRequested = true;
+    char b = 1;
+    send(wakeWrite, &b, 1, 0);
+}
+
+void Reactor::exportSessions(HandoffState& st) {
+    // остальные реакторы уже стоят: дописываем то, что они успели прислать, и сжатый хвост
+    drainMailbox();
+    flushCompressed();
+
+    for (auto& kv : conns) {
+        Connection& c = kv.second;
+        if (c.closing) continue;
+        if (c.zout) {
+            // словарь zlib в другой процесс не перенести — такой клиент просто переподключится
+            cout << "[Сервер] " << (c.login.empty() ? "сокет " + to_string(c.sock) : c.login)
+                << " со сжатием не переносится, отключаем\n";
+            continue;
+        }
+        if (c.shm) {
+            // сегмент уже без имени — новому процессу его не открыть
+            cout << "[Сервер] " << (c.login.empty() ? "сокет " + to_string(c.sock) : c.login)
+                << " на общей памяти не переносится, отключаем\n";
+            continue;
+        }
+        HandoffSession s;
+        s.sock = c.sock;
+        s.shard = (uint32_t)id;
+        s.ready = c.state == ConnState::READY ? 1 : 0;
+        s.login = c.login;
+        s.userId = c.userId;
+        s.proto = (uint8_t)c.proto;
+        s.room = c.room;
+        s.rooms = c.rooms;
+        s.input = c.in.pending();
+        s.output = c.out.pending();
+        auto rp = replays.find(c.sock);
+        if (rp != replays.end()) {
+            for (const auto& h : rp->second) s.replays.push_back(HandoffReplay{ h.room, (uint8_t)h.offline, (uint32_t)h.cursor, (uint32_t)h.upTo });
+        }
+        st.sessions.push_back(move(s));
+    }
+}
+
+void Reactor::adopt(HandoffSession& s) {
+    setNonBlocking(s.sock);
+    if (!loop->add(s.sock, IO_READ)) {
+        cerr << "Превышен лимит соединений бэкенда " << loop->name() << endl;
+        closeSocket(s.sock);
+        return;
+    }
+
+    Connection& c = conns[s.sock];
+    c.sock = s.sock;
+    c.serial = nextSerial++;
+    c.in.reset(ctx.maxMsgLen + LINE_OVERHEAD);
+    c.lastSeen = chrono::steady_clock::now();
+    c.msgRate.configure(ctx.rateMsgs, ctx.rateMsgsBurst);
+    c.byteRate.configure(ctx.rateBytes, ctx.rateBytesBurst);
+    c.proto = s.proto == 2 ? 2 : 1;
+    if (c.proto == 2) ctx.v2Clients++;
+
+    // недоразобранный ввод — обратно в кольцо, как будто только что пришёл из recv
+    size_t off = 0;
+    while (off < s.input.size()) {
+        auto [buf, room] = c.in.writable();
+        if (room == 0) break;
+        const size_t n = min(room, s.input.size() - off);
+        memcpy(buf, s.input.data() + off, n);
+        c.in.commit(n);
+        off += n;
+    }
+
+    if (!s.ready) armAuthTimer(c);
+    else {
+        c.state = ConnState::READY;
+        c.login = s.login;
+        c.userId = s.userId;
+        {
+            lock_guard<mutex> lock(ctx.dirMutex);
+            ctx.loginToSock[c.login] = Route{ id, c.sock, c.userId };
+            ctx.idToLogin[c.userId] = c.login;
+        }
+        // все уже видят его в сети: без оповещений и без повторной истории
+        ctx.presence.restore(c.login, c.userId);
+        ctx.federation.localPresence(c.login, +1);
+        for (const auto& room : s.rooms) {
+            c.rooms.push_back(room);
+            roomMembers[room].insert(c.sock);
+            lock_guard<mutex> lock(ctx.roomsMutex);
+            auto& shards = ctx.roomShards[room];
+            shards.resize(ctx.reactors.size());
+            shards[id]++;
+        }
+        c.room = s.room;
+        for (const auto& h : s.replays) {
+            HistoryReplay r;
+            r.room = h.room;
+            r.offline = h.offline != 0;
+            r.cursor = (int)h.cursor;
+            r.upTo = (int)h.upTo;
+            if (c.proto == 2) r.ids[c.login] = c.userId;
+            replays[c.sock].push_back(move(r));
+        }
+        if (!s.replays.empty()) startReplay(c);
+        watchIdle(c.sock, c.serial);
+    }
+
+    if (!s.output.empty()) sendRaw(c, makeFrame(move(s.output)));
+
+    // уже целые строки в кольце событий от сокета не дадут — разберём на первом шаге цикла
+    if (c.in.buffered() > 0) {
+        const SOCKET sock = c.sock;
+        const uint64_t serial = c.serial;
+        defer(chrono::milliseconds(0), [this, sock, serial]() {
+            if (findConn(sock, serial)) onReadable(sock);
+        });
+    }
+}
+
+Connection* Reactor::findConn(SOCKET sock, uint64_t serial) {
+    auto it = conns.find(sock);
+    return it != conns.end() && it->second.serial == serial ? &it->second : nullptr;
+}
+
+// не переставляем ожидание на каждый recv: просыпаемся, смотрим на lastSeen
+// и засыпаем снова на оставшееся время
+Task Reactor::watchIdle(SOCKET sock, uint64_t serial) {
+    const bool hb = ctx.heartbeat.count() > 0;
+    const bool idle = ctx.idleTimeout.count() > 0;
+    if (!hb && !idle) co_return;
+
+    chrono::milliseconds delay = hb ? ctx.heartbeat : ctx.idleTimeout;
+    while (true) {
+        co_await sleepFor(delay);
+        Connection* c = findConn(sock, serial);
+        if (!c || c->closing) co_return;
+
+        const auto silent = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - c->lastSeen);
+        if (idle && silent >= ctx.idleTimeout) {
+            cout << "[Сервер] " << c->login << " не отвечает, отключаем\n";
+            closeLater(*c);
+            co_return;
+        }
+        if (hb && !c->pinged && silent >= ctx.heartbeat) sendPing(*c);
+
+        // следующая проверка — к пингу, если он ещё впереди, и не позже таймаута простоя
+        chrono::milliseconds next = idle ? ctx.idleTimeout - silent : ctx.heartbeat;
+        if (hb && !c->pinged) next = min(next, ctx.heartbeat - silent);
+        delay = max(next, chrono::milliseconds(1));
+    }
+}
+
+void Reactor::sendPing(Connection& c) {
+    c.pinged = true;
+    if (c.proto == 2) enqueue(c, FrameWriter(MsgType::Ping).finish());
+    else enqueue(c, "[PING]\n");
+}
+
+// вычитываем сокет до EWOULDBLOCK (epoll работает по фронту);
+// recv пишет прямо в кольцо разборщика, строки разбираем по мере поступления
+void Reactor::onReadable(SOCKET sock) {
+    auto it = conns.find(sock);
+    if (it == conns.end()) return; // уже закрыт раньше в этой же пачке событий
+    Connection& c = it->second;
+
+    if (c.shm) {
+        // сокет кольца — только звонок: клиент что-то записал или освободил место для нас
+        c.shm->drainBell();
+        if (c.shm->closed() && (c.readPaused || c.throttled)) {
+            // дочитывать некому и незачем, а закрытый сокет будил бы цикл снова и снова
+            disconnect(sock);
+            return;
+        }
+        if (!c.out.empty() && !c.closing) {
+            if (!flushOut(c)) { closeLater(c); return; }
+            if (c.out.size() <= ctx.outLowWater) c.drained.wake(turn);
+            updateInterest(c);
+        }
+    }
+
+    bool closed = false;
+    string_view line;
+    // пока клиент на паузе, ни читаем, ни разбираем: каждая строка может породить ещё вывод;
+    // пока проверяется пароль — тоже: что прислано следом, разберём уже в чате (finishAuth)
+    while (!c.readPaused && !c.throttled && !c.closing && c.state != ConnState::AUTHENTICATING) {
+        // лимит сообщений: следующую строку не разбираем, пока нет токена
+        // (после обрыва дочитываем остаток без пауз — держать уже некого)
+        const auto now = chrono::steady_clock::now();
+        if (!closed && c.in.buffered() > 0 && !c.msgRate.ready(1, now)) {
+            throttle(c, c.msgRate.waitFor(1, now));
+            break;
+        }
+
+        if (c.proto == 2) {
+            if (c.in.nextFrame(line)) {
+                c.msgRate.take(1, now);
+                if (!handleFrame(c, line)) return; // соединение уже закрыто
+                continue;
+            }
+            if (c.in.broken()) {
+                // длину кадра не понять — дальше поток не разобрать, закрываем
+                sendError(c, ERR_BAD_FRAME, "[Сервер] Некорректная длина кадра\n");
+                closeLater(c);
+                break;
+            }
+        }
+        else if (c.in.next(line)) {
+            c.msgRate.take(1, now);
+            if (c.state == ConnState::AWAIT_AUTH) {
+                // обрезанная строка авторизации — явно не логин, а мусор
+                if (c.in.truncated()) { rejectAuth(sock); return; }
+                if (line == COMPRESS_HELLO && !c.zout) {
+                    enableCompression(c);
+                    continue;
+                }
+                if (line.rfind(SHM_HELLO " ", 0) == 0 && !c.shm) {
+                    enableShm(c, string(line.substr(sizeof(SHM_HELLO))));
+                    continue;
+                }
+                if (line == PROTO2_HELLO) {
+                    // клиент умеет кадры: подтверждаем и дальше читаем уже их
+                    c.proto = 2;
+                    ctx.v2Clients++;
+                    enqueue(c, PROTO2_ACK "\n");
+                    continue;
+                }
+                if (!authenticateLine(c, string(line))) return; // соединение уже закрыто
+                continue;
+            }
+            handleLine(c, line);
+            continue;
+        }
+        if (closed) break;
+
+        // лимит байтов: долг прошлого recv ещё не отработан — сокет пока не читаем
+        if (!c.byteRate.ready(1, now)) {
+            throttle(c, c.byteRate.waitFor(1, now));
+            break;
+        }
+
+        auto [buf, room] = c.in.writable();
+        if (room == 0) break;
+        // кольцо: -1 — пусто (звонок заказан), -2 — сегмент испорчен
+        int n = c.shm ? c.shm->read(buf, room) : recv(sock, buf, (int)room, 0);
+        if (n > 0) {
+            c.in.commit((size_t)n);
+            c.byteRate.take(n, now);
+            // любой входящий байт — признак жизни; таймер простоя сам это увидит
+            c.lastSeen = chrono::steady_clock::now();
+            c.pinged = false;
+            continue;
+        }
+        if (c.shm ? n == -1 : (n < 0 && lastErrorWouldBlock())) break;
+        closed = true;
+    }
+
+    if (closed) disconnect(sock);
+}
+
+// первая строка протокола 1: "login:password"
+bool Reactor::authenticateLine(Connection& c, const string& firstMsg) {
+    if (firstMsg.empty()) {
+        rejectAuth(c.sock);
+        return false;
+    }
+
+    string login, pass;
+    size_t pos = firstMsg.find(':');
+    if (pos != string::npos) {
+        login = firstMsg.substr(0, pos);
+        pass = firstMsg.substr(pos + 1);
+    }
+    else {
+        login = firstMsg;
+        pass = "nopass";
+    }
+    return authenticate(c, login, pass);
+}
+
+// false — отказ сразу, соединение закрыто; true — проверка ушла в поток-писатель
+bool Reactor::authenticate(Connection& c, const string& login, const string& pass) {
+    // управляющие символы зарезервированы за служебными строками (OFFLINE_MARK)
+    if (login.empty() || login.size() > MAX_LOGIN || hasControlChars(login)) {
+        rejectAuth(c.sock);
+        return false;
+    }
+    c.state = ConnState::AUTHENTICATING;
+
+    // хэш пароля и запросы к БД — не в потоке реактора: остальные его клиенты
+    // не должны ждать чужого входа; ответ вернётся письмом в ящик
+    const SOCKET sock = c.sock;
+    const uint64_t serial = c.serial;
+    ctx.writer.submitTask([this, sock, serial, login, pass]() {
+        const bool ok = ctx.db.checkUser(login, pass) || ctx.db.addUser(login, pass, login);
+        const uint32_t userId = ok ? (uint32_t)ctx.db.getUserId(login) : 0;
+        post(Post::call([sock, serial, login, ok, userId](Reactor& r) {
+            r.finishAuth(sock, serial, login, ok, userId);
+        }));
+    });
+    return true;
+}
+
+void Reactor::finishAuth(SOCKET sock, uint64_t serial, const string& login, bool ok, uint32_t userId) {
+    Connection* c = findConn(sock, serial);
+    // пока проверяли, соединение закрылось (или истёк таймаут входа)
+    if (!c || c->closing || c->state != ConnState::AUTHENTICATING) return;
+    if (!ok) {
+        rejectAuth(sock);
+        return;
+    }
+
+    c->login = login;
+    c->userId = userId;
+
+    if (c->proto == 2) enqueue(*c, FrameWriter(MsgType::AuthResult).u8(1).u32(c->userId).finish());
+    else enqueue(*c, "OK\n");
+
+    c->state = ConnState::READY;
+    timers.cancel(c->authTimer);
+    c->authTimer = 0;
+    watchIdle(c->sock, c->serial);
+    welcome(*c);
+    // что клиент успел прислать вслед за логином — разбираем и дочитываем сокет
+    onReadable(sock);
+}
+
+void Reactor::rejectAuth(SOCKET sock) {
+    // сокет сразу закрываем, поэтому пишем напрямую: пара байт в пустой буфер ядра влезет
+    auto it = conns.find(sock);
+    string err = it != conns.end() && it->second.proto == 2
+        ? FrameWriter(MsgType::AuthResult).u8(0).u32(0).bytes()
+        : string("FAIL\n");
+    if (it != conns.end() && it->second.zout) {
+        // клиент ждёт сжатый поток — отказ тоже сжимаем
+        Connection& c = it->second;
+        c.zpending += err;
+        err.clear();
+        c.zout->write(c.zpending.data(), c.zpending.size(), err, true);
+    }
+    send(sock, err.c_str(), (int)err.size(), 0);
+    drop(sock);
+}
+
+// история, список пользователей и оповещение остальных
+void Reactor::welcome(Connection& c) {
+    SOCKET client = c.sock;
+    const string& me = c.login;
+
+    // добавляем в мапу логинов для ЛС
+    {
+        lock_guard<mutex> lock(ctx.dirMutex);
+        ctx.loginToSock[me] = Route{ id, client, c.userId };
+        ctx.idToLogin[c.userId] = me;
+    }
+
+    // сообщение о подключении
+    cout << "[Сервер] " + me + " подключился\n";
+
+    // клиенту протокола 2 список нужен раньше истории: в ней только id
+    if (c.proto == 2) sendUsers(c);
+    // историю (только публичное и мои приватные) догружаем порциями в replayHistory;
+    // список пользователей для протокола 1 уйдёт после неё, как и раньше
+    vector<HistoryReplay> parts(2);
+    if (c.proto == 2) parts[0].ids[me] = c.userId;
+    // за историей — личные, пришедшие, пока был не в сети
+    parts[1].offline = true;
+    queueReplay(c, move(parts));
+
+    // остальные узнают в ближайшем пакете присутствия (другие узлы — от федерации);
+    // ему самому — один готовый снимок «кто в сети», дальше только изменения.
+    // Логин ещё никому не виден — снимок придёт свежим в конце окна, вместо пакета
+    bool visible = false;
+    presenceChanged(ctx.presence.join(me, c.userId, &visible));
+    if (visible) enqueue(c, ctx.presence.snapshot(c.proto));
+    ctx.federation.localPresence(me, +1);
+}
+
+void Reactor::remotePresence(const string& login, int delta) {
+    const uint32_t userId = delta > 0 ? (uint32_t)ctx.db.getUserId(login) : 0;
+    for (; delta > 0; delta--) presenceChanged(ctx.presence.join(login, userId));
+    for (; delta < 0; delta++) presenceChanged(ctx.presence.leave(login));
+}
+
+void Reactor::presenceChanged(bool openedWindow) {
+    if (!openedWindow) return;
+    // один общий кадр на все изменения окна: при массовом переподключении
+    // каждый клиент получает пакет раз в окно, а не строку на каждого вошедшего
+    defer(ctx.presence.windowLength(), [this]() {
+        ctx.presence.flush(wantBinary(), [this](const PresenceUpdate& u) {
+            if (u.joined.empty()) {
+                broadcast(u.delta, INVALID_SOCKET);
+                return;
+            }
+            // вошедшие могут сидеть в любом реакторе — каждый сам разберёт своих
+            auto shared = make_shared<const PresenceUpdate>(u);
+            for (auto& r : ctx.reactors) {
+                r->post(Post::call([shared](Reactor& r) { r.presenceLocal(*shared); }));
+            }
+        });
+    });
+}
+
+void Reactor::presenceLocal(const PresenceUpdate& u) {
+    vector<Connection*> rest;
+    rest.reserve(conns.size());
+    for (auto& kv : conns) {
+        Connection& c = kv.second;
+        if (c.state != ConnState::READY) continue;
+        if (!u.joined.count(c.login)) {
+            rest.push_back(&c);
+            continue;
+        }
+        const FramePtr& snap = c.proto == 2 ? u.snapBin : u.snapText;
+        if (snap) enqueue(c, snap);
+    }
+    if (useFanout(rest.size())) {
+        fanOutParallel(rest, u.delta);
+        return;
+    }
+    for (Connection* c : rest) enqueue(*c, u.delta);
+}
+
+void Reactor::queueReplay(Connection& c, vector<HistoryReplay> parts) {
+    const SOCKET sock = c.sock;
+    const uint64_t serial = c.serial;
+    // границы берёт поток-писатель: upTo — последнее записанное из поставленного до нас,
+    // курсор отложенных — там же. Подтверждённые (durable) рассылаются только после
+    // записи, так что в этом режиме очередь писателя не ждём
+    ctx.writer.afterCommit([this, sock, serial, login = c.login, parts](int lastId) mutable {
+        for (auto& h : parts) {
+            if (h.offline) h.cursor = ctx.db.offlineCursor(login);
+            else h.upTo = lastId;
+        }
+        post(Post::call([sock, serial, parts](Reactor& r) {
+            Connection* c = r.findConn(sock, serial);
+            if (!c || c->closing) return;
+            auto& q = r.replays[sock];
+            q.insert(q.end(), parts.begin(), parts.end());
+            r.startReplay(*c);
+        }));
+    }, !ctx.durableAck);
+}
+
+void Reactor::startReplay(Connection& c) {
+    if (c.replaying) return;
+    c.replaying = true;
+    replayHistory(c.sock, c.serial);
+}
+
+// одна сопрограмма на соединение проходит все его догрузки по очереди
+// (общий чат при входе, затем комнаты по /join)
+Task Reactor::replayHistory(SOCKET sock, uint64_t serial) {
+    // первая порция — уже после текущей пачки событий
+    co_await nextTurn();
+    while (true) {
+        Connection* c = findConn(sock, serial);
+        if (!c || c->closing) co_return;
+        auto it = replays.find(sock);
+        if (it == replays.end() || it->second.empty()) {
+            if (it != replays.end()) replays.erase(it);
+            c->replaying = false;
+            co_return;
+        }
+
+        // клиент не успевает читать — спим, пока очередь не опустится до нижней отметки
+        if (c->out.size() > ctx.outLowWater) {
+            if (!co_await drained(*c)) co_return;
+            continue;
+        }
+
+        HistoryReplay& h = it->second.front();
+        if (h.offline) {
+            // порция очереди и метка с её последним id; курсор в БД двигает /ack клиента,
+            // так что неподтверждённое придёт снова при следующем входе
+            auto chunk = ctx.db.getOfflineChunk(c->login, h.cursor, ctx.historyChunk);
+            string buf;
+            for (const auto& m : chunk) {
+                if (c->proto == 2) {
+                    auto f = h.ids.find(m.sender);
+                    if (f == h.ids.end()) f = h.ids.emplace(m.sender, (uint32_t)ctx.db.getUserId(m.sender)).first;
+                    buf += FrameWriter(MsgType::PrivateMsg).u32(f->second).u32(c->userId).str(m.text).bytes();
+                    continue;
+                }
+                buf += "[" + m.sender + " -> " + m.recipient + "] " + m.text + "\n";
+            }
+            if (!chunk.empty()) {
+                h.cursor = chunk.back().id;
+                buf += c->proto == 2 ? FrameWriter(MsgType::OfflineEnd).u32((uint32_t)h.cursor).bytes()
+                    : OFFLINE_MARK + to_string(h.cursor) + "\n";
+                enqueue(*c, move(buf));
+            }
+            if (chunk.size() < ctx.historyChunk) it->second.pop_front();
+            co_await nextTurn();
+            continue;
+        }
+        auto chunk = ctx.db.getHistoryChunk(c->login, h.room, h.cursor, h.upTo, ctx.historyChunk);
+
+        // вся порция — одним кадром: один send и один элемент очереди вместо сотен
+        string buf;
+        for (const auto& m : chunk) {
+            if (c->proto == 2) {
+                auto idOf = [&](const string& login) {
+                    auto f = h.ids.find(login);
+                    if (f != h.ids.end()) return f->second;
+                    return h.ids[login] = (uint32_t)ctx.db.getUserId(login);
+                };
+                if (!m.room.empty()) {
+                    buf += FrameWriter(MsgType::RoomMsg).u32(idOf(m.sender)).str(m.room).str(m.text).bytes();
+                    continue;
+                }
+                FrameWriter w(m.recipient.empty() ? MsgType::PublicMsg : MsgType::PrivateMsg);
+                w.u32(idOf(m.sender));
+                if (!m.recipient.empty()) w.u32(idOf(m.recipient));
+                buf += w.str(m.text).bytes();
+                continue;
+            }
+            buf += "[" + m.sender +
+                (!m.room.empty() ? " -> #" + m.room : m.recipient.empty() ? " -> ALL" : " -> " + m.recipient) +
+                "] " + m.text + "\n";
+        }
+        if (!buf.empty()) enqueue(*c, move(buf));
+        if (!chunk.empty()) h.cursor = chunk.back().id;
+
+        if (chunk.size() < ctx.historyChunk) {
+            // история закончилась; после общей, как и раньше, — список пользователей
+            if (h.room.empty() && c->proto != 2) sendUsers(*c);
+            it->second.pop_front();
+        }
+        co_await nextTurn();
+    }
+}
+
+const CommandTable<Reactor::CommandHandler>& Reactor::commands() {
+    static const CommandTable<CommandHandler> table = [] {
+        CommandTable<CommandHandler> t;
+        t.add("help", &Reactor::cmdHelp);
+        t.add("users", &Reactor::cmdUsers, "/users", "список пользователей");
+        t.add("w", &Reactor::cmdWhisper, "/w <login> <текст>", "личное сообщение");
+        t.add("join", &Reactor::cmdJoin, "/join <комната>", "войти в комнату (сообщения пойдут туда)");
+        t.add("leave", &Reactor::cmdLeave, "/leave [комната]", "выйти из комнаты (по умолчанию из текущей)");
+        // ответ на [PING]: сам факт прихода уже обновил lastSeen
+        t.add("pong", &Reactor::cmdPong);
+        // клиент получил отложенные личные до id включительно (OFFLINE_MARK id)
+        t.add("ack", &Reactor::cmdAck);
+        return t;
+    }();
+    return table;
+}
+
+void Reactor::handleLine(Connection& c, string_view line) {
+    if (!plainText(c, line)) return;
+    // обычные сообщения в таблицу команд не заходят: хватает первого байта
+    CommandArgs args;
+    if (args.parse(line)) {
+        if (const auto* cmd = commands().find(args.name())) {
+            (this->*cmd->handler)(c, args);
+            return;
+        }
+        // неизвестная "/команда" уходит в чат как текст — как и раньше
+    }
+
+    string text = trim_copy(line);
+    if (text.empty()) return;
+
+    // обычное сообщение — в текущую комнату или во весь чат
+    publish(c, move(text));
+}
+
+// /help — краткая справка, собирается из таблицы один раз
+void Reactor::cmdHelp(Connection& c, const CommandArgs&) {
+    static const string help = [] {
+        // колонка описаний выровнена по символам, а не байтам (в usage есть кириллица)
+        auto column = [](const string& usage) {
+            size_t chars = 0;
+            for (unsigned char ch : usage) {
+                if ((ch & 0xC0) != 0x80) chars++;
+            }
+            return usage + string(chars < 20 ? 20 - chars : 1, ' ');
+        };
+        string text = "[Сервер] Команды:\n";
+        for (const auto& cmd : commands().all()) {
+            if (cmd.usage.empty()) continue;
+            text += "  " + column(cmd.usage) + "— " + cmd.help + "\n";
+        }
+        text += "  " + column("exit") + "— выход (на клиенте)\n";
+        return text;
+    }();
+    sendInfo(c, help);
+}
+
+void Reactor::cmdPong(Connection&, const CommandArgs&) {}
+
+void Reactor::cmdUsers(Connection& c, const CommandArgs&) {
+    sendUsers(c);
+}
+
+// /w <login> <текст> — личное сообщение
+void Reactor::cmdWhisper(Connection& c, const CommandArgs& args) {
+    if (args.count() < 2) {
+        sendError(c, ERR_USAGE, "[Сервер] Использование: /w <login> <текст>\n");
+        return;
+    }
+    sendPrivate(c, string(args.arg(0)), string(args.from(1)));
+}
+
+void Reactor::cmdAck(Connection& c, const CommandArgs& args) {
+    // только голое число: "/ack 12]" или "/ack 12 x" — не подтверждение, а мусор
+    const string_view arg = args.arg(0);
+    if (args.count() != 1 || arg.empty() || arg.size() > 9 || arg.find_first_not_of("0123456789") != string_view::npos) {
+        sendError(c, ERR_USAGE, "[Сервер] Использование: /ack <id>\n");
+        return;
+    }
+    const int upTo = stoi(string(arg));
+    if (upTo <= 0) return;
+    // транзакция с fsync — в потоке-писателе, реактор не ждёт
+    ctx.writer.submitTask([this, login = c.login, upTo]() { ctx.db.ackOffline(login, upTo); });
+}
+
+// /join <комната>
+void Reactor::cmdJoin(Connection& c, const CommandArgs& args) {
+    const string_view room = args.rest();
+    if (room.empty() || room.size() > MAX_ROOM_NAME || args.count() != 1) {
+        sendError(c, ERR_USAGE, "[Сервер] Использование: /join <комната> (без пробелов, до 32 байт)\n");
+        return;
+    }
+    joinRoom(c, string(room));
+}
+
+// /leave [комната]
+void Reactor::cmdLeave(Connection& c, const CommandArgs& args) {
+    leaveRoom(c, args.count() == 0 ? c.room : string(args.rest()));
+}
+
+// кадр протокола 2; разбор идёт прямо по view в кольце приёма
+bool Reactor::handleFrame(Connection& c, string_view frame) {
+    FrameReader r(frame);
+
+    if (c.state == ConnState::AWAIT_AUTH) {
+        string_view login, pass;
+        if (r.type() != MsgType::Auth || !r.str(login) || !r.str(pass)) {
+            rejectAuth(c.sock);
+            return false;
+        }
+        return authenticate(c, string(login), string(pass));
+    }
+
+    string_view text;
+    switch (r.type()) {
+    case MsgType::PublicMsg:
+        if (!r.str(text)) break;
+        if (plainText(c, text)) publish(c, trim_copy(text));
+        return true;
+
+    case MsgType::PrivateMsg: {
+        uint32_t toId = 0;
+        if (!r.u32(toId) || !r.str(text)) break;
+        if (!plainText(c, text)) return true;
+        string toLogin;
+        {
+            lock_guard<mutex> lock(ctx.dirMutex);
+            auto it = ctx.idToLogin.find(toId);
+            if (it != ctx.idToLogin.end()) toLogin = it->second;
+        }
+        string body = trim_copy(text);
+        if (body.empty()) {
+            sendError(c, ERR_USAGE, "[Сервер] Пустое личное сообщение\n");
+            return true;
+        }
+        // в idToLogin только те, кто в сети; остальным — в очередь по логину из БД
+        if (toLogin.empty()) toLogin = ctx.db.getUserLogin((int)toId);
+        if (toLogin.empty()) {
+            sendError(c, ERR_OFFLINE, "[Сервер] Пользователь #" + to_string(toId) + " не в сети\n");
+            return true;
+        }
+        sendPrivate(c, toLogin, body);
+        return true;
+    }
+
+    case MsgType::RoomMsg: {
+        string_view room;
+        if (!r.str(room) || !r.str(text)) break;
+        if (plainText(c, room) && plainText(c, text)) publishRoom(c, string(room), trim_copy(text));
+        return true;
+    }
+
+    case MsgType::Pong:
+        return true;
+
+    case MsgType::Command:
+        if (!r.str(text)) break;
+        handleLine(c, text);
+        return true;
+
+    default:
+        break;
+    }
+    sendError(c, ERR_BAD_FRAME, "[Сервер] Непонятный кадр\n");
+    return true;
+}
+
+void Reactor::publish(Connection& c, string text) {
+    if (!c.room.empty()) {
+        publishRoom(c, c.room, move(text));
+        return;
+    }
+    if (text.empty()) return;
+    if (text.size() > ctx.maxMsgLen)
+        text.resize(ctx.maxMsgLen);
+    if (!admit(c, text.size())) return;
+
+    string out = "[" + c.login + "] " + text + "\n";
+    cout << out;
+
+    Outgoing msg{ makeFrame(move(out)), nullptr };
+    if (wantBinary()) msg.bin = FrameWriter(MsgType::PublicMsg).u32(c.userId).str(text).finish();
+
+    if (ctx.federation.enabled()) ctx.federation.relayPublic(c.login, "", text);
+
+    Message m{ 0, c.login, "", move(text), "" };
+    if (ctx.durableAck) {
+        ctx.writer.submit(move(m), [this, msg, sock = c.sock, serial = c.serial](bool stored) {
+            if (stored) postFanOut(msg, sock, "");
+            else postNotStored(sock, serial);
+        });
+        return;
+    }
+    ctx.writer.submit(move(m));
+    broadcast(msg, c.sock);
+}
+
+void Reactor::publishRoom(Connection& c, const string& room, string text) {
+    if (text.empty()) return;
+    if (find(c.rooms.begin(), c.rooms.end(), room) == c.rooms.end()) {
+        sendError(c, ERR_USAGE, "[Сервер] Вы не в комнате #" + room + "\n");
+        return;
+    }
+    if (text.size() > ctx.maxMsgLen)
+        text.resize(ctx.maxMsgLen);
+    if (!admit(c, text.size())) return;
+
+    string out = "[" + c.login + " -> #" + room + "] " + text + "\n";
+    cout << out;
+
+    Outgoing msg{ makeFrame(move(out)), nullptr };
+    if (wantBinary()) msg.bin = FrameWriter(MsgType::RoomMsg).u32(c.userId).str(room).str(text).finish();
+
+    if (ctx.federation.enabled()) ctx.federation.relayPublic(c.login, room, text);
+
+    Message m{ 0, c.login, "", move(text), room };
+    if (ctx.durableAck) {
+        ctx.writer.submit(move(m), [this, msg, room, sock = c.sock, serial = c.serial](bool stored) {
+            if (stored) postFanOut(msg, sock, room);
+            else postNotStored(sock, serial);
+        });
+        return;
+    }
+    ctx.writer.submit(move(m));
+    broadcastRoom(room, msg, c.sock);
+}
+
+void Reactor::joinRoom(Connection& c, const string& room) {
+    if (find(c.rooms.begin(), c.rooms.end(), room) != c.rooms.end()) {
+        c.room = room; // уже подписан — просто делаем текущей
+        sendInfo(c, "[Сервер] Текущая комната: #" + room + "\n");
+        return;
+    }
+
+    c.rooms.push_back(room);
+    c.room = room;
+    roomMembers[room].insert(c.sock);
+    {
+        lock_guard<mutex> lock(ctx.roomsMutex);
+        auto& shards = ctx.roomShards[room];
+        shards.resize(ctx.reactors.size());
+        shards[id]++;
+    }
+    sendInfo(c, "[Сервер] Вы вошли в комнату #" + room + "\n");
+
+    // история комнаты — тем же порционным курсором, что и общая при входе
+    vector<HistoryReplay> parts(1);
+    parts[0].room = room;
+    if (c.proto == 2) parts[0].ids[c.login] = c.userId;
+    queueReplay(c, move(parts));
+}
+
+void Reactor::leaveRoom(Connection& c, string room) {
+    auto it = find(c.rooms.begin(), c.rooms.end(), room);
+    if (room.empty() || it == c.rooms.end()) {
+        sendError(c, ERR_USAGE, "[Сервер] Вы не в комнате" + (room.empty() ? string() : " #" + room) + "\n");
+        return;
+    }
+    c.rooms.erase(it);
+    if (c.room == room) c.room.clear();
+
+    auto rm = roomMembers.find(room);
+    if (rm != roomMembers.end()) {
+        rm->second.erase(c.sock);
+        if (rm->second.empty()) roomMembers.erase(rm);
+    }
+    {
+        lock_guard<mutex> lock(ctx.roomsMutex);
+        auto rs = ctx.roomShards.find(room);
+        if (rs != ctx.roomShards.end()) {
+            if (rs->second[id] > 0) rs->second[id]--;
+            bool empty = true;
+            for (uint32_t n : rs->second) empty = empty && n == 0;
+            if (empty) ctx.roomShards.erase(rs);
+        }
+    }
+    if (!c.closing) sendInfo(c, "[Сервер] Вы вышли из комнаты #" + room + "\n");
+}
+
+// перевод строки из кадра протокола 2 разорвал бы строку у клиентов протокола 1,
+// а управляющий байт в начале выдал бы её за служебную
+bool Reactor::plainText(Connection& c, string_view text) {
+    if (!hasControlChars(text)) return true;
+    sendError(c, ERR_USAGE, "[Сервер] Управляющие символы в сообщениях не допускаются\n");
+    return false;
+}
+
+void Reactor::sendInfo(Connection& c, const string& text) {
+    if (c.proto == 2) enqueue(c, FrameWriter(MsgType::Info).str(chomp(text)).finish());
+    else enqueue(c, text);
+}
+
+void Reactor::sendError(Connection& c, ErrorCode code, const string& text) {
+    if (c.proto == 2) enqueue(c, FrameWriter(MsgType::Error).u16(code).str(chomp(text)).finish());
+    else enqueue(c, text);
+}
+
+// список из кеша: один общий кадр на всех, запрос в БД — только после addUser
+void Reactor::sendUsers(Connection& c) {
+    // версию берём до запроса: если кто-то добавится посреди сборки, пересоберём ещё раз
+    const uint64_t ver = ctx.db.usersVersion();
+    FramePtr block;
+    {
+        lock_guard<mutex> lock(ctx.usersMutex);
+        if (c.proto != 2) {
+            if (!ctx.usersText || ctx.usersTextVer != ver) {
+                ctx.usersText = makeFrame(usersListBlock(ctx.db));
+                ctx.usersTextVer = ver;
+            }
+            block = ctx.usersText;
+        }
+        else {
+            if (!ctx.usersBin || ctx.usersBinVer != ver) {
+                vector<pair<uint32_t, string>> users;
+                for (auto& u : ctx.db.getUsersWithIds()) users.emplace_back((uint32_t)u.first, move(u.second));
+                // большой каталог не влезает в один кадр — режем на куски под MAX_FRAME
+                ctx.usersBin = makeFrame(listFrames(MsgType::UserList, users));
+                ctx.usersBinVer = ver;
+            }
+            block = ctx.usersBin;
+        }
+    }
+    enqueue(c, block);
+}
+
+void Reactor::sendPrivate(Connection& c, const string& toLogin, const string& body) {
+    Route to{ 0, INVALID_SOCKET, 0 };
+    {
+        lock_guard<mutex> lock(ctx.dirMutex);
+        auto it = ctx.loginToSock.find(toLogin);
+        if (it != ctx.loginToSock.end()) to = it->second;
+    }
+    if (to.sock == INVALID_SOCKET) {
+        // не у нас — может, на другом узле или его дом там
+        const string hop = ctx.federation.enabled() ? ctx.federation.nextHop(toLogin) : "";
+        if (hop.empty()) sendOffline(c, toLogin, body);
+        else sendRemote(c, hop, toLogin, body);
+        return;
+    }
+
+    // ограничение длины
+    string text = body;
+    if (text.size() > ctx.maxMsgLen) text.resize(ctx.maxMsgLen);
+    if (!admit(c, text.size())) return;
+
+    const string& from = c.login;
+    Outgoing out{ makeFrame("[" + from + " -> " + toLogin + "] " + text + "\n"), nullptr };
+    if (wantBinary()) out.bin = FrameWriter(MsgType::PrivateMsg).u32(c.userId).u32(to.userId).str(text).finish();
+
+    Message m{ 0, from, toLogin, text, "" };
+    if (ctx.durableAck) {
+        // обоим — только после записи на диск, через ящики реакторов
+        ctx.writer.submit(move(m), [this, to, toLogin, out, sock = c.sock, serial = c.serial, from](bool stored) {
+            if (!stored) {
+                postNotStored(sock, serial);
+                return;
+            }
+            ctx.reactors[to.shard]->post(Post::direct(to.sock, toLogin, out));
+            ctx.reactors[id]->post(Post::direct(sock, from, out));
+        });
+        return;
+    }
+
+    // отправляем адресату и отправителю (подтверждение)
+    if (to.shard == id) {
+        auto it = conns.find(to.sock);
+        if (it != conns.end()) enqueue(it->second, out);
+    }
+    else {
+        ctx.reactors[to.shard]->post(Post::direct(to.sock, toLogin, out));
+    }
+    enqueue(c, out);
+
+    // сохраняем в БД как приватное (поток-писатель, без ожидания диска)
+    ctx.writer.submit(move(m));
+}
+
+void Reactor::sendOffline(Connection& c, const string& toLogin, const string& body) {
+    string text = body;
+    if (text.size() > ctx.maxMsgLen) text.resize(ctx.maxMsgLen);
+    if (!admit(c, text.size())) return;
+
+    // есть ли такой и запись в его очередь — в потоке-писателе, не в реакторе;
+    // подтверждение отправителю вернётся письмом и значит, что сообщение уже в очереди адресата
+    const SOCKET sock = c.sock;
+    const uint64_t serial = c.serial;
+    ctx.writer.submitTask([this, sock, serial, from = c.login, toLogin, text]() {
+        const int toId = ctx.db.getUserId(toLogin);
+        const bool queued = toId != 0 && ctx.db.addOfflineMessage(from, toLogin, text);
+        const uint32_t id = queued ? (uint32_t)toId : 0;
+        post(Post::call([sock, serial, toLogin, text, id](Reactor& r) {
+            r.finishOffline(sock, serial, toLogin, text, id);
+        }));
+    });
+}
+
+void Reactor::finishOffline(SOCKET sock, uint64_t serial, const string& toLogin, const string& text, uint32_t toId) {
+    Connection* c = findConn(sock, serial);
+    if (!c || c->closing) return;
+    if (toId == 0) {
+        sendError(*c, ERR_OFFLINE, "[Сервер] Пользователь '" + toLogin + "' не в сети\n");
+        return;
+    }
+
+    Outgoing out{ makeFrame("[" + c->login + " -> " + toLogin + "] " + text + "\n"), nullptr };
+    if (c->proto == 2) out.bin = FrameWriter(MsgType::PrivateMsg).u32(c->userId).u32(toId).str(text).finish();
+    enqueue(*c, out);
+    sendInfo(*c, "[Сервер] " + toLogin + " не в сети — сообщение будет доставлено при входе\n");
+}
+
+void Reactor::sendRemote(Connection& c, const string& node, const string& toLogin, const string& body) {
+    string text = body;
+    if (text.size() > ctx.maxMsgLen) text.resize(ctx.maxMsgLen);
+    if (!admit(c, text.size())) return;
+
+    // подтверждение — сразу: не застанет адресата, узлы пришлют сюда уведомление
+    Outgoing out{ makeFrame("[" + c.login + " -> " + toLogin + "] " + text + "\n"), nullptr };
+    if (c.proto == 2) out.bin = FrameWriter(MsgType::PrivateMsg).u32(c.userId).u32((uint32_t)ctx.db.getUserId(toLogin)).str(text).finish();
+    enqueue(c, out);
+    ctx.writer.submit(Message{ 0, c.login, toLogin, text, "" });
+    ctx.federation.sendPrivate(node, c.login, toLogin, text);
+}
+
+void Reactor::broadcast(const Outgoing& msg, SOCKET except) {
+    // один кадр на всех получателей во всех реакторах; каждый ящик — FIFO,
+    // поэтому сообщения одного отправителя приходят в исходном порядке
+    broadcastLocal(msg, except);
+    for (size_t i = 0; i < ctx.reactors.size(); i++) {
+        if (i != id) ctx.reactors[i]->post(Post::fanout(msg));
+    }
+}
+
+void Reactor::broadcastRoom(const string& room, const Outgoing& msg, SOCKET except) {
+    // реакторы без участников комнаты не трогаем вовсе
+    vector<size_t> targets;
+    {
+        lock_guard<mutex> lock(ctx.roomsMutex);
+        auto it = ctx.roomShards.find(room);
+        if (it == ctx.roomShards.end()) return;
+        for (size_t i = 0; i < it->second.size(); i++) {
+            if (i != id && it->second[i] > 0) targets.push_back(i);
+        }
+    }
+    broadcastRoomLocal(room, msg, except);
+    for (size_t i : targets) ctx.reactors[i]->post(Post::fanout(msg, room));
+}
+
+// из потока-писателя: сообщение не легло в БД — отправителю ошибка вместо рассылки
+void Reactor::postNotStored(SOCKET sock, uint64_t serial) {
+    post(Post::call([sock, serial](Reactor& r) {
+        Connection* c = r.findConn(sock, serial);
+        if (c && !c->closing) r.sendError(*c, ERR_NOT_STORED, "[Сервер] Не удалось сохранить сообщение, оно не отправлено\n");
+    }));
+}
+
+void Reactor::postFanOut(const Outgoing& msg, SOCKET except, const string& room) {
+    vector<size_t> targets;
+    if (room.empty()) {
+        for (size_t i = 0; i < ctx.reactors.size(); i++) targets.push_back(i);
+    }
+    else {
+        lock_guard<mutex> lock(ctx.roomsMutex);
+        auto it = ctx.roomShards.find(room);
+        if (it == ctx.roomShards.end()) return;
+        for (size_t i = 0; i < it->second.size(); i++) {
+            if (it->second[i] > 0) targets.push_back(i);
+        }
+    }
+    // except — сокет в нашем реакторе; в чужих это был бы посторонний клиент
+    for (size_t i : targets) ctx.reactors[i]->post(Post::fanout(msg, room, i == id ? except : INVALID_SOCKET));
+}
+
+void Reactor::broadcastRoomLocal(const string& room, const Outgoing& msg, SOCKET except) {
+    auto it = roomMembers.find(room);
+    if (it == roomMembers.end()) return;
+    if (useFanout(it->second.size())) {
+        vector<Connection*> targets;
+        targets.reserve(it->second.size());
+        for (SOCKET s : it->second) {
+            auto ci = conns.find(s);
+            if (s != except && ci != conns.end() && ci->second.state == ConnState::READY) targets.push_back(&ci->second);
+        }
+        fanOutParallel(targets, msg);
+        return;
+    }
+    for (SOCKET s : it->second) {
+        if (s == except) continue;
+        auto ci = conns.find(s);
+        if (ci != conns.end() && ci->second.state == ConnState::READY) enqueue(ci->second, msg);
+    }
+}
+
+void Reactor::broadcastLocal(const Outgoing& msg, SOCKET except) {
+    if (useFanout(conns.size())) {
+        vector<Connection*> targets;
+        targets.reserve(conns.size());
+        for (auto& kv : conns) {
+            if (kv.first != except && kv.second.state == ConnState::READY) targets.push_back(&kv.second);
+        }
+        fanOutParallel(targets, msg);
+        return;
+    }
+    for (auto& kv : conns) {
+        if (kv.first != except && kv.second.state == ConnState::READY) {
+            enqueue(kv.second, msg);
+        }
+    }
+}
+
+void Reactor::fanOutParallel(const vector<Connection*>& targets, const Outgoing& msg) {
+    // запасной кадр Info для клиентов 2 собираем один раз, а не в каждом потоке
+    FramePtr info;
+    if (!msg.bin && msg.text && wantBinary()) info = FrameWriter(MsgType::Info).str(chomp(*msg.text)).finish();
+
+    // потоки пула пишут только в сами соединения; всё, что касается реактора
+    // (подписки, закрытие, список на сжатие), копят у себя и отдают после
+    struct SliceResult {
+        vector<pair<Connection*, WriteResult>> writes;
+        vector<SOCKET> dirty;
+    };
+    vector<SliceResult> results(ctx.fanout.threads() + 1);
+    const size_t maxBytes = ctx.outMaxBytes;
+    const bool hold = !flusher.immediate();
+
+    ctx.fanout.parallelFor(targets.size(), results.size(), [&](size_t slice, size_t begin, size_t end) {
+        SliceResult& r = results[slice];
+        for (size_t i = begin; i < end; i++) {
+            Connection& c = *targets[i];
+            if (c.closing) continue;
+            const FramePtr& f = c.proto != 2 ? msg.text : (msg.bin ? msg.bin : info);
+            if (!f || f->empty()) continue;
+            if (c.zout) {
+                c.zpending += *f;
+                if (!c.zqueued) {
+                    c.zqueued = true;
+                    r.dirty.push_back(c.sock);
+                }
+                continue;
+            }
+            const WriteResult w = writeFrame(c, f, maxBytes, hold);
+            if (w != WriteResult::Sent) r.writes.emplace_back(&c, w);
+        }
+    });
+
+    for (auto& r : results) {
+        for (auto& w : r.writes) applyWrite(*w.first, w.second);
+        zdirty.insert(zdirty.end(), r.dirty.begin(), r.dirty.end());
+    }
+}
+
+void Reactor::enqueue(Connection& c, const Outgoing& msg) {
+    if (c.proto != 2) {
+        if (msg.text) enqueue(c, msg.text);
+        return;
+    }
+    if (msg.bin) {
+        enqueue(c, msg.bin);
+        return;
+    }
+    // бинарный кадр не собрали (клиент 2 появился, пока сообщение было в пути) —
+    // не теряем его, а отдаём текстом в кадре Info
+    if (msg.text) enqueue(c, FrameWriter(MsgType::Info).str(chomp(*msg.text)).finish());
+}
+
+void Reactor::enqueue(Connection& c, const FramePtr& frame) {
+    if (c.closing || frame->empty()) return;
+
+    if (c.zout) {
+        // сжимаем не каждый кадр, а всю пачку разом: словарь общий, сброс один
+        c.zpending += *frame;
+        if (!c.zqueued) {
+            c.zqueued = true;
+            zdirty.push_back(c.sock);
+        }
+        return;
+    }
+    sendRaw(c, frame);
+}
+
+void Reactor::sendRaw(Connection& c, const FramePtr& frame) {
+    if (c.closing || frame->empty()) return;
+    applyWrite(c, writeFrame(c, frame, ctx.outMaxBytes, !flusher.immediate()));
+}
+
+void Reactor::applyWrite(Connection& c, WriteResult r) {
+    switch (r) {
+    case WriteResult::Sent:
+        return;
+    case WriteResult::Broken:
+        closeLater(c);
+        return;
+    case WriteResult::Overflow:
+        cout << "[Сервер] " << c.login << " не успевает читать, отключаем\n";
+        closeLater(c);
+        return;
+    case WriteResult::Queued:
+        updateInterest(c);
+        return;
+    case WriteResult::Held:
+        holdFlush(c);
+        return;
+    }
+}
+
+void Reactor::holdFlush(Connection& c) {
+    if (c.flushQueued) return;
+    c.flushQueued = true;
+    fdirty.push_back(c.sock);
+    flusher.held(chrono::steady_clock::now());
+}
+
+void Reactor::flushHeld() {
+    vector<SOCKET> batch;
+    batch.swap(fdirty);
+    flusher.flushed();
+    for (SOCKET s : batch) {
+        auto it = conns.find(s);
+        if (it == conns.end()) continue;
+        Connection& c = it->second;
+        c.flushQueued = false;
+        if (c.closing) {
+            // закрывается после этой пачки — отдаём, что влезет в буфер ядра
+            flushOut(c);
+            continue;
+        }
+        // всё отложенное уходит одним writev; остаток и отметки — как при готовности к записи
+        onWritable(s);
+    }
+}
+
+void Reactor::enableCompression(Connection& c) {
+    if (ctx.compressLevel <= 0 || !compressionAvailable()) {
+        enqueue(c, COMPRESS_NAK "\n");
+        return;
+    }
+    auto z = make_unique<Deflater>();
+    if (!z->init(ctx.compressLevel)) {
+        enqueue(c, COMPRESS_NAK "\n");
+        return;
+    }
+    // подтверждение уходит ещё несжатым, всё после него — уже в сжатом потоке
+    enqueue(c, COMPRESS_ACK "\n");
+    c.zout = move(z);
+}
+
+void Reactor::enableShm(Connection& c, const string& name) {
+    // ответ уходит ещё по сокету, поэтому до него всё должно уже уйти туда же,
+    // а клиент до ответа ничего больше не шлёт
+    unique_ptr<ShmLink> link;
+    if (ctx.shmTransport && c.local && c.zpending.empty() && c.in.buffered() == 0 && flushOut(c) && c.out.empty())
+        link = ShmLink::open(c.sock, name);
+    if (!link) {
+        enqueue(c, SHM_NAK "\n");
+        return;
+    }
+    const string ack = SHM_ACK "\n";
+    if (send(c.sock, ack.data(), (int)ack.size(), 0) != (int)ack.size()) {
+        closeLater(c);
+        return;
+    }
+    c.shm = move(link);
+    updateInterest(c);
+}
+
+void Reactor::flushCompressed() {
+    vector<SOCKET> batch;
+    batch.swap(zdirty);
+    for (SOCKET s : batch) {
+        auto it = conns.find(s);
+        if (it == conns.end()) continue;
+        Connection& c = it->second;
+        c.zqueued = false;
+        if (!c.zout || c.zpending.empty()) continue;
+
+        string packed;
+        packed.reserve(c.zpending.size() / 2 + 64);
+        const bool ok = c.zout->write(c.zpending.data(), c.zpending.size(), packed, true);
+        c.zpending.clear();
+        if (!ok) { closeLater(c); continue; }
+
+        if (c.closing) {
+            // закрывается после этой пачки (ошибка, простой) — последнее слово шлём как есть,
+            // лишь бы влезло в буфер ядра
+            if (c.out.empty()) writeSome(c, packed.data(), packed.size());
+            continue;
+        }
+        sendRaw(c, makeFrame(move(packed)));
+    }
+}
+
+// готовность к записи: дописываем очередь и, если она опустилась ниже нижней отметки,
+// снова начинаем читать клиента
+void Reactor::onWritable(SOCKET sock) {
+    auto it = conns.find(sock);
+    if (it == conns.end() || it->second.closing) return;
+    Connection& c = it->second;
+
+    if (!flushOut(c)) { closeLater(c); return; }
+    if (c.out.size() <= ctx.outLowWater) c.drained.wake(turn);
+    const bool resume = c.readPaused && c.out.size() <= ctx.outLowWater;
+    updateInterest(c);
+    // на edge-triggered бэкенде данные, пришедшие во время паузы, нового события не дадут
+    if (resume) onReadable(sock);
+}
+
+void Reactor::updateInterest(Connection& c) {
+    if (!c.readPaused && c.out.size() > ctx.outHighWater) c.readPaused = true;
+    else if (c.readPaused && c.out.size() <= ctx.outLowWater) c.readPaused = false;
+
+    const bool reading = !c.readPaused && !c.throttled;
+    unsigned flags = (reading ? (unsigned)IO_READ : 0u) | (c.out.empty() ? 0u : (unsigned)IO_WRITE);
+    // у колец сокет всегда готов к записи: о месте в кольце клиент звонит туда же, что и о данных
+    if (c.shm) flags = (reading || !c.out.empty()) ? (unsigned)IO_READ : 0u;
+    if (flags != c.ioFlags) {
+        c.ioFlags = flags;
+        loop->modify(c.sock, flags);
+    }
+}
+
+void Reactor::throttle(Connection& c, chrono::milliseconds wait) {
+    c.throttled = true;
+    updateInterest(c);
+
+    const SOCKET sock = c.sock;
+    const uint64_t serial = c.serial;
+    c.throttleTimer = timers.schedule(max(wait, chrono::milliseconds(1)), [this, sock, serial]() {
+        Connection* c = findConn(sock, serial);
+        if (!c) return;
+        c->throttleTimer = 0;
+        c->throttled = false;
+        updateInterest(*c);
+        // на edge-triggered бэкенде то, что накопилось в сокете за паузу, события не даст
+        onReadable(sock);
+    });
+}
+
+bool Reactor::admit(Connection& c, size_t bytes) {
+    if (ctx.loginLimiter.allow(c.login, bytes)) return true;
+    sendError(c, ERR_RATE_LIMIT, "[Сервер] Слишком много сообщений, это отброшено\n");
+    return false;
+}
+
+// закрыть клиента, убрать из всех структур и оповестить остальных
+void Reactor::disconnect(SOCKET sock) {
+    auto it = conns.find(sock);
+    if (it == conns.end()) return;
+    if (it->second.state != ConnState::READY) { drop(sock); return; }
+
+    string name = it->second.login;
+    const uint32_t userId = it->second.userId;
+    cout << "[Сервер] " + name + " отключился\n";
+
+    // выписываем из комнат (closing уже стоит или сейчас встанет — ответов не шлём)
+    it->second.closing = true;
+    while (!it->second.rooms.empty()) leaveRoom(it->second, it->second.rooms.back());
+
+    {
+        lock_guard<mutex> lock(ctx.dirMutex);
+        auto ls = ctx.loginToSock.find(name);
+        if (ls != ctx.loginToSock.end() && ls->second.shard == id && ls->second.sock == sock) {
+            ctx.loginToSock.erase(ls);
+            ctx.idToLogin.erase(userId);
+        }
+    }
+    drop(sock);
+
+    presenceChanged(ctx.presence.leave(name));
+    ctx.federation.localPresence(name, -1);
+}
+
+void Reactor::closeLater(Connection& c) {
+    if (c.closing) return;
+    c.closing = true;
+    pendingClose.push_back(c.sock);
+}
+
+void Reactor::closePending() {
+    // disconnect() рассылает уведомления и может пополнить список — крутимся, пока не опустеет
+    while (!pendingClose.empty()) {
+        vector<SOCKET> batch;
+        batch.swap(pendingClose);
+        for (SOCKET s : batch) disconnect(s);
+    }
+}
+
+void Reactor::drop(SOCKET sock) {
+    auto it = conns.find(sock);
+    if (it != conns.end()) {
+        if (it->second.proto == 2) ctx.v2Clients--;
+        // таймеры мёртвого соединения не ждут своего срока — освобождаем сразу
+        timers.cancel(it->second.authTimer);
+        // ждущие этого соединения проснутся с отказом и завершатся сами
+        it->second.drained.wake(turn, false);
+        timers.cancel(it->second.throttleTimer);
+    }
+    conns.erase(sock);
+    replays.erase(sock);
+    loop->remove(sock);
+    closeSocket(sock);
+}
+
+// сколько можно спать до ближайшего таймера
+int Reactor::nextTimeoutMs() const {
+    if (!turn.empty()) return 0; // сопрограммам есть что делать — только опрашиваем сокеты
+    if (!zdirty.empty()) return 0; // несжатый хвост ждёт сброса
+    const auto now = chrono::steady_clock::now();
+    const int timerMs = timers.nextTimeoutMs(now);
+    // отложенное исходящее не должно ждать дольше бюджета планировщика
+    const int flushMs = flusher.timeoutMs(now);
+    if (flushMs < 0) return timerMs;
+    return timerMs < 0 ? flushMs : min(timerMs, flushMs);
+}
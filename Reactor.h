@@ -0,0 +1,419 @@
+﻿// Reactor.h
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <unordered_map>
+#include <unordered_set>
+#include <functional>
+#include "Database.h"
+#include "EventLoop.h"
+#include "OutQueue.h"
+#include "LineFramer.h"
+#include "Protocol.h"
+#include "Presence.h"
+#include "TimerWheel.h"
+#include "RateLimiter.h"
+#include "Compression.h"
+#include "Handoff.h"
+#include "MessageWriter.h"
+#include "FanoutPool.h"
+#include "Coro.h"
+#include "Commands.h"
+#include "FlushScheduler.h"
+#include "Federation.h"
+#include "LocalTransport.h"
+
+using namespace std;
+
+// состояние соединения: сначала ждём строку "login:password",
+// затем проверяем её в БД и только после этого пускаем в чат
+enum class ConnState {
+    AWAIT_AUTH,
+    AUTHENTICATING,
+    READY,
+};
+
+struct Connection {
+    SOCKET sock = INVALID_SOCKET;
+    ConnState state = ConnState::AWAIT_AUTH;
+    string login;
+    uint32_t userId = 0;
+    int proto = 1;  // 1 — строки, 2 — бинарные кадры (после PROTO2_HELLO)
+    bool local = false; // пришёл через Unix-сокет: можно перейти на кольца в общей памяти
+    // после SHM_HELLO: данные идут через кольца, сокет — только звонок
+    unique_ptr<ShmLink> shm;
+    string room;          // куда идут обычные сообщения; пусто — общий чат
+    vector<string> rooms; // на какие комнаты подписан
+    LineFramer in; // построчный приём: кольцо, строки без копирования
+
+    uint64_t serial = 0; // номер соединения в реакторе: таймеры сверяют его, а не переиспользуемый сокет
+    chrono::steady_clock::time_point lastSeen; // когда клиент последний раз что-то прислал
+    bool pinged = false;                       // PING отправлен, ответа ещё не было
+    TimerWheel::TimerId authTimer = 0;
+    bool replaying = false; // сопрограмма догрузки истории уже идёт
+
+    // лимиты соединения: превысил — перестаём читать сокет, пока вёдра не наполнятся
+    TokenBucket msgRate;
+    TokenBucket byteRate;
+    bool throttled = false;
+    TimerWheel::TimerId throttleTimer = 0;
+
+    // сжатие исходящего (после COMPRESS_HELLO): за пачку событий всё копится
+    // в zpending и уходит в out одним сжатым куском
+    unique_ptr<Deflater> zout;
+    string zpending;
+    bool zqueued = false; // уже в списке на сжатие в конце пачки
+
+    OutQueue out;            // всё, что ещё не ушло в сокет
+    bool flushQueued = false; // в out отложены кадры до сброса в конце оборота
+    WaitList drained;        // сопрограммы, ждущие, пока out опустится до нижней отметки
+    bool readPaused = false; // очередь выше верхней отметки — клиента пока не читаем
+    bool closing = false;    // уже стоит в очереди на закрытие
+    unsigned ioFlags = IO_READ; // на что подписаны в цикле событий сейчас
+};
+
+// чем кончилась попытка записать кадр в соединение
+enum class WriteResult {
+    Sent,     // ушёл целиком
+    Queued,   // остаток в очереди — нужна подписка на запись
+    Broken,   // сокет сломан
+    Overflow, // очередь больше out_max_bytes — клиент не справляется
+    Held,     // отложен в очередь до сброса в конце оборота (FlushScheduler)
+};
+
+// догрузка истории после входа: идём курсором по id порциями,
+// чтобы один вход с большой историей не останавливал весь реактор
+struct HistoryReplay {
+    string room;    // пусто — общий чат и личные, иначе история комнаты
+    bool offline = false; // не история, а отложенные личные (cursor — id в их очереди)
+    int cursor = 0; // id последнего отправленного сообщения
+    int upTo = 0;   // что пришло позже, клиент получит вживую
+    unordered_map<string, uint32_t> ids; // логин -> id для кадров протокола 2
+};
+
+class Reactor;
+
+// где сейчас сидит пользователь: номер реактора и сокет внутри него
+struct Route {
+    size_t shard;
+    SOCKET sock;
+    uint32_t userId;
+};
+
+// общее для всех реакторов состояние сервера
+struct ServerContext {
+    ServerContext(Database& db) : db(db), writer(db), federation(*this) {}
+
+    Database& db;
+    // сообщения пишутся в БД отдельным потоком пачками;
+    // durableAck — рассылать только после COMMIT (иначе сразу, не дожидаясь диска)
+    MessageWriter writer;
+    bool durableAck = false;
+    size_t maxMsgLen = 200;
+    chrono::milliseconds authTimeout{ 10000 };
+    // молчит heartbeat — шлём PING; молчит idleTimeout — отключаем (0 — выключено).
+    // По умолчанию выключено: старые клиенты на PING не отвечают и отвалились бы
+    chrono::milliseconds heartbeat{ 0 };
+    chrono::milliseconds idleTimeout{ 0 };
+
+    // лимиты на соединение (в секунду и запас; 0 — без лимита)
+    double rateMsgs = 20, rateMsgsBurst = 40;
+    double rateBytes = 32 << 10, rateBytesBurst = 64 << 10;
+    // лимиты на логин по всем его соединениям: сверх них сообщения отклоняются
+    LoginLimiter loginLimiter;
+
+    // отметки исходящей очереди: выше high перестаём читать клиента,
+    // ниже low — снова читаем; больше maxBytes — клиент не справляется, отключаем
+    size_t outHighWater = 1 << 20;
+    size_t outLowWater = 256 << 10;
+    size_t outMaxBytes = 16 << 20;
+
+    // отдавать ли кольца в общей памяти клиентам с Unix-сокета (SHM_HELLO)
+    bool shmTransport = false;
+
+    // уровень сжатия для клиентов, приславших COMPRESS_HELLO (0 — не предлагаем)
+    int compressLevel = 6;
+
+    // рассылка на fanoutThreshold и больше получателей реактора раздаётся потоками пула
+    // (fanout_threads; без потоков — всегда в потоке реактора)
+    FanoutPool fanout;
+    size_t fanoutThreshold = 4096;
+
+    // под нагрузкой исходящее копится до конца оборота цикла, а пока она держится —
+    // ещё до flushDelay; нагрузка — от flushBusyEvents событий за оборот
+    chrono::microseconds flushDelay{ 0 };
+    size_t flushBusyEvents = 2;
+
+    // сколько сообщений истории читать из БД за один шаг реактора
+    size_t historyChunk = 256;
+
+    // готовый список пользователей в обеих кодировках; пересобирается,
+    // только когда db.usersVersion() ушла вперёд
+    mutex usersMutex;
+    uint64_t usersTextVer = UINT64_MAX, usersBinVer = UINT64_MAX;
+    FramePtr usersText, usersBin;
+
+    vector<unique_ptr<Reactor>> reactors;
+
+    // логин -> реактор/сокет (для личных сообщений); читают и пишут все потоки
+    mutex dirMutex;
+    unordered_map<string, Route> loginToSock;
+    unordered_map<uint32_t, string> idToLogin; // для кадров PrivateMsg, адресованных по id
+
+    // кто в сети: подключения/отключения уходят клиентам пакетами раз в окно
+    Presence presence;
+
+    // комната -> сколько её участников в каждом реакторе: рассылка комнаты
+    // будит только те реакторы, где кто-то из неё сидит
+    mutex roomsMutex;
+    unordered_map<string, vector<uint32_t>> roomShards;
+
+    // сколько сейчас клиентов протокола 2: пока их нет, бинарные кадры не собираем
+    atomic<int> v2Clients{ 0 };
+
+    // связь с другими узлами (node_id в конфиге; без него — один сервер)
+    Federation federation;
+};
+
+// доставка из чужого реактора: сообщение уходит либо одному адресату, либо всем
+struct Post {
+    SOCKET target = INVALID_SOCKET; // INVALID_SOCKET — всем авторизованным реактора
+    string targetLogin;             // сокет мог успеть смениться владельцем — сверяем логин
+    Outgoing data;
+    string room;                    // для рассылки: только участникам комнаты
+    SOCKET except = INVALID_SOCKET; // для рассылки: кроме этого сокета (отправителя)
+    function<void(Reactor&)> task;  // вместо доставки — выполнить в потоке реактора
+
+    // собирать письма только через эти фабрики — частичный Post{...} ловит -Wextra
+    // одному соединению (сокет сверяется с логином)
+    static Post direct(SOCKET target, string login, Outgoing data) {
+        Post p;
+        p.target = target;
+        p.targetLogin = move(login);
+        p.data = move(data);
+        return p;
+    }
+    // всем авторизованным реактора (room — только участникам комнаты), кроме except
+    static Post fanout(Outgoing data, string room = "", SOCKET except = INVALID_SOCKET) {
+        Post p;
+        p.data = move(data);
+        p.room = move(room);
+        p.except = except;
+        return p;
+    }
+    // выполнить task в потоке реактора
+    static Post call(function<void(Reactor&)> task) {
+        Post p;
+        p.task = move(task);
+        return p;
+    }
+};
+
+// Один поток = один реактор: свой цикл событий, свой слушающий сокет
+// (SO_REUSEPORT) и свой набор соединений. Между собой реакторы общаются
+// только через почтовые ящики post(), которые сохраняют порядок отправки.
+class Reactor {
+public:
+    Reactor(ServerContext& ctx, size_t id, unique_ptr<EventLoop> loop, SOCKET listenSock);
+    ~Reactor();
+
+    bool ok() const { return wakeRead != INVALID_SOCKET; }
+    const char* backendName() const { return loop->name(); }
+
+    void run();
+
+    // общий для всех реакторов слушающий Unix-сокет; только до run()
+    void listenLocal(SOCKET s);
+
+    // потокобезопасно: поставить доставку в очередь реактора и разбудить его
+    void post(Post p);
+
+    // горячий перезапуск. stop() потокобезопасен: run() вернётся после текущей пачки.
+    // exportSessions() — после остановки всех реакторов; adopt() — до первого run()
+    void stop();
+    void exportSessions(HandoffState& st);
+    void adopt(HandoffSession& s);
+
+    // у логина на другом узле стало на delta соединений больше (меньше);
+    // только из потока реактора (федерация присылает задачей через post)
+    void remotePresence(const string& login, int delta);
+
+    // отложенная задача на колесе таймеров реактора; только из его собственного потока
+    TimerWheel::TimerId defer(chrono::milliseconds delay, TimerWheel::Callback task) {
+        return timers.schedule(delay, move(task));
+    }
+
+private:
+    void acceptAll(SOCKET from, bool local);
+    void armAuthTimer(Connection& c);
+    void onReadable(SOCKET sock);
+    void onWritable(SOCKET sock);
+    bool authenticateLine(Connection& c, const string& firstMsg);
+    bool authenticate(Connection& c, const string& login, const string& pass);
+    // ответ потока-писателя на authenticate (в потоке реактора)
+    void finishAuth(SOCKET sock, uint64_t serial, const string& login, bool ok, uint32_t userId);
+    void rejectAuth(SOCKET sock);
+    void welcome(Connection& c);
+    // догрузка истории соединения: порция за оборот цикла, пока клиент успевает читать
+    void startReplay(Connection& c);
+    Task replayHistory(SOCKET sock, uint64_t serial);
+    // поставить догрузки соединению, когда уже разосланное ляжет в БД (иначе новичок
+    // не получит его ни вживую, ни из истории); ждёт поток-писатель, не реактор
+    void queueReplay(Connection& c, vector<HistoryReplay> parts);
+    void handleLine(Connection& c, string_view line);
+    // текстовые команды (/help, /w, ...): таблица общая на все реакторы
+    using CommandHandler = void (Reactor::*)(Connection& c, const CommandArgs& args);
+    static const CommandTable<CommandHandler>& commands();
+    void cmdHelp(Connection& c, const CommandArgs& args);
+    void cmdPong(Connection& c, const CommandArgs& args);
+    void cmdUsers(Connection& c, const CommandArgs& args);
+    void cmdWhisper(Connection& c, const CommandArgs& args);
+    void cmdJoin(Connection& c, const CommandArgs& args);
+    void cmdLeave(Connection& c, const CommandArgs& args);
+    void cmdAck(Connection& c, const CommandArgs& args);
+    // false — соединение уже закрыто (отказ во входе), c больше не трогать
+    bool handleFrame(Connection& c, string_view frame);
+    void publish(Connection& c, string text);
+    void publishRoom(Connection& c, const string& room, string text);
+
+    // /join и /leave: подписка соединения на комнату
+    void joinRoom(Connection& c, const string& room);
+    void leaveRoom(Connection& c, string room); // по значению: часто передают c.room
+    void sendPrivate(Connection& c, const string& toLogin, const string& body);
+    // адресата нет в сети: в его очередь, отдадим при входе
+    void sendOffline(Connection& c, const string& toLogin, const string& body);
+    // ответ потока-писателя на sendOffline: toId == 0 — адресата нет или запись не удалась
+    void finishOffline(SOCKET sock, uint64_t serial, const string& toLogin, const string& text, uint32_t toId);
+    // адресат на другом узле (или его дом там): через федерацию на узел node
+    void sendRemote(Connection& c, const string& node, const string& toLogin, const string& body);
+
+    // ответы одному клиенту в его протоколе: справка/служебное и ошибки
+    // false — в тексте управляющие символы: отправителю ошибка, дальше не передаём
+    bool plainText(Connection& c, string_view text);
+    void sendInfo(Connection& c, const string& text);
+    void sendError(Connection& c, ErrorCode code, const string& text);
+    void sendUsers(Connection& c);
+
+    // есть ли кому отправлять бинарные кадры
+    bool wantBinary() const { return ctx.v2Clients.load() > 0; }
+
+    // всем авторизованным во всех реакторах, кроме except в этом
+    void broadcast(const Outgoing& msg, SOCKET except);
+    void broadcastLocal(const Outgoing& msg, SOCKET except);
+    // только участникам комнаты, и только в тех реакторах, где они есть
+    void broadcastRoom(const string& room, const Outgoing& msg, SOCKET except);
+    void broadcastRoomLocal(const string& room, const Outgoing& msg, SOCKET except);
+    // большая рассылка по потокам пула; реактор ждёт, пока она разложена всем
+    bool useFanout(size_t recipients) const { return ctx.fanout.threads() > 0 && recipients >= ctx.fanoutThreshold; }
+    void fanOutParallel(const vector<Connection*>& targets, const Outgoing& msg);
+    // то же из любого потока: только через почтовые ящики, свой реактор тоже
+    // (persist_ack=durable — зовёт поток-писатель после COMMIT); room пусто — всем
+    void postFanOut(const Outgoing& msg, SOCKET except, const string& room);
+    void postNotStored(SOCKET sock, uint64_t serial);
+
+    // поставить данные в исходящую очередь клиента (и сразу попытаться отправить)
+    // общий кадр кладётся в очередь по указателю, без копирования байтов
+    void enqueue(Connection& c, const FramePtr& frame);
+    void enqueue(Connection& c, string s) { enqueue(c, makeFrame(move(s))); }
+    // из двух кодировок берём ту, на которой говорит клиент
+    void enqueue(Connection& c, const Outgoing& msg);
+    // уже готовые к сокету байты, мимо сжатия
+    void sendRaw(Connection& c, const FramePtr& frame);
+    // последствия записи, которые трогают реактор (подписки, закрытие)
+    void applyWrite(Connection& c, WriteResult r);
+    void updateInterest(Connection& c);
+
+    // ответ на COMPRESS_HELLO; дальше всё исходящее соединения сжимается
+    void enableCompression(Connection& c);
+    // ответ на SHM_HELLO; дальше всё идёт через кольца сегмента name
+    void enableShm(Connection& c, const string& name);
+    // сжать и отправить накопленное за пачку событий, по одному сбросу на соединение
+    void flushCompressed();
+    // отложенное планировщиком — одним writev на соединение
+    void holdFlush(Connection& c);
+    void flushHeld();
+
+    // превышен лимит соединения: не читаем его wait мс (давление уходит в TCP)
+    void throttle(Connection& c, chrono::milliseconds wait);
+    // лимит логина перед записью в БД и рассылкой; false — ошибка уже отправлена
+    bool admit(Connection& c, size_t bytes);
+
+    void disconnect(SOCKET sock);
+    void drop(SOCKET sock);
+    // закрыть после текущей пачки событий (нельзя рвать conns посреди обхода)
+    void closeLater(Connection& c);
+    void closePending();
+
+    void drainMailbox();
+
+    // изменение присутствия; открывший окно реактор сам его и разошлёт
+    void presenceChanged(bool openedWindow);
+    // пакет присутствия своим соединениям: вошедшим в окне — снимок вместо пакета
+    void presenceLocal(const PresenceUpdate& u);
+
+    // соединение, если сокет всё ещё принадлежит тому же клиенту
+    Connection* findConn(SOCKET sock, uint64_t serial);
+    // пинги и простой: спит до ближайшей проверки и смотрит на lastSeen
+    Task watchIdle(SOCKET sock, uint64_t serial);
+    void sendPing(Connection& c);
+
+    int nextTimeoutMs() const;
+
+    // ожидания для сопрограмм (только из потока реактора): возобновляются
+    // в безопасной точке цикла — после пачки событий и таймеров
+    struct SleepAwaiter {
+        TimerWheel& timers;
+        unordered_set<void*>& sleeping;
+        chrono::milliseconds delay;
+
+        bool await_ready() const noexcept { return delay.count() <= 0; }
+        void await_suspend(coroutine_handle<> h) {
+            sleeping.insert(h.address());
+            timers.schedule(delay, [h, &s = sleeping]() {
+                s.erase(h.address());
+                h.resume();
+            });
+        }
+        void await_resume() const noexcept {}
+    };
+    // следующий оборот цикла
+    WaitList::Awaiter nextTurn() { return turn.wait(); }
+    // исходящая очередь опустилась до нижней отметки; false — соединение закрыто
+    WaitList::Awaiter drained(Connection& c) { return c.drained.wait(); }
+    // пауза на колесе таймеров (отменить нельзя: после неё сопрограмма сама
+    // проверяет, живо ли ещё соединение)
+    SleepAwaiter sleepFor(chrono::milliseconds d) { return SleepAwaiter{ timers, sleeping, d }; }
+
+    ServerContext& ctx;
+    size_t id;
+    unique_ptr<EventLoop> loop;
+    SOCKET listenSock;
+    SOCKET localListen = INVALID_SOCKET;
+
+    unordered_map<SOCKET, Connection> conns;
+    uint64_t nextSerial = 1;
+    // дедлайны рукопожатий, пинги, простой и отложенные задачи
+    TimerWheel timers;
+    unordered_set<void*> sleeping; // кадры сопрограмм, спящих на колесе (sleepFor)
+    vector<SOCKET> pendingClose;
+    unordered_map<SOCKET, deque<HistoryReplay>> replays; // общий чат при входе, затем комнаты по /join
+    unordered_map<string, unordered_set<SOCKET>> roomMembers; // участники комнат в этом реакторе
+    WaitList turn;            // сопрограммы, которые продолжатся на этом обороте цикла
+    vector<SOCKET> zdirty;    // у кого в zpending что-то лежит
+    FlushScheduler flusher;   // писать сразу или копить до конца оборота
+    vector<SOCKET> fdirty;    // у кого в out отложены кадры
+    atomic<bool> stopRequested{ false };
+
+    // почтовый ящик: пишут другие потоки, читает только свой
+    SOCKET wakeRead = INVALID_SOCKET;
+    SOCKET wakeWrite = INVALID_SOCKET;
+    mutex mailMutex;
+    vector<Post> mailbox;
+    vector<Post> mailWork; // забранная пачка, чтобы не держать мьютекс при отправке
+};
@@ -0,0 +1,101 @@
+﻿// TimerWheel.cpp
+#include "TimerWheel.h"
+#include <algorithm>
+
+TimerWheel::TimerWheel(chrono::milliseconds tick)
+    : tick(tick.count() > 0 ? tick : chrono::milliseconds(1)), start(chrono::steady_clock::now()) {}
+
+TimerWheel::TimerId TimerWheel::schedule(chrono::milliseconds delay, Callback cb) {
+    // округляем вверх и не меньше одного тика: в текущую ячейку не кладём никогда
+    const int64_t ticks = max<int64_t>(1, (delay.count() + tick.count() - 1) / tick.count());
+
+    // срок считаем от настоящего «сейчас»: advance() могли давно не звать
+    const auto elapsed = chrono::steady_clock::now() - start;
+    const uint64_t nowTick = max<uint64_t>(current, (uint64_t)(elapsed / tick));
+    if (index.empty()) current = nowTick; // пустое колесо можно просто перевести вперёд
+
+    const TimerId id = nextId++;
+    place(Timer{ id, nowTick + (uint64_t)ticks, move(cb) });
+    return id;
+}
+
+bool TimerWheel::cancel(TimerId id) {
+    auto it = index.find(id);
+    if (it == index.end()) return false;
+    it->second.slot->erase(it->second.it);
+    index.erase(it);
+    return true;
+}
+
+void TimerWheel::place(Timer&& t) {
+    const uint64_t maxDelta = (uint64_t(1) << (SLOT_BITS * LEVELS)) - 1;
+    if (t.expire - current > maxDelta) t.expire = current + maxDelta;
+    const uint64_t delta = t.expire - current;
+
+    // уровень — по тому, насколько далеко срок; ячейка — по битам самого срока
+    int level = 0;
+    while (level < LEVELS - 1 && delta >= (uint64_t(1) << (SLOT_BITS * (level + 1)))) level++;
+    Slot& slot = wheel[level][(t.expire >> (SLOT_BITS * level)) & (SLOTS - 1)];
+
+    const TimerId id = t.id;
+    slot.push_back(move(t));
+    index[id] = Where{ &slot, prev(slot.end()) };
+}
+
+void TimerWheel::cascade(int level) {
+    // ячейка уровня level подошла: её таймеры теперь ближе — раскладываем ниже
+    Slot& slot = wheel[level][(current >> (SLOT_BITS * level)) & (SLOTS - 1)];
+    Slot moving;
+    moving.swap(slot);
+    while (!moving.empty()) {
+        Timer t = move(moving.front());
+        moving.pop_front();
+        index.erase(t.id);
+        place(move(t));
+    }
+}
+
+void TimerWheel::advance(chrono::steady_clock::time_point now) {
+    if (now < start) return;
+    const uint64_t target = (uint64_t)((now - start) / tick);
+
+    while (current < target) {
+        // пустое колесо крутить незачем
+        if (index.empty()) {
+            current = target;
+            break;
+        }
+        current++;
+
+        // нижний уровень сделал оборот — спускаем следующую ячейку сверху
+        for (int level = 1; level < LEVELS; level++) {
+            if ((current & ((uint64_t(1) << (SLOT_BITS * level)) - 1)) != 0) break;
+            cascade(level);
+        }
+
+        // по одному: колбэк может отменить соседа по ячейке
+        Slot& slot = wheel[0][current & (SLOTS - 1)];
+        while (!slot.empty()) {
+            Callback cb = move(slot.front().cb);
+            index.erase(slot.front().id);
+            slot.pop_front();
+            cb();
+        }
+    }
+}
+
+int TimerWheel::nextTimeoutMs(chrono::steady_clock::time_point now) const {
+    if (index.empty()) return -1;
+
+    // ближайшая занятая ячейка нижнего уровня; если их нет — просыпаемся к перекладке сверху
+    uint64_t due = (current | (SLOTS - 1)) + 1;
+    for (uint64_t t = current + 1; t < due; t++) {
+        if (!wheel[0][t & (SLOTS - 1)].empty()) {
+            due = t;
+            break;
+        }
+    }
+    const auto at = start + tick * (int64_t)due;
+    const auto left = chrono::duration_cast<chrono::milliseconds>(at - now).count();
+    return left > 0 ? (int)left + 1 : 0;
+}
@@ -0,0 +1,61 @@
+﻿// TimerWheel.h
+#pragma once
+#include <cstdint>
+#include <chrono>
+#include <functional>
+#include <list>
+#include <unordered_map>
+
+using namespace std;
+
+// Иерархическое колесо таймеров: 4 уровня по 64 ячейки, шаг tick.
+// Постановка и отмена — O(1), продвижение — O(1) на тик (плюс перекладка
+// ячейки верхнего уровня раз в 64 тика нижнего). Уровни покрывают
+// 64, 64², 64³, 64⁴ тиков; более далёкие сроки прижимаются к последнему уровню.
+// Однопоточное: у каждого реактора своё колесо.
+class TimerWheel {
+public:
+    using TimerId = uint64_t;   // 0 — «нет таймера»
+    using Callback = function<void()>;
+
+    explicit TimerWheel(chrono::milliseconds tick = chrono::milliseconds(10));
+
+    // cb вызовется из advance() не раньше чем через delay (с точностью до тика)
+    TimerId schedule(chrono::milliseconds delay, Callback cb);
+    // false — таймера уже нет (сработал или отменён)
+    bool cancel(TimerId id);
+
+    // выполнить всё, что созрело к моменту now; колбэки могут ставить и отменять таймеры
+    void advance(chrono::steady_clock::time_point now);
+
+    // сколько можно спать до ближайшего срабатывания (-1 — таймеров нет)
+    int nextTimeoutMs(chrono::steady_clock::time_point now) const;
+
+    size_t size() const { return index.size(); }
+
+private:
+    static const int LEVELS = 4;
+    static const int SLOT_BITS = 6;
+    static const int SLOTS = 1 << SLOT_BITS;
+
+    struct Timer {
+        TimerId id;
+        uint64_t expire; // номер тика
+        Callback cb;
+    };
+    using Slot = list<Timer>;
+    struct Where {
+        Slot* slot;
+        Slot::iterator it;
+    };
+
+    void place(Timer&& t);
+    void cascade(int level);
+
+    Slot wheel[LEVELS][SLOTS];
+    unordered_map<TimerId, Where> index;
+    chrono::milliseconds tick;
+    chrono::steady_clock::time_point start;
+    uint64_t current = 0; // последний обработанный тик
+    TimerId nextId = 1;
+};
@@ -5,7 +5,16 @@
 #include <thread>
 #include <atomic>
 #include <vector>
+#include <mutex>
+#include <unordered_map>
+#include <memory>
+#include <cstring>
+#include <algorithm>
 #include "Config.h"   // читать ip/port из config.txt
+#include "LineFramer.h"
+#include "Protocol.h"
+#include "Compression.h"
+#include "LocalTransport.h"
 
 #ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
@@ -26,9 +35,16 @@ typedef int SOCKET;
 using namespace std;
 
 static atomic<bool> running(true);
+// пишут двое: поток ввода и поток приёма (ответы на PING) — не перемешиваем их байты
+static mutex sendMutex;
+
+// transport=shm: после рукопожатия байты идут через кольца, сокет — только звонок
+static unique_ptr<ShmLink> shm;
 
 // надёжная отправка всего буфера (боремся с частичной отправкой)
 static bool sendAll(SOCKET s, const char* data, int len) {
+    lock_guard<mutex> lock(sendMutex);
+    if (shm) return shm->writeAll(data, (size_t)len, running);
     int sent = 0;
     while (sent < len) {
         int rc = send(s, data + sent, len - sent, 0);
@@ -38,26 +54,259 @@ static bool sendAll(SOCKET s, const char* data, int len) {
     return true;
 }
 
+// протокол 2: id -> логин из кадров UserList/Presence (нужен и потоку ввода для /w)
+static mutex namesMutex;
+static unordered_map<uint32_t, string> names;
+
+static void closeClient(SOCKET s) {
+#ifdef _WIN32
+    closesocket(s);
+    WSACleanup();
+#else
+    close(s);
+#endif
+}
+
+// сжатие от сервера (compress=1): пришедшее разжимается в plainBuf, оттуда и читаем;
+// после рукопожатия читает только поток приёма, поэтому без мьютекса
+static unique_ptr<Inflater> inflater;
+static string plainBuf;
+static size_t plainPos = 0;
+
+// recv из сокета или из кольца общей памяти
+static int recvRaw(SOCKET s, char* data, int len) {
+    if (shm) return shm->readWait(data, (size_t)len);
+    return recv(s, data, len, 0);
+}
+
+// recv поверх возможного сжатия: отдаёт уже разжатые байты, результат как у recv
+static int recvData(SOCKET s, char* data, int len) {
+    if (!inflater) return recvRaw(s, data, len);
+    while (plainPos == plainBuf.size()) {
+        char raw[16 * 1024];
+        int n = recvRaw(s, raw, (int)sizeof(raw));
+        if (n <= 0) return n;
+        plainBuf.clear();
+        plainPos = 0;
+        if (!inflater->write(raw, (size_t)n, plainBuf)) return -1;
+    }
+    const size_t take = min((size_t)len, plainBuf.size() - plainPos);
+    memcpy(data, plainBuf.data() + plainPos, take);
+    plainPos += take;
+    return (int)take;
+}
+
+// читаем ровно len байт (рукопожатие, пока поток приёма не запущен)
+static bool recvAll(SOCKET s, char* data, size_t len) {
+    size_t got = 0;
+    while (got < len) {
+        int n = recvData(s, data + got, (int)(len - got));
+        if (n <= 0) return false;
+        got += (size_t)n;
+    }
+    return true;
+}
+
+// одна строка ответа сервера до '\n' — побайтно, чтобы не съесть то, что идёт следом
+static bool recvLine(SOCKET s, string& line) {
+    line.clear();
+    char ch;
+    while (true) {
+        if (!recvAll(s, &ch, 1)) return false;
+        if (ch == '\n') return true;
+        if (ch != '\r') line.push_back(ch);
+    }
+}
+
+// один кадр протокола 2 целиком: тип + данные
+static bool recvFrame(SOCKET s, string& frame) {
+    unsigned char hdr[FRAME_HEADER];
+    if (!recvAll(s, reinterpret_cast<char*>(hdr), FRAME_HEADER)) return false;
+    const size_t len = (size_t(hdr[0]) << 24) | (size_t(hdr[1]) << 16) | (size_t(hdr[2]) << 8) | hdr[3];
+    if (len == 0 || len > MAX_FRAME) return false;
+    frame.resize(len);
+    return recvAll(s, &frame[0], len);
+}
+
+static string nameOf(uint32_t id) {
+    lock_guard<mutex> lock(namesMutex);
+    auto it = names.find(id);
+    return it != names.end() ? it->second : "#" + to_string(id);
+}
+
+static void printLine(string_view line) {
+    cout << "\n" << line << "\n> ";
+    cout.flush();
+}
+
+// разбор кадра протокола 2 и вывод в том же виде, что и строки протокола 1
+static void printFrame(string_view frame) {
+    FrameReader r(frame);
+    string_view text, login;
+    uint32_t from = 0, to = 0, count = 0;
+    uint8_t flag = 0;
+    uint16_t code = 0;
+
+    switch (r.type()) {
+    case MsgType::PublicMsg:
+        if (r.u32(from) && r.str(text)) printLine("[" + nameOf(from) + "] " + string(text));
+        break;
+    case MsgType::PrivateMsg:
+        if (r.u32(from) && r.u32(to) && r.str(text))
+            printLine("[" + nameOf(from) + " -> " + nameOf(to) + "] " + string(text));
+        break;
+    case MsgType::RoomMsg: {
+        string_view room;
+        if (r.u32(from) && r.str(room) && r.str(text))
+            printLine("[" + nameOf(from) + " -> #" + string(room) + "] " + string(text));
+        break;
+    }
+    case MsgType::UserList: {
+        // длинный список приходит несколькими кадрами: копим до кадра с more = 0
+        static vector<string> users;
+        if (!r.u8(flag) || !r.u32(count)) break;
+        {
+            lock_guard<mutex> lock(namesMutex);
+            for (uint32_t i = 0; i < count && r.u32(from) && r.str(login); i++) {
+                names[from] = string(login);
+                users.emplace_back(login);
+            }
+        }
+        if (flag) break;
+        cout << "\n=== Пользователи (" << users.size() << ") ===\n";
+        for (const auto& u : users) cout << " - " << u << '\n';
+        cout << "= = = = = = = = = = = = = = = =\n> ";
+        cout.flush();
+        users.clear();
+        break;
+    }
+    case MsgType::Presence:
+        if (!r.u8(flag) || !r.u32(from) || !r.str(login)) break;
+        {
+            lock_guard<mutex> lock(namesMutex);
+            names[from] = string(login);
+        }
+        printLine("[Сервер] " + string(login) + (flag ? " подключился" : " отключился"));
+        break;
+    case MsgType::Online: {
+        // как и UserList, может прийти несколькими кадрами
+        static vector<string> online;
+        if (!r.u8(flag) || !r.u32(count)) break;
+        {
+            lock_guard<mutex> lock(namesMutex);
+            for (uint32_t i = 0; i < count && r.u32(from) && r.str(login); i++) {
+                names[from] = string(login);
+                online.emplace_back(login);
+            }
+        }
+        if (flag) break;
+        string line = "[Сервер] В сети: " + to_string(online.size());
+        for (size_t i = 0; i < online.size(); i++) line += (i == 0 ? " — " : ", ") + online[i];
+        printLine(line);
+        online.clear();
+        break;
+    }
+    case MsgType::Ping:
+        break; // отвечает receiveFrames — у неё есть сокет
+    case MsgType::Error:
+        if (r.u16(code) && r.str(text)) printLine(text);
+        break;
+    case MsgType::Info:
+        if (r.str(text)) printLine(text);
+        break;
+    default:
+        break;
+    }
+}
+
+// протокол 2: кадры вместо строк; новый клиент говорит со старым сервером только построчно
+static void receiveFrames(SOCKET sock) {
+    LineFramer framer(MAX_FRAME);
+    while (running) {
+        auto [buf, room] = framer.writable();
+        int n = recvData(sock, buf, (int)room);
+        if (n <= 0) {
+            cout << (n == 0 ? "\n[Сервер отключился]\n" : "\n[Ошибка приёма]\n");
+            running = false;
+            break;
+        }
+        framer.commit((size_t)n);
+
+        string_view frame;
+        while (framer.nextFrame(frame)) {
+            if (FrameReader(frame).type() == MsgType::Ping) {
+                string pong = FrameWriter(MsgType::Pong).bytes();
+                sendAll(sock, pong.c_str(), (int)pong.size());
+                continue;
+            }
+            // отложенные личные получены — подтверждаем, чтобы не пришли снова
+            FrameReader r(frame);
+            uint32_t lastId = 0;
+            if (r.type() == MsgType::OfflineEnd) {
+                if (r.u32(lastId)) {
+                    string ack = FrameWriter(MsgType::Command).str("/ack " + to_string(lastId)).bytes();
+                    sendAll(sock, ack.c_str(), (int)ack.size());
+                }
+                continue;
+            }
+            printFrame(frame);
+        }
+        if (framer.broken()) {
+            cout << "\n[Некорректный кадр от сервера]\n";
+            running = false;
+            break;
+        }
+    }
+}
+
+// строка ввода -> кадр протокола 2
+static string encodeInput(const string& msg) {
+    // /w <login> <текст> — по id, если адресат уже известен из списка/оповещений
+    if (msg.rfind("/w ", 0) == 0) {
+        size_t b = msg.find_first_not_of(' ', 3);
+        size_t sp = b == string::npos ? string::npos : msg.find(' ', b);
+        if (sp != string::npos) {
+            string to = msg.substr(b, sp - b);
+            lock_guard<mutex> lock(namesMutex);
+            for (const auto& kv : names) {
+                if (kv.second == to)
+                    return FrameWriter(MsgType::PrivateMsg).u32(kv.first).str(string_view(msg).substr(sp + 1)).bytes();
+            }
+        }
+    }
+    if (!msg.empty() && msg[0] == '/') return FrameWriter(MsgType::Command).str(msg).bytes();
+    return FrameWriter(MsgType::PublicMsg).str(msg).bytes();
+}
+
 // поток приёма сообщений (построчный парсинг + блок [USERS])
 static void receiveLoop(SOCKET sock) {
-    string acc;                 // аккумулятор «хвостов» между recv
+    LineFramer framer(MAX_FRAME); // кольцо между recv; длиннее 64К строк от сервера не бывает
     bool inUsers = false;       // внутри блока [USERS]..[END]
     vector<string> users;       // временный сбор пользователей
 
-    char buf[1024];
     while (running) {
-        int n = recv(sock, buf, sizeof(buf), 0);
+        auto [buf, room] = framer.writable();
+        int n = recvData(sock, buf, (int)room);
         if (n > 0) {
-            acc.append(buf, buf + n);
-
-            // вынимаем полные строки по '\n'
-            size_t pos;
-            while ((pos = acc.find('\n')) != string::npos) {
-                string line = acc.substr(0, pos);
-                acc.erase(0, pos + 1);
+            framer.commit((size_t)n);
 
-                // уберём CR, если пришёл "\r\n"
-                if (!line.empty() && line.back() == '\r') line.pop_back();
+            // вынимаем полные строки по '\n' (CR уже отрезан)
+            string_view line;
+            while (framer.next(line)) {
+                // сервер проверяет, живы ли мы
+                if (line == "[PING]") {
+                    sendAll(sock, "/pong\n", 6);
+                    continue;
+                }
+                // OFFLINE_MARK id — конец порции отложенных личных, подтверждаем
+                if (line.rfind(OFFLINE_MARK, 0) == 0) {
+                    const string_view id = line.substr(sizeof(OFFLINE_MARK) - 1);
+                    if (!id.empty() && id.find_first_not_of("0123456789") == string_view::npos) {
+                        string ack = "/ack " + string(id) + "\n";
+                        sendAll(sock, ack.c_str(), (int)ack.size());
+                    }
+                    continue;
+                }
 
                 // обработка спец-блока [USERS]
                 if (!inUsers && line == "[USERS]") {
@@ -76,7 +325,7 @@ static void receiveLoop(SOCKET sock) {
                         continue;
                     }
                     else {
-                        if (!line.empty()) users.push_back(line);
+                        if (!line.empty()) users.emplace_back(line);
                         continue;
                     }
                 }
@@ -102,35 +351,12 @@ static void receiveLoop(SOCKET sock) {
     }
 }
 
-int client_main() {
-#ifdef _WIN32
-    // консоль в UTF-8 для корректной кириллицы
-    SetConsoleOutputCP(CP_UTF8);
-    SetConsoleCP(CP_UTF8);
-
-    WSADATA wsa;
-    if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) {
-        cerr << "Ошибка инициализации Winsock\n";
-        return 1;
-    }
-#endif
-
-    // читаем ip/port из config.txt
-    auto cfg = loadConfig("config.txt");
-    string ip = "127.0.0.1";
-    int port = 5000;
-    try { ip = cfg.at("ip"); }
-    catch (...) {}
-    try { port = stoi(cfg.at("port")); }
-    catch (...) {}
-
+// TCP-подключение к ip:port; INVALID_SOCKET — ошибка уже выведена
+static SOCKET connectTcp(const string& ip, int port) {
     SOCKET sock = socket(AF_INET, SOCK_STREAM, 0);
     if (sock == INVALID_SOCKET) {
         cerr << "Ошибка создания сокета\n";
-#ifdef _WIN32
-        WSACleanup();
-#endif
-        return 1;
+        return INVALID_SOCKET;
     }
 
     sockaddr_in serverAddr{};
@@ -147,23 +373,97 @@ int client_main() {
         cerr << "inet_pton: некорректный IP-адрес\n";
 #ifdef _WIN32
         closesocket(sock);
-        WSACleanup();
 #else
         close(sock);
 #endif
-        return 1;
+        return INVALID_SOCKET;
     }
 
     if (connect(sock, (sockaddr*)&serverAddr, sizeof(serverAddr)) == SOCKET_ERROR) {
         cerr << "Не удалось подключиться к серверу " << ip << ":" << port << "\n";
 #ifdef _WIN32
         closesocket(sock);
-        WSACleanup();
 #else
         close(sock);
 #endif
+        return INVALID_SOCKET;
+    }
+    return sock;
+}
+
+int client_main() {
+#ifdef _WIN32
+    // консоль в UTF-8 для корректной кириллицы
+    SetConsoleOutputCP(CP_UTF8);
+    SetConsoleCP(CP_UTF8);
+
+    WSADATA wsa;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) {
+        cerr << "Ошибка инициализации Winsock\n";
         return 1;
     }
+#endif
+
+    // читаем ip/port из config.txt
+    auto cfg = loadConfig("config.txt");
+    string ip = "127.0.0.1";
+    int port = 5000;
+    int protocol = 1;
+    int compress = 0;
+    try { ip = cfg.at("ip"); }
+    catch (...) {}
+    try { port = stoi(cfg.at("port")); }
+    catch (...) {}
+    try { protocol = stoi(cfg.at("protocol")); }
+    catch (...) {}
+    try { compress = stoi(cfg.at("compress")); }
+    catch (...) {}
+    string transport = "tcp", unixPath;
+    size_t ringBytes = 1 << 20;
+    try { transport = cfg.at("transport"); }
+    catch (...) {}
+    try { unixPath = cfg.at("unix_socket"); }
+    catch (...) {}
+    try { ringBytes = static_cast<size_t>(stoul(cfg.at("shm_ring_bytes"))); }
+    catch (...) {}
+
+    SOCKET sock = INVALID_SOCKET;
+    if ((transport == "unix" || transport == "shm") && unixPath.empty()) {
+        cerr << "Для transport=" << transport << " задайте unix_socket в config.txt\n";
+    }
+    else if (transport == "unix" || transport == "shm") {
+        sock = connectLocal(unixPath);
+        if (sock == INVALID_SOCKET) cerr << "Не удалось подключиться к серверу через " << unixPath << "\n";
+    }
+    else {
+        sock = connectTcp(ip, port);
+    }
+    if (sock == INVALID_SOCKET) {
+#ifdef _WIN32
+        WSACleanup();
+#endif
+        return 1;
+    }
+
+    if (transport == "shm") {
+        // кольца просим самыми первыми; после ответа по сокету идут только звонки
+        unique_ptr<ShmLink> link = ShmLink::create(sock, ringBytes);
+        string reply;
+        if (!link) {
+            cerr << "Не удалось создать общую память — работаем через Unix-сокет\n";
+        }
+        else {
+            const string hello = SHM_HELLO " " + link->name() + "\n";
+            if (!sendAll(sock, hello.c_str(), (int)hello.size()) || !recvLine(sock, reply) ||
+                (reply != SHM_ACK && reply != SHM_NAK)) {
+                cerr << "Сервер не поддерживает общую память (transport=unix в config.txt)\n";
+                closeClient(sock);
+                return 1;
+            }
+            if (reply == SHM_ACK) shm = move(link);
+            else cerr << "Сервер отказал в общей памяти — работаем через Unix-сокет\n";
+        }
+    }
 
     // логин/пароль
     string login, password;
@@ -172,26 +472,60 @@ int client_main() {
     cout << "Введите пароль: ";
     getline(cin, password);
 
-    // отправляем с завершающим \n, чтобы сервер мог безопасно прочитать "линию"
-    string authData = login + ":" + password + "\n";
-    if (!sendAll(sock, authData.c_str(), (int)authData.size())) {
-        cerr << "Ошибка отправки авторизационных данных\n";
-#ifdef _WIN32
-        closesocket(sock);
-        WSACleanup();
-#else
-        close(sock);
-#endif
-        return 1;
+    if (compress && compressionAvailable()) {
+        // сжатие просим самым первым, до "CHAT/2" и логина; старый сервер примет
+        // эту строку за логин, поэтому ждём именно ответа на неё
+        string hello = COMPRESS_HELLO "\n", reply;
+        if (!sendAll(sock, hello.c_str(), (int)hello.size()) || !recvLine(sock, reply) ||
+            (reply != COMPRESS_ACK && reply != COMPRESS_NAK)) {
+            cerr << "Сервер не поддерживает сжатие (compress=0 в config.txt)\n";
+            closeClient(sock);
+            return 1;
+        }
+        if (reply == COMPRESS_ACK) {
+            inflater = make_unique<Inflater>();
+            if (!inflater->init()) {
+                cerr << "Ошибка инициализации сжатия\n";
+                closeClient(sock);
+                return 1;
+            }
+        }
     }
 
-    // ждём ответ (OK/FAIL) — читаем ровно до '\n'
-    string reply;
-    char ch;
-    while (true) {
-        int n = recv(sock, &ch, 1, 0);
-        if (n <= 0) {
+    if (protocol == 2) {
+        // договариваемся о кадрах; старый сервер примет "CHAT/2" за логин, поэтому ждём именно ACK
+        string hello = PROTO2_HELLO "\n", reply;
+        if (!sendAll(sock, hello.c_str(), (int)hello.size()) || !recvLine(sock, reply) || reply != PROTO2_ACK) {
+            cerr << "Сервер не поддерживает протокол 2\n";
+            closeClient(sock);
+            return 1;
+        }
+
+        string auth = FrameWriter(MsgType::Auth).str(login).str(password).bytes();
+        string frame;
+        uint8_t ok = 0;
+        uint32_t myId = 0;
+        if (!sendAll(sock, auth.c_str(), (int)auth.size()) || !recvFrame(sock, frame)) {
             cerr << "Ошибка: сервер не ответил\n";
+            closeClient(sock);
+            return 1;
+        }
+        FrameReader r(frame);
+        if (r.type() != MsgType::AuthResult || !r.u8(ok) || !r.u32(myId) || !ok) {
+            cerr << "Авторизация не удалась!\n";
+            closeClient(sock);
+            return 1;
+        }
+        {
+            lock_guard<mutex> lock(namesMutex);
+            names[myId] = login;
+        }
+    }
+    else {
+        // отправляем с завершающим \n, чтобы сервер мог безопасно прочитать "линию"
+        string authData = login + ":" + password + "\n";
+        if (!sendAll(sock, authData.c_str(), (int)authData.size())) {
+            cerr << "Ошибка отправки авторизационных данных\n";
 #ifdef _WIN32
             closesocket(sock);
             WSACleanup();
@@ -200,26 +534,43 @@ int client_main() {
 #endif
             return 1;
         }
-        if (ch == '\n') break;
-        if (ch != '\r') reply.push_back(ch);
-    }
 
-    if (reply.find("FAIL") != string::npos) {
-        cerr << "Авторизация не удалась!\n";
+        // ждём ответ (OK/FAIL) — читаем ровно до '\n'
+        string reply;
+        char ch;
+        while (true) {
+            int n = recvData(sock, &ch, 1);
+            if (n <= 0) {
+                cerr << "Ошибка: сервер не ответил\n";
 #ifdef _WIN32
-        closesocket(sock);
-        WSACleanup();
+                closesocket(sock);
+                WSACleanup();
 #else
-        close(sock);
+                close(sock);
 #endif
-        return 1;
+                return 1;
+            }
+            if (ch == '\n') break;
+            if (ch != '\r') reply.push_back(ch);
+        }
+
+        if (reply.find("FAIL") != string::npos) {
+            cerr << "Авторизация не удалась!\n";
+#ifdef _WIN32
+            closesocket(sock);
+            WSACleanup();
+#else
+            close(sock);
+#endif
+            return 1;
+        }
     }
 
     cout << "Авторизация успешна!\n";
     cout << "=== История чата ===\n";
 
     // запуск приёмника
-    thread receiver(receiveLoop, sock);
+    thread receiver(protocol == 2 ? receiveFrames : receiveLoop, sock);
 
     cout << "Теперь можно писать сообщения (exit для выхода):\n";
 
@@ -238,8 +589,9 @@ int client_main() {
             break;
         }
 
-        // отправляем каждое сообщение с '\n' (протокол «построчно»)
-        msg.push_back('\n');
+        // протокол 1: каждое сообщение с '\n' («построчно»); протокол 2: один кадр
+        if (protocol == 2) msg = encodeInput(msg);
+        else msg.push_back('\n');
         if (!sendAll(sock, msg.c_str(), (int)msg.size())) {
             cerr << "\nОшибка отправки. Соединение разорвано?\n";
             running = false;
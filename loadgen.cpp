@@ -0,0 +1,481 @@
+﻿// loadgen.cpp
+// Генератор нагрузки: открывает loadgen_clients соединений с сервером по обычному
+// строковому протоколу (login:password, потом строки) и шлёт смесь общих сообщений,
+// /w и /users. В каждом сообщении — время отправки, так что задержку доставки
+// меряет сам получатель: отправитель и получатели живут в одном процессе,
+// часы у них общие.
+#include "loadgen.h"
+#include "Config.h"
+#include "EventLoop.h"
+#include "LineFramer.h"
+#include "NetUtils.h"
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <cstdlib>
+
+#ifndef _WIN32
+#include <csignal>
+#endif
+
+using namespace std;
+
+namespace {
+
+struct LoadConfig {
+    string ip = "127.0.0.1";
+    int port = 5000;
+    string backend = "auto";
+    string prefix = "lg";     // логины prefix0..prefixN-1, пароль тот же
+    size_t clients = 1000;
+    size_t threads = 2;
+    int seconds = 30;
+    double rate = 1;          // сообщений в секунду от каждого клиента
+    unsigned wPublic = 80;    // доли действий
+    unsigned wPrivate = 15;
+    unsigned wUsers = 5;
+    size_t payload = 32;      // длина текста сообщения
+    double connectRate = 500; // подключений в секунду на поток (0 — без паузы)
+    uint32_t run = 0;         // метка прогона: чужие и старые сообщения из истории не считаем
+};
+
+// Гистограмма задержек в микросекундах: до 64 мкс — точно, дальше по 32 корзины
+// на каждую степень двойки (ошибка не больше 1/32). Память постоянная,
+// сколько бы доставок ни было.
+class LatencyHistogram {
+public:
+    LatencyHistogram() : counts(64 + 40 * 32, 0) {}
+
+    void add(uint64_t us) {
+        counts[min(bucketOf(us), counts.size() - 1)]++;
+        total++;
+        maxUs = max(maxUs, us);
+    }
+
+    void merge(const LatencyHistogram& o) {
+        for (size_t i = 0; i < counts.size(); i++) counts[i] += o.counts[i];
+        total += o.total;
+        maxUs = max(maxUs, o.maxUs);
+    }
+
+    uint64_t count() const { return total; }
+    uint64_t maxValue() const { return maxUs; }
+
+    // верхняя граница корзины, в которую попал p-й перцентиль (p от 0 до 1)
+    uint64_t percentile(double p) const {
+        if (total == 0) return 0;
+        const uint64_t rank = max<uint64_t>(1, (uint64_t)(p * (double)total + 0.5));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < counts.size(); i++) {
+            seen += counts[i];
+            if (seen >= rank) return min(bucketTop(i), maxUs);
+        }
+        return maxUs;
+    }
+
+private:
+    static size_t bucketOf(uint64_t v) {
+        if (v < 64) return (size_t)v;
+        int msb = 6;
+        while ((v >> (msb + 1)) != 0) msb++;
+        const int shift = msb - 5; // v >> shift — от 32 до 63
+        return 64 + (size_t)(shift - 1) * 32 + (size_t)((v >> shift) - 32);
+    }
+
+    static uint64_t bucketTop(size_t b) {
+        if (b < 64) return b;
+        const int shift = (int)((b - 64) / 32) + 1;
+        const uint64_t sub = (b - 64) % 32 + 32;
+        return ((sub + 1) << shift) - 1;
+    }
+
+    vector<uint64_t> counts;
+    uint64_t total = 0;
+    uint64_t maxUs = 0;
+};
+
+// 0 — подключаемся, 1 — шлём и меряем, 2 — не шлём, дочитываем отставшее, 3 — выход
+atomic<int> phase{ 0 };
+
+struct LoadStats {
+    atomic<uint64_t> ready{ 0 };       // вошли и получили историю
+    atomic<uint64_t> failed{ 0 };      // не подключились, FAIL или обрыв
+    atomic<uint64_t> sentPublic{ 0 };
+    atomic<uint64_t> sentPrivate{ 0 };
+    atomic<uint64_t> sentUsers{ 0 };
+    atomic<uint64_t> delivered{ 0 };   // получено чужих сообщений этого прогона
+    atomic<uint64_t> usersReplies{ 0 };
+};
+
+const chrono::steady_clock::time_point epoch = chrono::steady_clock::now();
+
+uint64_t nowUs() {
+    return (uint64_t)chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - epoch).count();
+}
+
+struct LgClient {
+    SOCKET sock = INVALID_SOCKET;
+    size_t idx = 0;
+    LineFramer in{ 2048 }; // от сервера нам нужны только короткие строки
+    string out;            // что сокет не принял сразу
+    bool ready = false;    // пришёл первый [END] — история и список позади
+    uint64_t nextSend = 0; // мкс от epoch
+};
+
+class LoadWorker {
+public:
+    LoadWorker(const LoadConfig& lc, LoadStats& st, size_t first, size_t count)
+        : lc(lc), st(st), first(first), count(count), rng((uint32_t)(lc.run + first)) {}
+
+    void run();
+    const LatencyHistogram& latency() const { return hist; }
+
+private:
+    bool connectOne(size_t idx);
+    void handle(const vector<IoEvent>& events, int n);
+    void dropDead();
+    void onReadable(LgClient& c);
+    void onLine(LgClient& c, string_view line);
+    void sendSome(LgClient& c, uint64_t now);
+    void push(LgClient& c, string s);
+    bool flush(LgClient& c);
+    void drop(LgClient& c);
+
+    const LoadConfig& lc;
+    LoadStats& st;
+    size_t first, count;
+    mt19937 rng;
+    unique_ptr<EventLoop> loop;
+    unordered_map<SOCKET, LgClient> clients;
+    vector<SOCKET> dead;
+    LatencyHistogram hist;
+};
+
+bool LoadWorker::connectOne(size_t idx) {
+    SOCKET s = socket(AF_INET, SOCK_STREAM, 0);
+    if (s == INVALID_SOCKET) return false;
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<uint16_t>(lc.port));
+    if (
+#ifdef _WIN32
+        InetPtonA(AF_INET, lc.ip.c_str(), &addr.sin_addr)
+#else
+        inet_pton(AF_INET, lc.ip.c_str(), &addr.sin_addr)
+#endif
+        != 1 || connect(s, (sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR) {
+        closeSocket(s);
+        return false;
+    }
+    setNonBlocking(s);
+    if (!loop->add(s, IO_READ)) {
+        closeSocket(s);
+        return false;
+    }
+
+    LgClient& c = clients[s];
+    c.sock = s;
+    c.idx = idx;
+    const string login = lc.prefix + to_string(idx);
+    push(c, login + ":" + login + "\n");
+    return true;
+}
+
+void LoadWorker::push(LgClient& c, string s) {
+    const bool wasEmpty = c.out.empty();
+    c.out += s;
+    if (!flush(c)) {
+        dead.push_back(c.sock);
+        return;
+    }
+    if (wasEmpty && !c.out.empty()) loop->modify(c.sock, IO_READ | IO_WRITE);
+}
+
+bool LoadWorker::flush(LgClient& c) {
+    size_t off = 0;
+    while (off < c.out.size()) {
+        int n = send(c.sock, c.out.data() + off, (int)(c.out.size() - off), 0);
+        if (n > 0) {
+            off += (size_t)n;
+            continue;
+        }
+        if (n < 0 && lastErrorWouldBlock()) break;
+        return false;
+    }
+    c.out.erase(0, off);
+    return true;
+}
+
+void LoadWorker::drop(LgClient& c) {
+    if (c.ready) st.ready--;
+    st.failed++;
+    loop->remove(c.sock);
+    closeSocket(c.sock);
+    clients.erase(c.sock);
+}
+
+void LoadWorker::onReadable(LgClient& c) {
+    // бэкенд может быть edge-triggered: читаем до EWOULDBLOCK
+    while (true) {
+        auto [buf, room] = c.in.writable();
+        if (room == 0) break; // строка длиннее кольца — LineFramer её обрежет
+        int n = recv(c.sock, buf, (int)room, 0);
+        if (n > 0) {
+            c.in.commit((size_t)n);
+            string_view line;
+            while (c.in.next(line)) onLine(c, line);
+            continue;
+        }
+        if (n < 0 && lastErrorWouldBlock()) return;
+        dead.push_back(c.sock);
+        return;
+    }
+}
+
+void LoadWorker::onLine(LgClient& c, string_view line) {
+    if (line == "[PING]") {
+        push(c, "/pong\n");
+        return;
+    }
+    if (line == "FAIL") {
+        dead.push_back(c.sock);
+        return;
+    }
+    if (line == "[END]") {
+        // первый [END] — конец списка после истории, дальше — ответы на /users
+        if (!c.ready) {
+            c.ready = true;
+            st.ready++;
+        }
+        else {
+            st.usersReplies++;
+        }
+        return;
+    }
+
+    // "[lg3] LG run from t ..." или "[lg3 -> lg7] LG run from t ..."
+    const size_t pos = line.find("] LG ");
+    if (pos == string_view::npos) return;
+    const string tail(line.substr(pos + 5));
+    char* end = nullptr;
+    const unsigned long run = strtoul(tail.c_str(), &end, 10);
+    const unsigned long long from = strtoull(end, &end, 10);
+    const unsigned long long sentAt = strtoull(end, &end, 10);
+    // своё эхо /w и сообщения других прогонов из истории не считаем
+    if (run != lc.run || from == c.idx) return;
+
+    const uint64_t now = nowUs();
+    if (sentAt > now) return;
+    hist.add(now - sentAt);
+    st.delivered++;
+}
+
+void LoadWorker::sendSome(LgClient& c, uint64_t now) {
+    const uint64_t interval = (uint64_t)(1e6 / lc.rate);
+    const unsigned total = lc.wPublic + lc.wPrivate + lc.wUsers;
+    while (c.nextSend <= now) {
+        c.nextSend += interval;
+
+        const unsigned pick = uniform_int_distribution<unsigned>(0, total - 1)(rng);
+        if (pick >= lc.wPublic + lc.wPrivate) {
+            st.sentUsers++;
+            push(c, "/users\n");
+            continue;
+        }
+
+        string text = "LG " + to_string(lc.run) + " " + to_string(c.idx) + " " + to_string(nowUs());
+        if (text.size() < lc.payload) text.append(lc.payload - text.size(), 'x');
+        if (pick < lc.wPublic || lc.clients < 2) {
+            st.sentPublic++;
+            push(c, text + "\n");
+            continue;
+        }
+        size_t to = uniform_int_distribution<size_t>(0, lc.clients - 2)(rng);
+        if (to >= c.idx) to++; // кому угодно, кроме себя
+        st.sentPrivate++;
+        push(c, "/w " + lc.prefix + to_string(to) + " " + text + "\n");
+    }
+}
+
+void LoadWorker::handle(const vector<IoEvent>& events, int n) {
+    for (int i = 0; i < n; i++) {
+        auto it = clients.find(events[i].sock);
+        if (it == clients.end()) continue;
+        LgClient& c = it->second;
+        if (events[i].flags & (IO_READ | IO_ERROR)) onReadable(c);
+        if ((events[i].flags & IO_WRITE) && !c.out.empty()) {
+            if (!flush(c)) dead.push_back(c.sock);
+            else if (c.out.empty()) loop->modify(c.sock, IO_READ);
+        }
+    }
+}
+
+// закрываем только здесь: обработчики строк держат ссылки на клиентов
+void LoadWorker::dropDead() {
+    for (SOCKET s : dead) {
+        auto it = clients.find(s);
+        if (it != clients.end()) drop(it->second);
+    }
+    dead.clear();
+}
+
+void LoadWorker::run() {
+    loop = makeEventLoop(lc.backend);
+
+    // подключаемся с паузами, чтобы не упереться в очередь accept и лимиты входа
+    const auto pause = lc.connectRate > 0
+        ? chrono::microseconds((long long)(1e6 / lc.connectRate)) : chrono::microseconds(0);
+    vector<IoEvent> events;
+    for (size_t i = 0; i < count && phase.load() < 3; i++) {
+        if (!connectOne(first + i)) st.failed++;
+        // пока подключаем остальных, уже вошедшие получают историю
+        handle(events, loop->wait(events, 0));
+        dropDead();
+        if (pause.count() > 0) this_thread::sleep_for(pause);
+    }
+
+    bool scheduled = false;
+    while (phase.load() < 3) {
+        handle(events, loop->wait(events, 5));
+
+        if (phase.load() == 1 && lc.rate > 0) {
+            const uint64_t now = nowUs();
+            if (!scheduled) {
+                // первые отправки размазаны по интервалу, а не все в одну миллисекунду
+                const uint64_t interval = (uint64_t)(1e6 / lc.rate);
+                for (auto& kv : clients) {
+                    kv.second.nextSend = now + uniform_int_distribution<uint64_t>(0, interval)(rng);
+                }
+                scheduled = true;
+            }
+            for (auto& kv : clients) {
+                if (kv.second.ready) sendSome(kv.second, now);
+            }
+        }
+
+        dropDead();
+    }
+
+    for (auto& kv : clients) {
+        loop->remove(kv.first);
+        closeSocket(kv.first);
+    }
+    clients.clear();
+}
+
+} // namespace
+
+int loadgen_main() {
+#ifdef _WIN32
+    WSADATA wsaData;
+    WSAStartup(MAKEWORD(2, 2), &wsaData);
+#else
+    signal(SIGPIPE, SIG_IGN);
+#endif
+
+    auto cfg = loadConfig("config.txt");
+    LoadConfig lc;
+    try { lc.ip = cfg.at("ip"); }
+    catch (...) {}
+    try { lc.port = stoi(cfg.at("port")); }
+    catch (...) {}
+    try { lc.backend = cfg.at("event_loop"); }
+    catch (...) {}
+    try { lc.prefix = cfg.at("loadgen_prefix"); }
+    catch (...) {}
+    try { lc.clients = static_cast<size_t>(stoul(cfg.at("loadgen_clients"))); }
+    catch (...) {}
+    try { lc.threads = max<size_t>(1, stoul(cfg.at("loadgen_threads"))); }
+    catch (...) {}
+    try { lc.seconds = stoi(cfg.at("loadgen_seconds")); }
+    catch (...) {}
+    try { lc.rate = stod(cfg.at("loadgen_rate")); }
+    catch (...) {}
+    try { lc.wPublic = static_cast<unsigned>(stoul(cfg.at("loadgen_public"))); }
+    catch (...) {}
+    try { lc.wPrivate = static_cast<unsigned>(stoul(cfg.at("loadgen_private"))); }
+    catch (...) {}
+    try { lc.wUsers = static_cast<unsigned>(stoul(cfg.at("loadgen_users"))); }
+    catch (...) {}
+    try { lc.payload = static_cast<size_t>(stoul(cfg.at("loadgen_payload"))); }
+    catch (...) {}
+    try { lc.connectRate = stod(cfg.at("loadgen_connect_rate")); }
+    catch (...) {}
+    if (lc.wPublic + lc.wPrivate + lc.wUsers == 0) lc.wPublic = 1;
+    lc.threads = min(lc.threads, max<size_t>(1, lc.clients));
+    lc.run = random_device{}();
+
+    raiseFdLimit();
+    cout << "[Нагрузка] " << lc.clients << " клиентов в " << lc.threads << " потоках на "
+        << lc.ip << ":" << lc.port << ", " << lc.rate << " сообщ./с на клиента, смесь "
+        << lc.wPublic << "/" << lc.wPrivate << "/" << lc.wUsers << " (общие / /w / /users)\n";
+
+    phase = 0;
+    LoadStats st;
+    vector<unique_ptr<LoadWorker>> workers;
+    vector<thread> pool;
+    for (size_t i = 0; i < lc.threads; i++) {
+        const size_t first = lc.clients * i / lc.threads;
+        const size_t last = lc.clients * (i + 1) / lc.threads;
+        workers.push_back(make_unique<LoadWorker>(lc, st, first, last - first));
+    }
+    for (auto& w : workers) pool.emplace_back([&w]() { w->run(); });
+
+    // ждём, пока все войдут (или отвалятся); зависшие не держат тест дольше минуты
+    const auto connectDeadline = chrono::steady_clock::now() + chrono::seconds(60);
+    while (st.ready.load() + st.failed.load() < lc.clients && chrono::steady_clock::now() < connectDeadline) {
+        this_thread::sleep_for(chrono::milliseconds(100));
+    }
+    cout << "[Нагрузка] в сети " << st.ready.load() << ", ошибок " << st.failed.load() << "\n";
+
+    auto sentTotal = [&]() { return st.sentPublic.load() + st.sentPrivate.load() + st.sentUsers.load(); };
+    phase = 1;
+    const auto start = chrono::steady_clock::now();
+    uint64_t lastSent = 0, lastDelivered = 0;
+    for (int sec = 1; sec <= lc.seconds; sec++) {
+        this_thread::sleep_until(start + chrono::seconds(sec));
+        const uint64_t sent = sentTotal(), delivered = st.delivered.load();
+        cout << "[Нагрузка] " << sec << " с: отправлено " << sent - lastSent << "/с, доставлено "
+            << delivered - lastDelivered << "/с, в сети " << st.ready.load() << "\n";
+        lastSent = sent;
+        lastDelivered = delivered;
+    }
+    const double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    // дочитываем то, что уже в пути, — иначе хвост задержек потеряется
+    phase = 2;
+    this_thread::sleep_for(chrono::seconds(1));
+    phase = 3;
+    for (auto& t : pool) t.join();
+
+    LatencyHistogram hist;
+    for (const auto& w : workers) hist.merge(w->latency());
+
+    auto ms = [](uint64_t us) { return (double)us / 1000.0; };
+    cout << fixed << setprecision(2);
+    cout << "\n=== Итог нагрузочного теста (" << elapsed << " с) ===\n";
+    cout << "Клиентов: " << lc.clients << ", в сети в конце " << st.ready.load()
+        << ", ошибок/обрывов " << st.failed.load() << "\n";
+    cout << "Отправлено: " << sentTotal() << " (" << (double)sentTotal() / elapsed << "/с) — общих "
+        << st.sentPublic.load() << ", личных " << st.sentPrivate.load() << ", /users " << st.sentUsers.load() << "\n";
+    cout << "Доставлено: " << st.delivered.load() << " (" << (double)st.delivered.load() / elapsed
+        << "/с), ответов /users: " << st.usersReplies.load() << "\n";
+    cout << "Задержка доставки, мс: p50 " << ms(hist.percentile(0.50)) << ", p99 " << ms(hist.percentile(0.99))
+        << ", p999 " << ms(hist.percentile(0.999)) << ", max " << ms(hist.maxValue()) << "\n";
+    cout.unsetf(ios::floatfield);
+
+#ifdef _WIN32
+    WSACleanup();
+#endif
+    return 0;
+}
@@ -0,0 +1,5 @@
+﻿//loadgen.h
+#pragma once
+
+// нагрузочный тест сервера: тысячи клиентов протокола 1 из одного процесса
+int loadgen_main();
@@ -7,6 +7,8 @@
 #include "Config.h"
 #include "server.h"
 #include "client.h"
+#include "loadgen.h"
+#include "selftest.h"
 
 #include <iostream>
 #include <map>
@@ -26,6 +28,8 @@ int main() {
         cout << "1 - Локальный чат" << endl;
         cout << "2 - Сервер" << endl;
         cout << "3 - Клиент" << endl;
+        cout << "4 - Нагрузочный тест сервера" << endl;
+        cout << "5 - Самопроверка сервера" << endl;
         cout << "0 - Выход" << endl;
 
         int choice;
@@ -52,6 +56,14 @@ int main() {
             cout << "Запуск клиента..." << endl;
             client_main();
             break;
+        case 4:
+            cout << "Запуск нагрузочного теста..." << endl;
+            loadgen_main();
+            break;
+        case 5:
+            cout << "Запуск самопроверки..." << endl;
+            selftest_main();
+            break;
         default:
             cout << "Неверный выбор, попробуйте ещё раз." << endl;
         }
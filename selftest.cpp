@@ -0,0 +1,319 @@
+﻿// selftest.cpp
+// Самопроверка сервера по ip/port из config.txt. Сервер запускается отдельно;
+// каждая проверка открывает свои соединения, делает то, на чём сервер уже
+// однажды падал или ошибался, и печатает OK/FAIL. Логины — со случайным
+// хвостом, так что проверку можно гонять сколько угодно раз на одной БД.
+#include "selftest.h"
+#include "Config.h"
+#include "NetUtils.h"
+#include "Protocol.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <random>
+#include <functional>
+#include <set>
+#include <thread>
+#include <chrono>
+
+#ifndef _WIN32
+#include <csignal>
+#include <sys/time.h>
+#endif
+
+using namespace std;
+
+namespace {
+
+struct Target {
+    string ip = "127.0.0.1";
+    int port = 5000;
+};
+
+// сколько ждём ответа сервера, прежде чем счесть проверку проваленной
+static const int REPLY_TIMEOUT_SEC = 5;
+
+SOCKET dial(const Target& t) {
+    SOCKET s = socket(AF_INET, SOCK_STREAM, 0);
+    if (s == INVALID_SOCKET) return INVALID_SOCKET;
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<uint16_t>(t.port));
+    if (
+#ifdef _WIN32
+        InetPtonA(AF_INET, t.ip.c_str(), &addr.sin_addr)
+#else
+        inet_pton(AF_INET, t.ip.c_str(), &addr.sin_addr)
+#endif
+        != 1 || connect(s, (sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR) {
+        closeSocket(s);
+        return INVALID_SOCKET;
+    }
+    // зависший сервер не должен вешать всю самопроверку
+#ifdef _WIN32
+    DWORD tv = REPLY_TIMEOUT_SEC * 1000;
+#else
+    timeval tv{ REPLY_TIMEOUT_SEC, 0 };
+#endif
+    setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv, sizeof(tv));
+    return s;
+}
+
+bool sendAll(SOCKET s, const string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        int rc = send(s, data.data() + sent, (int)(data.size() - sent), 0);
+        if (rc == SOCKET_ERROR || rc == 0) return false;
+        sent += (size_t)rc;
+    }
+    return true;
+}
+
+bool recvAll(SOCKET s, char* data, size_t len) {
+    size_t got = 0;
+    while (got < len) {
+        int n = recv(s, data + got, (int)(len - got), 0);
+        if (n <= 0) return false;
+        got += (size_t)n;
+    }
+    return true;
+}
+
+bool recvLine(SOCKET s, string& line) {
+    line.clear();
+    char ch;
+    while (recvAll(s, &ch, 1)) {
+        if (ch == '\n') return true;
+        if (ch != '\r') line.push_back(ch);
+    }
+    return false;
+}
+
+bool recvFrame(SOCKET s, string& frame) {
+    unsigned char hdr[FRAME_HEADER];
+    if (!recvAll(s, reinterpret_cast<char*>(hdr), FRAME_HEADER)) return false;
+    const size_t len = (size_t(hdr[0]) << 24) | (size_t(hdr[1]) << 16) | (size_t(hdr[2]) << 8) | hdr[3];
+    if (len == 0 || len > MAX_FRAME) return false;
+    frame.resize(len);
+    return recvAll(s, &frame[0], len);
+}
+
+// сервер сам закрыл соединение: дочитываем до конца потока
+bool closedByServer(SOCKET s) {
+    char buf[512];
+    while (true) {
+        int n = recv(s, buf, (int)sizeof(buf), 0);
+        if (n == 0) return true;
+        if (n < 0) return false; // таймаут или ошибка — сервер держит соединение
+    }
+}
+
+// соединение протокола 2 после рукопожатия; INVALID_SOCKET — сервер не ответил как надо
+SOCKET dialV2(const Target& t) {
+    SOCKET s = dial(t);
+    if (s == INVALID_SOCKET) return INVALID_SOCKET;
+    string ack;
+    if (!sendAll(s, PROTO2_HELLO "\n") || !recvLine(s, ack) || ack != PROTO2_ACK) {
+        closeSocket(s);
+        return INVALID_SOCKET;
+    }
+    return s;
+}
+
+// ответ на вход протокола 2: true — сервер прислал AuthResult с результатом ok
+bool readAuthResult(SOCKET s, bool& ok) {
+    string frame;
+    if (!recvFrame(s, frame)) return false;
+    FrameReader r(frame);
+    uint8_t flag = 0;
+    if (r.type() != MsgType::AuthResult || !r.u8(flag)) return false;
+    ok = flag != 0;
+    return true;
+}
+
+bool loginV2(SOCKET s, const string& login) {
+    bool ok = false;
+    return sendAll(s, FrameWriter(MsgType::Auth).str(login).str(login).bytes()) && readAuthResult(s, ok) && ok;
+}
+
+// ждём кадр Error, пропуская историю, список и присутствие; false — так и не пришёл
+bool awaitError(SOCKET s, uint16_t& code) {
+    string frame;
+    while (recvFrame(s, frame)) {
+        FrameReader r(frame);
+        if (r.type() == MsgType::Error) return r.u16(code);
+    }
+    return false;
+}
+
+string uniqueLogin(const string& prefix) {
+    static mt19937 rng(random_device{}());
+    return prefix + to_string(rng() % 1000000000u);
+}
+
+// первым кадром протокола 2 пришёл не вход (или вход без логина):
+// сервер обязан отказать, закрыть соединение и дальше работать как ни в чём не бывало
+bool checkBadFirstFrame(const Target& t) {
+    const vector<string> firstFrames = {
+        FrameWriter(MsgType::PublicMsg).str("привет").bytes(),
+        FrameWriter(MsgType::Auth).str("").str("pass").bytes(),
+    };
+    for (const auto& first : firstFrames) {
+        SOCKET s = dialV2(t);
+        if (s == INVALID_SOCKET) return false;
+        bool ok = true;
+        const bool rejected = sendAll(s, first) && readAuthResult(s, ok) && !ok && closedByServer(s);
+        closeSocket(s);
+        if (!rejected) return false;
+    }
+
+    SOCKET s = dialV2(t);
+    if (s == INVALID_SOCKET) return false;
+    const bool alive = loginV2(s, uniqueLogin("selftest"));
+    closeSocket(s);
+    return alive;
+}
+
+// метку конца отложенных личных (OFFLINE_MARK) нельзя собрать ни логином, ни текстом,
+// а /ack принимает только голое число — иначе чужой клиент подтвердит за нас всю очередь
+bool checkOfflineMarkSpoof(const Target& t) {
+    SOCKET s = dial(t);
+    if (s == INVALID_SOCKET) return false;
+    string reply;
+    const bool loginRefused = sendAll(s, OFFLINE_MARK "999999:pw\n") && recvLine(s, reply) && reply == "FAIL";
+    closeSocket(s);
+    if (!loginRefused) return false;
+
+    s = dialV2(t);
+    if (s == INVALID_SOCKET) return false;
+    uint16_t code = 0;
+    const bool textRefused = loginV2(s, uniqueLogin("selftest"))
+        && sendAll(s, FrameWriter(MsgType::PublicMsg).str("x\n" OFFLINE_MARK "999999").bytes())
+        && awaitError(s, code) && code == ERR_USAGE;
+    const bool ackRefused = textRefused
+        && sendAll(s, FrameWriter(MsgType::Command).str("/ack 999999]").bytes())
+        && awaitError(s, code) && code == ERR_USAGE;
+    closeSocket(s);
+    return ackRefused;
+}
+
+// разбор одного кадра UserList/Online; false — кадр битый
+bool readListFrame(const string& frame, set<string>& logins, bool& more) {
+    FrameReader r(frame);
+    uint8_t flag = 0;
+    uint32_t count = 0, id = 0;
+    string_view login;
+    if (!r.u8(flag) || !r.u32(count)) return false;
+    for (uint32_t i = 0; i < count; i++) {
+        if (!r.u32(id) || !r.str(login)) return false;
+        logins.emplace(login);
+    }
+    more = flag != 0;
+    return true;
+}
+
+// каталог и список «в сети» длиннее MAX_FRAME: сервер обязан порезать их на кадры,
+// а не слать один огромный, который клиент отвергнет и отключится
+bool checkLargeUserList(const Target& t) {
+    // логины максимальной длины — так в один кадр влезает меньше тысячи записей
+    const size_t CROWD = 1200;
+    const string prefix = uniqueLogin("selftest") + "_";
+    vector<string> logins;
+    for (size_t i = 0; i < CROWD; i++) {
+        string tail = to_string(i);
+        logins.push_back(prefix + string(MAX_LOGIN - prefix.size() - tail.size(), 'x') + tail);
+    }
+
+    raiseFdLimit();
+    vector<SOCKET> crowd;
+    auto closeCrowd = [&crowd] { for (SOCKET s : crowd) closeSocket(s); };
+    // сначала все входы разом, потом ответы — иначе тысяча проверок пароля по очереди
+    for (const auto& login : logins) {
+        SOCKET s = dial(t);
+        if (s == INVALID_SOCKET || !sendAll(s, login + ":" + login + "\n")) {
+            if (s != INVALID_SOCKET) closeSocket(s);
+            closeCrowd();
+            return false;
+        }
+        crowd.push_back(s);
+    }
+    for (SOCKET s : crowd) {
+        string reply;
+        if (!recvLine(s, reply) || reply != "OK") {
+            closeCrowd();
+            return false;
+        }
+    }
+    // присутствие рассылается окнами — даём последнему окну закрыться
+    this_thread::sleep_for(chrono::seconds(1));
+
+    SOCKET s = dialV2(t);
+    bool ok = s != INVALID_SOCKET && loginV2(s, uniqueLogin("selftest"));
+    set<string> users, online;
+    size_t userFrames = 0, onlineFrames = 0;
+    bool usersDone = false, onlineDone = false;
+    string frame;
+    while (ok && !(usersDone && onlineDone) && recvFrame(s, frame)) {
+        const MsgType type = FrameReader(frame).type();
+        bool more = false;
+        if (type == MsgType::UserList && !usersDone) {
+            ok = readListFrame(frame, users, more);
+            userFrames++;
+            usersDone = !more;
+        }
+        else if (type == MsgType::Online && !onlineDone) {
+            ok = readListFrame(frame, online, more);
+            onlineFrames++;
+            onlineDone = !more;
+        }
+    }
+    ok = ok && usersDone && onlineDone && userFrames > 1 && onlineFrames > 1;
+    for (const auto& login : logins) ok = ok && users.count(login) && online.count(login);
+    if (s != INVALID_SOCKET) closeSocket(s);
+    closeCrowd();
+    return ok;
+}
+
+} // namespace
+
+int selftest_main() {
+#ifdef _WIN32
+    WSADATA wsaData;
+    WSAStartup(MAKEWORD(2, 2), &wsaData);
+#else
+    signal(SIGPIPE, SIG_IGN);
+#endif
+
+    auto cfg = loadConfig("config.txt");
+    Target t;
+    try { t.ip = cfg.at("ip"); }
+    catch (...) {}
+    try { t.port = stoi(cfg.at("port")); }
+    catch (...) {}
+
+    struct Check {
+        const char* name;
+        function<bool(const Target&)> run;
+    };
+    const vector<Check> checks = {
+        { "кривой первый кадр протокола 2", checkBadFirstFrame },
+        { "подделка метки OFFLINE", checkOfflineMarkSpoof },
+        { "список пользователей больше кадра", checkLargeUserList },
+    };
+
+    cout << "[Проверка] сервер " << t.ip << ":" << t.port << "\n";
+    size_t failed = 0;
+    for (const auto& check : checks) {
+        const bool ok = check.run(t);
+        if (!ok) failed++;
+        cout << "[Проверка] " << check.name << ": " << (ok ? "OK" : "FAIL") << "\n";
+    }
+    cout << "[Проверка] пройдено " << checks.size() - failed << " из " << checks.size() << "\n";
+
+#ifdef _WIN32
+    WSACleanup();
+#endif
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,6 @@
+﻿//selftest.h
+#pragma once
+
+// самопроверка запущенного сервера: шлёт ему заведомо неудобные вещи
+// (кривой первый кадр и т.п.) и смотрит, что он ответил и остался жив
+int selftest_main();
@@ -6,54 +6,50 @@
 #include <string>
 #include <map>
 #include <vector>
-#include <unordered_map>
-#include <sstream>
-#include <cstring>      // ← для strlen
+#include <thread>
+#include <algorithm>
 #include "Database.h"
 #include "Config.h"     // для port и max_message_length
+#include "NetUtils.h"
+#include "EventLoop.h"
+#include "Reactor.h"
+#include "Handoff.h"
+#include "LocalTransport.h"
 
 #ifdef _WIN32
-#include <winsock2.h>
-#include <ws2tcpip.h>
 #pragma comment(lib, "ws2_32.lib")
 #else
-#include <sys/types.h>
-#include <sys/socket.h>
-#include <netinet/in.h>
-#include <arpa/inet.h>
-#include <unistd.h>
-#define SOCKET int
-#define INVALID_SOCKET -1
-#define SOCKET_ERROR -1
+#include <csignal>
 #endif
 
 using namespace std;
 
-// теперь не const, чтобы можно было подхватить значение из конфига
-static size_t MAX_MSG_LEN = 200;
+// слушающий сокет; с reusePort каждый реактор открывает свой, и ядро само
+// раскидывает входящие соединения между ними
+static SOCKET openListener(int port, bool reusePort) {
+    SOCKET s = socket(AF_INET, SOCK_STREAM, 0);
+    if (s == INVALID_SOCKET) return INVALID_SOCKET;
 
-// мапим логин -> сокет (для личных сообщений)
-static unordered_map<string, SOCKET> loginToSock;
+    int one = 1;
+#ifdef SO_REUSEPORT
+    if (reusePort) setsockopt(s, SOL_SOCKET, SO_REUSEPORT, (const char*)&one, sizeof(one));
+#else
+    (void)reusePort;
+    (void)one;
+#endif
 
-// аккуратно обрезаем пробелы/CR/LF по краям
-static inline std::string trim_copy(const std::string& s) {
-    const auto b = s.find_first_not_of(" \t\r\n");
-    if (b == std::string::npos) return "";
-    const auto e = s.find_last_not_of(" \t\r\n");
-    return s.substr(b, e - b + 1);
-}
+    sockaddr_in serverAddr{};
+    serverAddr.sin_family = AF_INET;
+    serverAddr.sin_port = htons(static_cast<uint16_t>(port));
+    serverAddr.sin_addr.s_addr = INADDR_ANY;
 
-// отправка списка пользователей конкретному клиенту
-static void sendUsersListTo(SOCKET client, Database& db) {
-    auto users = db.getAllUsers();
-    string start = "[USERS]\n";
-    send(client, start.c_str(), (int)start.size(), 0);
-    for (const auto& u : users) {
-        string line = u + "\n";
-        send(client, line.c_str(), (int)line.size(), 0);
+    if (bind(s, (sockaddr*)&serverAddr, sizeof(serverAddr)) == SOCKET_ERROR) {
+        closeSocket(s);
+        return INVALID_SOCKET;
     }
-    string end = "[END]\n";
-    send(client, end.c_str(), (int)end.size(), 0);
+    listen(s, SOMAXCONN);
+    setNonBlocking(s);
+    return s;
 }
 
 int server_main() {
@@ -62,13 +58,24 @@ int server_main() {
     WSAStartup(MAKEWORD(2, 2), &wsaData);
 #endif
 
-    // читаем конфиг (порт и лимит длины сообщений)
+    // читаем конфиг (порт, лимит длины сообщений, бэкенд цикла событий, таймаут входа, потоки)
     auto cfg = loadConfig("config.txt");
     int port = 5000;
+    string backend = "auto";
+    long authTimeoutMs = 10000;
+    size_t threads = 1;
+    size_t maxMsgLen = 200;
     try { port = stoi(cfg.at("port")); }
     catch (...) {}
-    try { MAX_MSG_LEN = static_cast<size_t>(stoul(cfg.at("max_message_length"))); }
+    try { maxMsgLen = static_cast<size_t>(stoul(cfg.at("max_message_length"))); }
+    catch (...) {}
+    try { backend = cfg.at("event_loop"); }
+    catch (...) {}
+    try { authTimeoutMs = stol(cfg.at("auth_timeout_ms")); }
     catch (...) {}
+    try { threads = static_cast<size_t>(stoul(cfg.at("reactor_threads"))); }
+    catch (...) {}
+    if (threads == 0) threads = max(1u, thread::hardware_concurrency());
 
     // БД
     Database db("chat.db");
@@ -77,267 +84,211 @@ int server_main() {
         return 1;
     }
 
-    SOCKET serverSock = socket(AF_INET, SOCK_STREAM, 0);
-    if (serverSock == INVALID_SOCKET) {
-        cerr << "Ошибка создания сокета!" << endl;
-        return 1;
-    }
-
-    sockaddr_in serverAddr{};
-    serverAddr.sin_family = AF_INET;
-    serverAddr.sin_port = htons(static_cast<uint16_t>(port));
-    serverAddr.sin_addr.s_addr = INADDR_ANY;
-
-    if (bind(serverSock, (sockaddr*)&serverAddr, sizeof(serverAddr)) == SOCKET_ERROR) {
-        cerr << "Ошибка bind!" << endl;
-#ifdef _WIN32
-        closesocket(serverSock);
-        WSACleanup();
-#else
-        close(serverSock);
+    raiseFdLimit();
+#ifndef _WIN32
+    signal(SIGPIPE, SIG_IGN); // запись в закрытый сокет не должна убивать сервер
 #endif
-        return 1;
-    }
-
-    listen(serverSock, 5);
-    cout << "Сервер запущен на порту " << port << endl;
 
-    fd_set master;
-    FD_ZERO(&master);
-    FD_SET(serverSock, &master);
-
-    map<SOCKET, string> clientNames;
-    unordered_map<SOCKET, string> acc; // аккумуляторы построчного приёма
-
-    while (true) {
-        fd_set copy = master;
-        int socketCount = select(0, &copy, nullptr, nullptr, nullptr);
-
-        for (int i = 0; i < socketCount; i++) {
-            SOCKET sock = copy.fd_array[i];
-
-            if (sock == serverSock) {
-                // новый клиент
-                SOCKET client = accept(serverSock, nullptr, nullptr);
-                if (client == INVALID_SOCKET) continue;
-                FD_SET(client, &master);
-
-                bool authorized = false;
-                string login = "guest", pass;
-
-                // читаем первую строку: "login:password\n"
-                string firstMsg;
-                char ch;
-                while (true) {
-                    int m = recv(client, &ch, 1, 0);
-                    if (m <= 0) { authorized = false; break; }
-                    if (ch == '\n') break;
-                    if (ch != '\r') firstMsg.push_back(ch);
-                }
-
-                if (!firstMsg.empty()) {
-                    size_t pos = firstMsg.find(':');
-                    if (pos != string::npos) {
-                        login = firstMsg.substr(0, pos);
-                        pass = firstMsg.substr(pos + 1);
-                    }
-                    else {
-                        login = firstMsg;
-                        pass = "nopass";
-                    }
-
-                    if (db.checkUser(login, pass)) {
-                        clientNames[client] = login;
-                        authorized = true;
-                    }
-                    else {
-                        if (db.addUser(login, pass, login)) {
-                            clientNames[client] = login;
-                            authorized = true;
-                        }
-                        else {
-                            authorized = false;
-                        }
-                    }
-                }
+    ServerContext ctx(db);
+    ctx.maxMsgLen = maxMsgLen;
+    ctx.authTimeout = chrono::milliseconds(authTimeoutMs);
+    try { ctx.outHighWater = static_cast<size_t>(stoul(cfg.at("out_high_watermark"))); }
+    catch (...) {}
+    try { ctx.outLowWater = static_cast<size_t>(stoul(cfg.at("out_low_watermark"))); }
+    catch (...) {}
+    try { ctx.outMaxBytes = static_cast<size_t>(stoul(cfg.at("out_max_bytes"))); }
+    catch (...) {}
+    try { ctx.historyChunk = max<size_t>(1, stoul(cfg.at("history_chunk"))); }
+    catch (...) {}
+    try { ctx.heartbeat = chrono::milliseconds(stol(cfg.at("heartbeat_ms"))); }
+    catch (...) {}
+    try { ctx.idleTimeout = chrono::milliseconds(stol(cfg.at("idle_timeout_ms"))); }
+    catch (...) {}
+    try { ctx.rateMsgs = stod(cfg.at("rate_msgs_per_sec")); }
+    catch (...) {}
+    try { ctx.rateMsgsBurst = stod(cfg.at("rate_msgs_burst")); }
+    catch (...) {}
+    try { ctx.rateBytes = stod(cfg.at("rate_bytes_per_sec")); }
+    catch (...) {}
+    try { ctx.rateBytesBurst = stod(cfg.at("rate_bytes_burst")); }
+    catch (...) {}
+    {
+        double loginMsgs = 30, loginBytes = 48 << 10;
+        try { loginMsgs = stod(cfg.at("login_msgs_per_sec")); }
+        catch (...) {}
+        try { loginBytes = stod(cfg.at("login_bytes_per_sec")); }
+        catch (...) {}
+        ctx.loginLimiter.configure(loginMsgs, loginBytes);
+    }
+    try { ctx.compressLevel = min(9, stoi(cfg.at("compression_level"))); }
+    catch (...) {}
+    {
+        // запись сообщений: пачка до persist_batch штук или persist_delay_ms, что раньше
+        size_t batch = 256;
+        long delayMs = 5;
+        string ack = "async";
+        try { batch = static_cast<size_t>(stoul(cfg.at("persist_batch"))); }
+        catch (...) {}
+        try { delayMs = stol(cfg.at("persist_delay_ms")); }
+        catch (...) {}
+        try { ack = cfg.at("persist_ack"); }
+        catch (...) {}
+        ctx.durableAck = ack == "durable";
+        ctx.writer.start(batch, chrono::milliseconds(delayMs));
+    }
+    {
+        // раздача больших рассылок: потоки пула и порог по числу получателей в реакторе
+        size_t fanoutThreads = 0;
+        try { fanoutThreads = static_cast<size_t>(stoul(cfg.at("fanout_threads"))); }
+        catch (...) {}
+        try { ctx.fanoutThreshold = max<size_t>(1, stoul(cfg.at("fanout_threshold"))); }
+        catch (...) {}
+        ctx.fanout.start(fanoutThreads);
+    }
+    // исходящее под нагрузкой: копим до конца оборота и ещё до flush_delay_us, пока поток держится
+    try { ctx.flushDelay = chrono::microseconds(stol(cfg.at("flush_delay_us"))); }
+    catch (...) {}
+    try { ctx.flushBusyEvents = max<size_t>(1, stoul(cfg.at("flush_busy_events"))); }
+    catch (...) {}
+    try { ctx.presence.setWindow(chrono::milliseconds(stol(cfg.at("presence_window_ms")))); }
+    catch (...) {}
+    string unixPath;
+    try { unixPath = cfg.at("unix_socket"); }
+    catch (...) {}
+    try { ctx.shmTransport = stoi(cfg.at("shm_transport")) != 0; }
+    catch (...) {}
 
-                if (!authorized) {
-                    string err = "FAIL\n";
-                    send(client, err.c_str(), (int)err.size(), 0);
-#ifdef _WIN32
-                    closesocket(client);
+    // горячий перезапуск: если прежний процесс ещё работает, забираем у него
+    // слушающие сокеты и всех клиентов вместо bind
+    string handoffPath;
+    try { handoffPath = cfg.at("handoff_path"); }
+    catch (...) {}
+    HandoffState inherited;
+    const bool takenOver = !handoffPath.empty() && takeOverFrom(handoffPath, inherited);
+    vector<SOCKET> listeners = inherited.listeners;
+    // реакторов не меньше, чем было слушающих сокетов: очередь accept ни одного не бросаем
+    threads = max(threads, listeners.size());
+
+#ifdef SO_REUSEPORT
+    const bool reusePort = threads > 1;
 #else
-                    close(client);
+    const bool reusePort = false;
 #endif
-                    FD_CLR(client, &master);
-                    continue;
-                }
-                else {
-                    string ok = "OK\n";
-                    send(client, ok.c_str(), (int)ok.size(), 0);
-                }
-
-                // добавляем в мапу логинов для ЛС
-                loginToSock[clientNames[client]] = client;
-
-                // сообщение о подключении
-                string msg = "[Сервер] " + clientNames[client] + " подключился\n";
-                cout << msg;
-
-                // отправляем историю (только публичное и мои приватные)
-                const string& me = clientNames[client];
-                auto history = db.getAllMessages();
-                for (const auto& m : history) {
-                    const bool isPublic = m.recipient.empty();
-                    const bool iAmSender = (m.sender == me);
-                    const bool iAmRecipient = (!m.recipient.empty() && m.recipient == me);
-                    if (!(isPublic || iAmSender || iAmRecipient)) continue;
-
-                    string line = "[" + m.sender +
-                        (m.recipient.empty() ? " -> ALL" : " -> " + m.recipient) +
-                        "] " + m.text + "\n";
-                    send(client, line.c_str(), (int)line.size(), 0);
-                }
-
-                // отправляем список пользователей подключившемуся
-                sendUsersListTo(client, db);
 
-                // оповестим остальных
-                for (u_int j = 0; j < master.fd_count; j++) {
-                    SOCKET outSock = master.fd_array[j];
-                    if (outSock != serverSock && outSock != client) {
-                        send(outSock, msg.c_str(), (int)msg.size(), 0);
-                    }
-                }
-            }
-            else {
-                char buffer[1024];
-                int n = recv(sock, buffer, sizeof(buffer), 0);
-
-                if (n <= 0) {
-                    string name = clientNames[sock];
-                    string msg = "[Сервер] " + name + " отключился\n";
-                    cout << msg;
-
-                    // чистим структуры
-                    clientNames.erase(sock);
-                    acc.erase(sock);
-                    if (!name.empty()) {
-                        auto it = loginToSock.find(name);
-                        if (it != loginToSock.end() && it->second == sock) {
-                            loginToSock.erase(it);
-                        }
-                    }
-
-                    FD_CLR(sock, &master);
+    // без SO_REUSEPORT (Windows) все реакторы делят один слушающий сокет
+    for (size_t i = 0; !takenOver && i < (reusePort ? threads : 1); i++) {
+        SOCKET s = openListener(port, reusePort);
+        if (s == INVALID_SOCKET) {
+            cerr << "Ошибка bind!" << endl;
+            for (SOCKET l : listeners) closeSocket(l);
 #ifdef _WIN32
-                    closesocket(sock);
-#else
-                    close(sock);
+            WSACleanup();
 #endif
-                    // рассылаем уведомление
-                    for (u_int j = 0; j < master.fd_count; j++) {
-                        SOCKET outSock = master.fd_array[j];
-                        if (outSock != serverSock) {
-                            send(outSock, msg.c_str(), (int)msg.size(), 0);
-                        }
-                    }
-                }
-                else {
-                    // построчный приём + фильтрация пустых
-                    acc[sock].append(buffer, buffer + n);
-
-                    size_t pos;
-                    while ((pos = acc[sock].find('\n')) != string::npos) {
-                        string line = acc[sock].substr(0, pos);
-                        acc[sock].erase(0, pos + 1);
-                        if (!line.empty() && line.back() == '\r') line.pop_back();
-
-                        string text = trim_copy(line);
-                        if (text.empty()) continue;
-
-                        // /help — краткая справка
-                        if (text == "/help") {
-                            const char* help =
-                                "[Сервер] Команды:\n"
-                                "  /users              — список пользователей\n"
-                                "  /w <login> <текст>  — личное сообщение\n"
-                                "  exit                — выход (на клиенте)\n";
-                            send(sock, help, (int)strlen(help), 0);
-                            continue;
-                        }
-
-                        // /users — выдать список
-                        if (text == "/users") {
-                            sendUsersListTo(sock, db);
-                            continue;
-                        }
-
-                        // /w <login> <текст> — личное сообщение
-                        if (text.rfind("/w ", 0) == 0) {   // ← БЕЗ обратных слэшей
-                            string rest = trim_copy(text.substr(3));
-                            size_t sp = rest.find(' ');
-                            if (sp == string::npos) {
-                                string help = "[Сервер] Использование: /w <login> <текст>\n";
-                                send(sock, help.c_str(), (int)help.size(), 0);
-                                continue;
-                            }
-                            string toLogin = trim_copy(rest.substr(0, sp));
-                            string body = trim_copy(rest.substr(sp + 1));
-                            if (toLogin.empty() || body.empty()) {
-                                string help = "[Сервер] Использование: /w <login> <текст>\n";
-                                send(sock, help.c_str(), (int)help.size(), 0);
-                                continue;
-                            }
-
-                            auto it = loginToSock.find(toLogin);
-                            if (it == loginToSock.end()) {
-                                string err = "[Сервер] Пользователь '" + toLogin + "' не в сети\n";
-                                send(sock, err.c_str(), (int)err.size(), 0);
-                                continue;
-                            }
-
-                            // ограничение длины
-                            if (body.size() > MAX_MSG_LEN) body.resize(MAX_MSG_LEN);
-
-                            string from = clientNames[sock];
-                            string out = "[" + from + " -> " + toLogin + "] " + body + "\n";
-
-                            // отправляем адресату и отправителю (подтверждение)
-                            send(it->second, out.c_str(), (int)out.size(), 0);
-                            send(sock, out.c_str(), (int)out.size(), 0);
+            return 1;
+        }
+        listeners.push_back(s);
+    }
 
-                            // сохраняем в БД как приватное
-                            db.addMessage(from, toLogin, body);
-                            continue;
-                        }
+    for (size_t i = 0; i < threads; i++) {
+        SOCKET listenSock = listeners[reusePort && i < listeners.size() ? i : 0];
+        if (reusePort && i >= listeners.size()) {
+            // прежний процесс жил с меньшим числом потоков — добираем своих слушателей
+            // (не вышло, например, без SO_REUSEPORT у старых — делим нулевой)
+            SOCKET s = openListener(port, true);
+            if (s != INVALID_SOCKET) {
+                listeners.push_back(s);
+                listenSock = s;
+            }
+        }
+        ctx.reactors.push_back(make_unique<Reactor>(ctx, i, makeEventLoop(backend), listenSock));
+        if (!ctx.reactors.back()->ok()) {
+            cerr << "Ошибка создания реактора " << i << endl;
+            return 1;
+        }
+    }
 
-                        // обычное сообщение во весь чат
-                        if (text.size() > MAX_MSG_LEN)
-                            text.resize(MAX_MSG_LEN);
+    // клиенты на этой же машине: один Unix-сокет на все реакторы (как TCP без SO_REUSEPORT).
+    // Горячему преемнику он не передаётся — тот занимает путь заново
+    SOCKET localListener = INVALID_SOCKET;
+    if (!unixPath.empty()) {
+        localListener = openLocalListener(unixPath);
+        if (localListener == INVALID_SOCKET) cerr << "Не удалось открыть Unix-сокет " << unixPath << endl;
+        else {
+            for (auto& r : ctx.reactors) r->listenLocal(localListener);
+            cout << "Локальные клиенты: " << unixPath << (ctx.shmTransport ? " (и общая память)" : "") << endl;
+        }
+    }
 
-                        string out = "[" + clientNames[sock] + "] " + text + "\n";
-                        cout << out;
+    // федерация: узлы делят пользователей; свой узел — node_id (пусто — одиночный сервер)
+    string nodeId, peersSpec, fedBind = "127.0.0.1", fedSecret;
+    int fedPort = 0;
+    try { nodeId = cfg.at("node_id"); }
+    catch (...) {}
+    try { fedPort = stoi(cfg.at("federation_port")); }
+    catch (...) {}
+    try { fedBind = cfg.at("federation_bind"); }
+    catch (...) {}
+    try { fedSecret = cfg.at("federation_secret"); }
+    catch (...) {}
+    try { peersSpec = cfg.at("federation_peers"); }
+    catch (...) {}
+    if (!nodeId.empty()) {
+        vector<PeerAddr> peers;
+        if (!parsePeers(peersSpec, peers)) cerr << "Непонятный federation_peers: " << peersSpec << endl;
+        else if (fedPort <= 0) cerr << "Не задан federation_port — федерация выключена" << endl;
+        else if (!ctx.federation.start(nodeId, fedBind, fedPort, fedSecret, peers)) cerr << "Не удалось запустить федерацию" << endl;
+        else cout << "Узел " << nodeId << ", других узлов: " << peers.size() << endl;
+    }
 
-                        db.addMessage(clientNames[sock], "", text);
+    // принятые соединения — в реактор с тем же номером, что и раньше (или по модулю)
+    for (auto& s : inherited.sessions) ctx.reactors[s.shard % threads]->adopt(s);
+
+    cout << "Сервер запущен на порту " << port << " (" << ctx.reactors[0]->backendName()
+        << ", реакторов: " << threads << ")" << endl;
+    if (takenOver) cout << "Принято соединений от прежнего процесса: " << inherited.sessions.size() << endl;
+
+    // ждём преемника: он придёт, и реакторы остановятся, чтобы отдать ему соединения
+    HandoffListener handoff;
+    SOCKET successor = INVALID_SOCKET;
+    thread handoffWaiter;
+    if (!handoffPath.empty() && handoff.open(handoffPath)) {
+        handoffWaiter = thread([&ctx, &handoff, &successor] {
+            successor = handoff.waitSuccessor();
+            if (successor == INVALID_SOCKET) return;
+            cout << "Запущен новый процесс сервера, передаём ему соединения..." << endl;
+            for (auto& r : ctx.reactors) r->stop();
+        });
+    }
 
-                        for (u_int j = 0; j < master.fd_count; j++) {
-                            SOCKET outSock = master.fd_array[j];
-                            if (outSock != serverSock && outSock != sock) {
-                                send(outSock, out.c_str(), (int)out.size(), 0);
-                            }
-                        }
-                    }
-                }
-            }
-        }
+    // нулевой реактор крутится в текущем потоке, остальные — в своих
+    vector<thread> workers;
+    for (size_t i = 1; i < threads; i++) {
+        workers.emplace_back([&ctx, i] { ctx.reactors[i]->run(); });
+    }
+    ctx.reactors[0]->run();
+    for (auto& t : workers) t.join();
+
+    // если ждали преемника и не дождались (реактор упал) — будим ожидающий поток
+    handoff.close();
+    if (handoffWaiter.joinable()) handoffWaiter.join();
+    // входящие от узлов больше не принимаем; их записи ещё успеют в очередь писателя
+    ctx.federation.stop();
+    // очередь записи — до конца; подтверждения durable ложатся в ящики и уйдут ниже
+    ctx.writer.stop();
+    if (successor != INVALID_SOCKET) {
+        HandoffState st;
+        st.listeners = listeners;
+        for (auto& r : ctx.reactors) r->exportSessions(st);
+        if (handoff.send(successor, st)) cout << "Передано соединений: " << st.sessions.size() << endl;
+        else cerr << "Не удалось передать соединения новому процессу" << endl;
+        closeSocket(successor);
     }
 
+    ctx.reactors.clear();
+    for (SOCKET l : listeners) closeSocket(l);
+    if (localListener != INVALID_SOCKET) closeSocket(localListener);
 #ifdef _WIN32
-    closesocket(serverSock);
     WSACleanup();
-#else
-    close(serverSock);
 #endif
     return 0;
 }
@@ -14,7 +14,7 @@ uint bring_to_human_view(uint val)
         ((val & 0xFF000000) >> 24);
 }
 
-uint* sha1(string message, uint msize_bytes)
+static uint* sha1_blocks(const string& message, uint msize_bytes, bool chain)
 {
     //инициализация
     uint A = H[0];
@@ -29,7 +29,8 @@ uint* sha1(string message, uint msize_bytes)
     // подсчет, сколько байт нужно, чтобы дополнить последний блок
     uint needAdditionalBytes = one_block_size_bytes - (msize_bytes - totalBlockCount * one_block_size_bytes);
 
-    if (needAdditionalBytes < 8)
+    // 0x80 и 8 байт длины; прежний sha1 оставлял место только под длину
+    if (needAdditionalBytes < (chain ? 9u : 8u))
     {
         totalBlockCount += 2;
         needAdditionalBytes += one_block_size_bytes;
@@ -80,11 +81,11 @@ uint* sha1(string message, uint msize_bytes)
         }
 
         // инициализация  
-        uint a = H[0];
-        uint b = H[1];
-        uint c = H[2];
-        uint d = H[3];
-        uint e = H[4];
+        uint a = chain ? A : H[0];
+        uint b = chain ? B : H[1];
+        uint c = chain ? C : H[2];
+        uint d = chain ? D : H[3];
+        uint e = chain ? E : H[4];
 
         // пересчитываем
         for (int j = 0; j < block_expend_size_uints; j++)
@@ -140,3 +141,13 @@ uint* sha1(string message, uint msize_bytes)
     delete[] newMessage;
     return digest;
 }
+
+uint* sha1(string message, uint msize_bytes)
+{
+    return sha1_blocks(message, msize_bytes, false);
+}
+
+uint* sha1_std(string message, uint msize_bytes)
+{
+    return sha1_blocks(message, msize_bytes, true);
+}
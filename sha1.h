@@ -26,4 +26,9 @@ const uint H[5] = {
 uint cycle_shift_left(uint val, int bit_count); // циклический сдвиг влево
 uint bring_to_human_view(uint val); // перевернуть представление числа в памяти в человеческий вид
 
+// Хэши паролей в базе: каждый блок начинается с констант H, а не с результата
+// предыдущего, и дополнение ошибается на байт, так что после 55 байт это уже
+// не стандартный SHA-1. Менять нельзя — старые пароли перестанут подходить.
 uint* sha1(string message, uint msize_bytes);
+// стандартный SHA-1 (для HMAC между узлами)
+uint* sha1_std(string message, uint msize_bytes);